@@ -0,0 +1,15 @@
+## Finds liburing
+#
+# Sets:
+#   URing_INCLUDE_DIRS - must be added to include path to use liburing.
+#   URing_LIBRARY - liburing.
+#   URing_FOUND - Set if the dependencies were found.
+
+find_path( URing_INCLUDE_DIRS liburing.h )
+
+find_library( URing_LIBRARY uring )
+
+if( EXISTS ${URing_INCLUDE_DIRS} AND EXISTS ${URing_LIBRARY} )
+    set( URing_FOUND TRUE )
+endif()
+
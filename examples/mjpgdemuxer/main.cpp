@@ -1,4 +1,5 @@
 #include "mkvreader/matroska_parser.h"
+#include "mkvreader/merged_frame_reader.h"
 
 #include <iostream>
 
@@ -31,7 +32,9 @@ int main( int argc, const char * const argv[] )
     const char *filename = (argc >= 2) ? argv[1] : "test.mkv";
     std::cout << "Reading " << filename << "\n";
 
-    mkvreader::MatroskaParser parser( filename );
+    mkvreader::IoOptions io_options;
+    io_options.bufferSize = 1024 * 1024;
+    mkvreader::MatroskaParser parser( filename, io_options );
     if (int failure = parser.Parse( true, true ))
     {
         std::cerr << "Parsing failed: " << failure << "\n";
@@ -99,48 +102,40 @@ int main( int argc, const char * const argv[] )
             << "\n";
     }
 
-    parser.EnableTrack( video_track );
-    parser.EnableTrack( pcd_track );
+    std::vector< uint16 > tracks;
+    tracks.push_back( video_track );
+    tracks.push_back( pcd_track );
+    mkvreader::MergedFrameReader reader( parser, tracks );
     parser.SetMaxQueueDepth( 10 );
 
     int video_count = 0;
     int   pcd_count = 0;
     boost::ptr_vector< mkvreader::MatroskaFrame > video_frames;
     boost::ptr_vector< mkvreader::MatroskaFrame >   pcd_frames;
-    bool progress = false;
-    while (!parser.IsEof() || progress)
+    uint16 track_idx = 0;
+    while (!reader.IsEnd())
     {
-        progress = false;
-        mkvreader::MatroskaFrame *video_frame = NULL;
-        do
+        mkvreader::MatroskaFrame *frame = reader.ReadFrame( track_idx );
+        if (!frame)
         {
-            video_frame = parser.ReadSingleFrame( video_track ); 
-            if (video_frame)
-            {
-                video_count++;
-                progress = true;
-                video_frames.push_back( video_frame );
-            }
+            std::cout << "A track can't be read, yet.\n";
+            break;
         }
-        while (video_frame);
-        std::cout << "Got " << video_count << " video frames.\n";
 
-        mkvreader::MatroskaFrame *pcd_frame = NULL;
-        do
+        if (track_idx == video_track)
         {
-            pcd_frame = parser.ReadSingleFrame( pcd_track ); 
-            if (pcd_frame)
-            {
-                pcd_count++;
-                progress = true;
-                pcd_frames.push_back( pcd_frame );
-            }
+            video_count++;
+            video_frames.push_back( frame );
+        }
+        else
+        {
+            pcd_count++;
+            pcd_frames.push_back( frame );
         }
-        while (pcd_frame);
-        std::cout << "Got " <<   pcd_count << "   pcd frames.\n";
-
-        if (parser.IsEof()) std::cout << "EOF.  progress: " << progress << "\n";
     }
+    std::cout << "Got " << video_count << " video frames.\n";
+    std::cout << "Got " <<   pcd_count << "   pcd frames.\n";
+    if (reader.IsEnd()) std::cout << "EOF.\n";
     
     std::cout << "\nVideo frames:\n";
     PrintQueue( video_frames );
@@ -149,6 +144,13 @@ int main( int argc, const char * const argv[] )
     PrintQueue( pcd_frames );
     std::cout << "\n";
 
+    mkvreader::IoStats requested, issued;
+    if (parser.GetIoStats( requested, issued ))
+    {
+        std::cout << "Parser made " << requested.reads << " reads & " << requested.seeks << " seeks.\n";
+        std::cout << "File got " << issued.reads << " reads & " << issued.seeks << " seeks.\n";
+    }
+
     return 0;
 }
 
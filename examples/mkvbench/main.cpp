@@ -0,0 +1,229 @@
+#include "mkvreader/matroska_parser.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+
+typedef boost::ptr_vector< mkvreader::MatroskaFrame > FrameList;
+
+
+double Now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+void Report( const char *name, size_t bytes, double seconds )
+{
+    std::cout << (boost::format( "  %-12s %10.1f MB/s  (%.3f s)\n" )
+        % name % (bytes / seconds / 1e6) % seconds);
+}
+
+
+void ReportRate( const char *name, size_t clips, double seconds )
+{
+    std::cout << (boost::format( "  %-12s %10.1f clips/s  (%.1f us/clip)\n" )
+        % name % (clips / seconds) % (seconds * 1e6 / std::max( clips, size_t( 1 ) )));
+}
+
+
+    // Returns the median time to open & parse a file, in seconds.
+double MeasureOpenLatency( const char *filename, bool lazy, int passes )
+{
+    std::vector< double > times;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        const double start = Now();
+        mkvreader::MatroskaParser parser( filename );
+        parser.SetLazyMetadata( lazy );
+        if (parser.Parse( true, true ) != 0) return -1.0;
+        times.push_back( Now() - start );
+    }
+
+    std::sort( times.begin(), times.end() );
+    return times[times.size() / 2];
+}
+
+
+    // Reads every frame of every track into memory, so the benchmarks below measure
+    // only payload export.
+bool ReadAllFrames( const char *filename, FrameList &frames )
+{
+    mkvreader::MatroskaParser parser( filename );
+    if (int failure = parser.Parse( true, true ))
+    {
+        std::cerr << "Parsing failed: " << failure << "\n";
+        return false;
+    }
+
+    for (uint32 t = 0; t < parser.GetTrackCount(); t++) parser.EnableTrack( t );
+
+    bool progress = true;
+    while (!parser.IsEof() || progress)
+    {
+        progress = false;
+        for (uint32 t = 0; t < parser.GetTrackCount(); t++)
+        {
+            while (mkvreader::MatroskaFrame *frame = parser.ReadSingleFrame( uint16( t ) ))
+            {
+                frames.push_back( frame );
+                progress = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+    // Parses a file & reads all of its frames, as a job processing many clips would.
+size_t ProcessClip( mkvreader::MatroskaParser &parser )
+{
+    if (parser.Parse( true, true ) != 0) return 0;
+
+    for (uint32 t = 0; t < parser.GetTrackCount(); t++) parser.EnableTrack( t );
+
+    size_t num_frames = 0;
+    bool progress = true;
+    while (!parser.IsEof() || progress)
+    {
+        progress = false;
+        for (uint32 t = 0; t < parser.GetTrackCount(); t++)
+        {
+            while (mkvreader::MatroskaFrame *frame = parser.ReadSingleFrame( uint16( t ) ))
+            {
+                parser.RecycleFrame( frame );
+                num_frames++;
+                progress = true;
+            }
+        }
+    }
+
+    return num_frames;
+}
+
+
+    // Gathers each frame into a buffer, then writes it.
+size_t WriteGathered( const FrameList &frames, int fd )
+{
+    size_t total_size = 0;
+    mkvreader::ByteArray payload;
+    for (FrameList::const_iterator frame = frames.begin(); frame != frames.end(); ++frame)
+    {
+        payload.clear();
+        frame->get_payload( payload );
+        if (!payload.empty()) total_size += write( fd, &payload.front(), payload.size() );
+    }
+    return total_size;
+}
+
+
+    // Writes batches of frames straight from their buffers.
+size_t WriteScattered( const FrameList &frames, int fd )
+{
+    static const size_t BatchSize = 64;
+
+    size_t total_size = 0;
+    std::vector< iovec > iovecs;
+    for (FrameList::const_iterator batch = frames.begin(); batch != frames.end(); )
+    {
+        FrameList::const_iterator batch_end = batch;
+        for (size_t i = 0; i < BatchSize && batch_end != frames.end(); i++) ++batch_end;
+
+        iovecs.clear();
+        mkvreader::get_iovecs( batch, batch_end, iovecs );
+        for (size_t i = 0; i < iovecs.size(); i += IOV_MAX)
+        {
+            ssize_t written = writev( fd, &iovecs[i], int( std::min( iovecs.size() - i, size_t( IOV_MAX ) ) ) );
+            if (written > 0) total_size += size_t( written );
+        }
+        batch = batch_end;
+    }
+    return total_size;
+}
+
+
+    // Usage: mkvbench [file [passes [open_budget_ms]]]
+    // Exits with 2 if the median lazy open takes longer than the budget.
+int main( int argc, const char * const argv[] )
+{
+    const char *filename = (argc >= 2) ? argv[1] : "test.mkv";
+    const int passes = std::max( (argc >= 3) ? atoi( argv[2] ) : 20, 1 );
+    const double open_budget_ms = (argc >= 4) ? atof( argv[3] ) : 5.0;
+
+    FrameList frames;
+    if (!ReadAllFrames( filename, frames )) return 1;
+    std::cout << "Read " << frames.size() << " frames from " << filename << "\n";
+
+    int fd = open( "/dev/null", O_WRONLY );
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open /dev/null\n";
+        return 1;
+    }
+
+    std::cout << "Payload export, " << passes << " passes:\n";
+
+    size_t bytes = 0;
+    double start = Now();
+    for (int pass = 0; pass < passes; pass++) bytes += WriteGathered( frames, fd );
+    Report( "get_payload", bytes, Now() - start );
+
+    bytes = 0;
+    start = Now();
+    for (int pass = 0; pass < passes; pass++) bytes += WriteScattered( frames, fd );
+    Report( "get_iovecs", bytes, Now() - start );
+
+    close( fd );
+
+    std::cout << "Clip processing, " << passes << " passes:\n";
+
+    mkvreader::IoOptions io_options;
+    io_options.bufferSize = 64 * 1024;
+
+    size_t clips = 0;
+    start = Now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        mkvreader::MatroskaParser parser( filename, io_options );
+        clips += (ProcessClip( parser ) > 0);
+    }
+    ReportRate( "new parser", clips, Now() - start );
+
+    clips = 0;
+    start = Now();
+    mkvreader::MatroskaParser reused( filename, io_options );
+    for (int pass = 0; pass < passes; pass++)
+    {
+        reused.Open( filename, io_options );
+        clips += (ProcessClip( reused ) > 0);
+    }
+    ReportRate( "Open()", clips, Now() - start );
+
+    std::cout << "Open latency (median of " << passes << "):\n";
+
+    const double eager = MeasureOpenLatency( filename, false, passes );
+    const double lazy = MeasureOpenLatency( filename, true, passes );
+    std::cout << (boost::format( "  %-12s %10.3f ms\n" ) % "eager" % (eager * 1e3));
+    std::cout << (boost::format( "  %-12s %10.3f ms  (budget %.3f ms)\n" ) % "lazy" % (lazy * 1e3) % open_budget_ms);
+    if (lazy * 1e3 > open_budget_ms)
+    {
+        std::cerr << "Lazy open exceeded its budget\n";
+        return 2;
+    }
+
+    return 0;
+}
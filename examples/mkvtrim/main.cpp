@@ -0,0 +1,35 @@
+#include "mkvreader/matroska_trim.h"
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+
+int main( int argc, const char * const argv[] )
+{
+    if (argc != 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input.mkv> <output.mkv> <start seconds> <end seconds>\n";
+        return 2;
+    }
+
+    uint64 start_ns = uint64( atof( argv[3] ) * 1e9 );
+    uint64 end_ns   = uint64( atof( argv[4] ) * 1e9 );
+
+    try
+    {
+        mkvreader::TrimStats stats = mkvreader::TrimFile( argv[1], argv[2], start_ns, end_ns );
+        std::cout << (boost::format( "Copied %d clusters (%d bytes), rewrote %d (%d bytes).\n" )
+            % stats.clustersCopied % stats.bytesCopied % stats.clustersRewritten % stats.bytesRewritten);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file async_frames.h
+    \brief A C++20 coroutine interface for reading frames, so one thread can demux many files.
+
+    The rest of the library is C++03, so this is header-only & needn't be used.
+*/
+
+#ifndef _ASYNC_FRAMES_H_
+#define _ASYNC_FRAMES_H_
+
+
+#if !defined( __cpp_impl_coroutine )
+#error "async_frames.h requires C++20 coroutines."
+#endif
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "mkvreader/async_io.h"
+#include "mkvreader/matroska_parser.h"
+#include "mkvreader/merged_frame_reader.h"
+
+
+namespace mkvreader {
+
+
+/// A coroutine which returns a value to the coroutine awaiting it.
+/// It doesn't start until it's awaited.
+template< typename T >
+class Task {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle< promise_type > Handle;
+
+        // Resumes the awaiting coroutine, once the task has finished.
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend( Handle handle ) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        T value{};
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task( Handle::from_promise( *this ) ); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_value( T result ) { value = std::move( result ); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task( Task &&other ) noexcept: m_Handle( std::exchange( other.m_Handle, Handle() ) ) {}
+    Task( const Task & ) = delete;
+    Task &operator=( const Task & ) = delete;
+    ~Task() { if (m_Handle) m_Handle.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+    {
+        m_Handle.promise().continuation = awaiting;
+        return m_Handle;
+    }
+
+    T await_resume()
+    {
+        if (m_Handle.promise().error) std::rethrow_exception( m_Handle.promise().error );
+        return std::move( m_Handle.promise().value );
+    }
+
+private:
+    explicit Task( Handle handle ): m_Handle( handle ) {}
+
+    Handle m_Handle;
+};
+
+
+/// A top-level coroutine, run by AsyncDemuxLoop::Spawn().
+class DemuxTask {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle< promise_type > Handle;
+
+    struct promise_type {
+        std::exception_ptr error;
+
+        DemuxTask get_return_object() { return DemuxTask( Handle::from_promise( *this ) ); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    DemuxTask( DemuxTask &&other ) noexcept: m_Handle( std::exchange( other.m_Handle, Handle() ) ) {}
+    DemuxTask( const DemuxTask & ) = delete;
+    DemuxTask &operator=( const DemuxTask & ) = delete;
+    ~DemuxTask() { if (m_Handle) m_Handle.destroy(); }
+
+        // Gives up ownership of the coroutine.
+    Handle Release() { return std::exchange( m_Handle, Handle() ); }
+
+private:
+    explicit DemuxTask( Handle handle ): m_Handle( handle ) {}
+
+    Handle m_Handle;
+};
+
+
+class AsyncDemuxLoop;
+
+
+/// Suspends the awaiting coroutine until a read, queued with AsyncIoContext, completes.
+class ReadAwaiter {
+public:
+    ReadAwaiter( AsyncDemuxLoop &loop, AsyncReadRequest *request ): m_Loop( loop ), m_Request( request ) {}
+
+        // There's nothing to wait for if the data's been read or isn't read ahead.
+    bool await_ready() const noexcept { return !m_Request; }
+    void await_suspend( std::coroutine_handle<> awaiting );
+    void await_resume() const noexcept {}
+
+private:
+    AsyncDemuxLoop &m_Loop;
+    AsyncReadRequest *m_Request;
+};
+
+
+/// Runs DemuxTasks on the calling thread, resuming them as their reads complete.
+///
+/// The reads are those of the parsers' own AsyncReadCallbacks, so the data's read once,
+/// into the buffers the parsers then read from.  They're submitted together, on each
+/// Poll(), so one thread can keep reads of hundreds of files in flight.
+class AsyncDemuxLoop {
+public:
+    AsyncDemuxLoop() {}
+
+    /// Destroys any tasks which haven't finished.
+    ~AsyncDemuxLoop()
+    {
+        for (size_t i = 0; i < m_Tasks.size(); i++) m_Tasks[i].destroy();
+    }
+
+    AsyncDemuxLoop( const AsyncDemuxLoop & ) = delete;
+    AsyncDemuxLoop &operator=( const AsyncDemuxLoop & ) = delete;
+
+    /// Schedules a task to be started by the next Poll() or Run().
+    void Spawn( DemuxTask task )
+    {
+        DemuxTask::Handle handle = task.Release();
+        m_Tasks.push_back( handle );
+        m_Ready.push_back( handle );
+    }
+
+    /// Resumes the tasks whose reads have completed, without blocking.
+    /// Exceptions escaping a task are rethrown, once it's been destroyed.
+    /// \return whether any tasks have yet to finish.
+    bool Poll()
+    {
+        for (size_t i = 0; i < m_Waiting.size(); )
+        {
+            if (AsyncIoContext::Instance().Poll( *m_Waiting[i].request ))
+            {
+                m_Ready.push_back( m_Waiting[i].handle );
+                m_Waiting.erase( m_Waiting.begin() + i );
+            }
+            else i++;
+        }
+
+            // Coroutines resumed here may make more ready, but those wait for the next Poll().
+        std::deque< std::coroutine_handle<> > ready;
+        ready.swap( m_Ready );
+        for (size_t i = 0; i < ready.size(); i++) ready[i].resume();
+
+        for (size_t i = 0; i < m_Tasks.size(); )
+        {
+            if (!m_Tasks[i].done()) { i++; continue; }
+
+            std::exception_ptr error = m_Tasks[i].promise().error;
+            m_Tasks[i].destroy();
+            m_Tasks.erase( m_Tasks.begin() + i );
+            if (error) std::rethrow_exception( error );
+        }
+
+        return !m_Tasks.empty();
+    }
+
+    /// Runs until all of the tasks have finished, blocking only when none can be resumed.
+    void Run()
+    {
+        while (Poll())
+        {
+            if (!m_Ready.empty()) continue;
+            if (m_Waiting.empty())
+                throw std::runtime_error( "AsyncDemuxLoop: tasks are suspended on something other than a read." );
+
+            AsyncIoContext::Instance().Wait( *m_Waiting.front().request );
+        }
+    }
+
+    /// Awaitable, which completes with a read.  A NULL request completes immediately.
+    ReadAwaiter Await( AsyncReadRequest *request ) { return ReadAwaiter( *this, request ); }
+
+private:
+    friend class ReadAwaiter;
+
+    struct Waiter {
+        AsyncReadRequest *request;
+        std::coroutine_handle<> handle;
+    };
+
+    std::vector< DemuxTask::Handle > m_Tasks;
+    std::deque< std::coroutine_handle<> > m_Ready;
+
+        // In the order they were queued.
+    std::vector< Waiter > m_Waiting;
+};
+
+
+inline void ReadAwaiter::await_suspend( std::coroutine_handle<> awaiting )
+{
+    AsyncDemuxLoop::Waiter waiter = { m_Request, awaiting };
+    m_Loop.m_Waiting.push_back( waiter );
+}
+
+
+/// Reads the frames of a set of tracks from a parser, in order of timecode, suspending
+/// until the next cluster's been read.  Use one per parser, each in its own DemuxTask:
+///
+///     DemuxTask Demux( AsyncDemuxLoop &loop, MatroskaParser &parser, std::vector< uint16 > tracks )
+///     {
+///         AsyncFrameReader reader( loop, parser, tracks );
+///         uint16 trackIdx = 0;
+///         while (MatroskaFrame *frame = co_await reader.Next( trackIdx ))
+///         {
+///             ...
+///             parser.RecycleFrame( frame );
+///         }
+///     }
+///
+/// The parser should be opened with IoOptions::asyncReadAhead & parsed already.  Otherwise,
+/// its reads block the loop.  Clusters bigger than IoOptions::readAheadSize may still
+/// block it on the rest of their reads, as may deferred payloads (see
+/// MatroskaParser::SetDeferredPayloads()), which are loaded as each track's next frame is
+/// taken from the parser.
+/// Frames are merged by a MergedFrameReader, so they're returned in timecode order, with
+/// the same bound on how far the file's read ahead for tracks without a frame.
+class AsyncFrameReader {
+public:
+    /// Enables the tracks, by index, on the parser.
+    AsyncFrameReader( AsyncDemuxLoop &loop, MatroskaParser &parser, const std::vector< uint16 > &trackIdxs )
+    :
+        m_Loop( loop ),
+        m_Parser( parser ),
+        m_Reader( parser, trackIdxs )
+    {
+    }
+
+    AsyncFrameReader( const AsyncFrameReader & ) = delete;
+    AsyncFrameReader &operator=( const AsyncFrameReader & ) = delete;
+
+    /// See MergedFrameReader::SetLookahead().
+    void SetLookahead( uint64 timecode ) { m_Reader.SetLookahead( timecode ); }
+
+    /// Returns the next frame, which the caller then owns, & the index of its track.
+    /// Pass it to MatroskaParser::RecycleFrame(), when done.  trackIdx is written when
+    /// the task finishes, so it must outlive it.
+    /// \return NULL at the end of all of the tracks, or if a track can't be read, yet
+    /// (follow mode, or the byte budgets).  IsEnd() tells which.
+    Task< MatroskaFrame * > Next( uint16 &trackIdx )
+    {
+        while (m_Reader.NeedsCluster())
+        {
+            co_await m_Loop.Await( m_Parser.ReadAhead() );
+
+                // Stop if there's nothing more to read, yet.
+            if (m_Reader.ReadCluster() != 0) break;
+        }
+
+        co_return m_Reader.TakeFrame( trackIdx );
+    }
+
+    /// Whether all of the tracks have ended.
+    bool IsEnd() const { return m_Reader.IsEnd(); }
+
+private:
+    AsyncDemuxLoop &m_Loop;
+    MatroskaParser &m_Parser;
+    MergedFrameReader m_Reader;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _ASYNC_FRAMES_H_
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file async_io.h
+    \brief Asynchronous read-ahead, shared by all parsers in the process.
+*/
+
+#ifndef _ASYNC_IO_H_
+#define _ASYNC_IO_H_
+
+
+#include <vector>
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "ebml/IOCallback.h"
+
+
+namespace mkvreader {
+
+
+/// A single read, queued with AsyncIoContext.
+struct AsyncReadRequest {
+    AsyncReadRequest();
+
+    int fd;
+    uint64 offset;
+    std::vector<uint8> buffer;  ///< Its size determines how much is read.
+
+    /// Number of bytes read, or a negated errno value.  Only valid when done.
+    int64 result;
+
+    /// Set by Queue() & only cleared by Wait() or Poll(), on the queuing thread, so
+    /// done & result needn't be read under a lock, once it's clear.
+    bool in_flight;
+    bool done;
+};
+
+
+/// Process-wide queue of reads, shared by every AsyncReadCallback, so that reads
+/// from all parsers are submitted to the kernel together.  Uses io_uring, when
+/// built with it and the kernel supports it.  Otherwise, it falls back to a small
+/// pool of threads calling pread, so no caller waits on another's reads.
+/// Thread-safe.
+class AsyncIoContext {
+public:
+    static AsyncIoContext &Instance();
+
+    /// Indicates whether reads are really asynchronous.
+    bool UsingIoUring() const;
+
+    /// Adds a request to the queue.  It's not necessarily submitted until
+    /// Submit() or Wait() is called.  The request must not be modified or
+    /// destroyed until it's done.
+    void Queue( AsyncReadRequest &request );
+
+    /// Submits all queued requests from all callers.
+    void Submit();
+
+    /// Blocks until the request has completed, submitting it if necessary.
+    void Wait( AsyncReadRequest &request );
+
+    /// Submits all queued requests & collects any completions, without blocking,
+    /// for event loops that check on requests rather than wait for them.
+    /// \return whether the request is done.
+    bool Poll( AsyncReadRequest &request );
+
+private:
+    AsyncIoContext();
+    ~AsyncIoContext();
+    AsyncIoContext( const AsyncIoContext & );
+    AsyncIoContext &operator=( const AsyncIoContext & );
+
+    void SubmitLocked();
+    void Reap( bool block, boost::unique_lock< boost::mutex > &lock );
+    void RunFallbackThread();
+
+    struct Ring;
+    boost::scoped_ptr< Ring > m_Ring;   ///< NULL, when falling back to pread.
+
+    struct Fallback;
+    boost::scoped_ptr< Fallback > m_Fallback;   ///< NULL, when using io_uring.
+
+    boost::mutex m_Mutex;
+    boost::condition_variable m_Reaped;
+    bool m_Reaping;
+    std::vector< AsyncReadRequest * > m_Queued;
+};
+
+
+/// Reads a file through AsyncIoContext, keeping a window of large reads in flight
+/// ahead of the current file position.  The caller only waits for the read it's
+/// consuming; at least one more is always in flight beyond it.
+class AsyncReadCallback : public libebml::IOCallback {
+public:
+    /// \param read_size size of each read-ahead request, in bytes.
+    /// \param depth number of read-ahead requests to keep in flight.  At least 2.
+    AsyncReadCallback( const char *filename, size_t read_size, unsigned int depth );
+    virtual ~AsyncReadCallback();
+
+    /// Makes sure the data at a position is being read, without waiting for it.
+    /// \return the request to wait for, with AsyncIoContext::Wait() or Poll(), or NULL
+    /// if the data's already been read (or the position's at the end of the file).
+    AsyncReadRequest *ReadAhead( uint64 pos );
+
+    virtual uint32 read( void *buffer, size_t size );
+    virtual void setFilePointer( int64 offset, libebml::seek_mode mode = libebml::seek_beginning );
+    virtual size_t write( const void *buffer, size_t size );
+    virtual uint64 getFilePointer();
+    virtual void close();
+
+private:
+    AsyncReadRequest *FindRequest( uint64 pos );
+    bool IsStale( const AsyncReadRequest &request ) const;
+    void Retire( AsyncReadRequest &request );
+    void RestartWindow( uint64 pos );
+    void FillWindow();
+
+    /// Rereads the file's size, in case it's grown.
+    /// \return whether it has.
+    bool UpdateFileSize();
+
+    AsyncIoContext &m_Context;
+    int m_Fd;
+    uint64 m_FileSize;
+    uint64 m_Pos;
+    uint64 m_NextOffset;    ///< Where the next read-ahead request will start.
+    size_t m_ReadSize;
+    std::vector< AsyncReadRequest > m_Window;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _ASYNC_IO_H_
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file chapter_index.h
+    \brief Finds the chapters in effect at a given time.
+*/
+
+#ifndef _CHAPTER_INDEX_H_
+#define _CHAPTER_INDEX_H_
+
+
+#include <vector>
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+class MatroskaChapterInfo;
+
+
+/// An interval index over chapters & their sub-chapters, at all levels.  It refers to
+/// the chapters, so it must be rebuilt if they change.
+class ChapterIndex {
+public:
+    /// Indexes chapters & their sub-chapters.  Sub-chapters without an end time end
+    /// with their parent.
+    void Build( const std::vector< MatroskaChapterInfo > &chapters );
+    void Clear();
+
+    size_t GetSize() const { return m_Entries.size(); }
+
+    /// Appends the chapters with timeStart <= timecode < timeEnd to dest, in order of
+    /// start time.  O(log n), plus the number found.
+    void Find( uint64 timecode, std::vector< const MatroskaChapterInfo * > &dest ) const;
+
+private:
+    struct Entry {
+        uint64 start;
+        uint64 end;
+        const MatroskaChapterInfo *chapter;
+
+        bool operator<( const Entry &other ) const { return start < other.start; }
+    };
+
+    void Add( const std::vector< MatroskaChapterInfo > &chapters, uint64 parent_end );
+    uint64 BuildMaxEnd( size_t begin, size_t end );
+    void Find( size_t begin, size_t end, uint64 timecode, std::vector< const MatroskaChapterInfo * > &dest ) const;
+
+        // Sorted by start, & treated as a balanced tree, with each range's middle entry as
+        // its root.  m_MaxEnd holds the latest end within the subtree rooted at each entry.
+    std::vector< Entry > m_Entries;
+    std::vector< uint64 > m_MaxEnd;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _CHAPTER_INDEX_H_
@@ -0,0 +1,182 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file io_callbacks.h
+    \brief IOCallback implementations used by MatroskaParser.
+*/
+
+#ifndef _IO_CALLBACKS_H_
+#define _IO_CALLBACKS_H_
+
+
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+#include "ebml/IOCallback.h"
+
+
+namespace mkvreader {
+
+
+/// Selects how MatroskaParser reads a file.
+struct IoOptions {
+    IoOptions();
+
+    /// Read through the process-wide asynchronous read-ahead queue (which uses
+    /// io_uring, where available), rather than with blocking stdio reads.
+    bool asyncReadAhead;
+    /// Size of each read-ahead request, in bytes.  Ideally, at least a cluster.
+    size_t readAheadSize;
+    /// Number of read-ahead requests to keep in flight, per file.
+    unsigned int readAheadDepth;
+    /// If non-zero, reads are coalesced into blocks of this size, by a BufferedReadCallback.
+    size_t bufferSize;
+    /// For one-pass scans: read with a DirectReadCallback, which keeps the file out
+    /// of the page cache.  Uses bufferSize (or 1 MB, if that's 0) as its block size.
+    bool directScan;
+};
+
+
+/// Counts of calls made on an IOCallback.
+struct IoStats {
+    IoStats();
+
+    uint64 reads;
+    uint64 seeks;
+    uint64 bytesRead;
+};
+
+
+/// Opens a file for reading, as specified by options.
+libebml::IOCallback *OpenFileCallback( const char *filename, const IoOptions &options );
+
+
+/// Read-only access to a buffer in memory.  Unlike libebml's MemIOCallback,
+/// this doesn't copy the buffer, which must outlive it.
+class MemoryReadCallback : public libebml::IOCallback {
+public:
+    MemoryReadCallback( const uint8 *data, size_t size );
+
+    const uint8 *GetData() const { return m_Data; }
+    size_t GetSize() const { return m_Size; }
+
+    virtual uint32 read( void *buffer, size_t size );
+    virtual void setFilePointer( int64 offset, libebml::seek_mode mode = libebml::seek_beginning );
+    virtual size_t write( const void *buffer, size_t size );
+    virtual uint64 getFilePointer();
+    virtual void close();
+
+private:
+    const uint8 *m_Data;
+    size_t m_Size;
+    size_t m_Pos;
+};
+
+
+/// Serves the many small reads made by libebml from a large buffer, so that the
+/// underlying file sees a few large reads, instead.  Seeks just move the position
+/// and only reach the underlying file if a read then falls outside the buffer.
+class BufferedReadCallback : public libebml::IOCallback {
+public:
+    /// \param inner the callback to read through, which this takes ownership of.
+    /// \param block_size size of the buffer & of each read from inner.
+    BufferedReadCallback( libebml::IOCallback *inner, size_t block_size );
+
+    /// Switches to reading through another callback, which this takes ownership of.
+    /// The buffer is kept, but its contents & the statistics are discarded.
+    void Reset( libebml::IOCallback *inner );
+
+    size_t GetBlockSize() const { return m_Buffer.size(); }
+    libebml::IOCallback *GetInner() const { return m_Inner.get(); }
+
+    /// Calls made on this object (i.e. by the parser).
+    const IoStats &GetStats() const { return m_Stats; }
+    /// Calls passed through to the underlying callback.
+    const IoStats &GetInnerStats() const { return m_InnerStats; }
+
+    virtual uint32 read( void *buffer, size_t size );
+    virtual void setFilePointer( int64 offset, libebml::seek_mode mode = libebml::seek_beginning );
+    virtual size_t write( const void *buffer, size_t size );
+    virtual uint64 getFilePointer();
+    virtual void close();
+
+private:
+    size_t ReadInner( uint64 pos, uint8 *buffer, size_t size );
+
+    boost::scoped_ptr< libebml::IOCallback > m_Inner;
+    std::vector< uint8 > m_Buffer;
+    uint64 m_BufferPos;     ///< File offset of m_Buffer[0].
+    size_t m_BufferLen;     ///< Number of valid bytes in m_Buffer.
+    uint64 m_Pos;
+    uint64 m_InnerPos;      ///< Where inner's file pointer is, if known.
+
+    IoStats m_Stats;
+    IoStats m_InnerStats;
+};
+
+
+/// Reads a file in large, aligned blocks with O_DIRECT, so that a full pass over
+/// it doesn't evict other data from the page cache.  Where O_DIRECT isn't supported,
+/// falls back to normal reads, but tells the kernel to drop each block, once consumed.
+class DirectReadCallback : public libebml::IOCallback {
+public:
+    /// \param block_size size of each read, rounded up to a multiple of the alignment.
+    DirectReadCallback( const char *filename, size_t block_size );
+    virtual ~DirectReadCallback();
+
+    /// Indicates whether O_DIRECT is really in use.
+    bool UsingDirectIo() const { return m_Direct; }
+
+    virtual uint32 read( void *buffer, size_t size );
+    virtual void setFilePointer( int64 offset, libebml::seek_mode mode = libebml::seek_beginning );
+    virtual size_t write( const void *buffer, size_t size );
+    virtual uint64 getFilePointer();
+    virtual void close();
+
+private:
+    DirectReadCallback( const DirectReadCallback & );
+    DirectReadCallback &operator=( const DirectReadCallback & );
+
+    bool Fill( uint64 pos );
+
+    /// Rereads the file's size, in case it's grown.
+    /// \return whether it has.
+    bool UpdateFileSize();
+
+    int m_Fd;
+    bool m_Direct;
+    uint8 *m_Buffer;        ///< Aligned, for O_DIRECT.
+    size_t m_BlockSize;
+    uint64 m_BufferPos;
+    size_t m_BufferLen;
+    uint64 m_Pos;
+    uint64 m_FileSize;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _IO_CALLBACKS_H_
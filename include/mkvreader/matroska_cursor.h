@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file matroska_cursor.h
+    \brief Independent readers of one parsed file, for demuxing different parts
+        of it at once.
+*/
+
+#ifndef _MATROSKA_CURSOR_H_
+#define _MATROSKA_CURSOR_H_
+
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/ptr_container/ptr_deque.hpp>
+
+#include "mkvreader/matroska_parser.h"
+
+
+namespace mkvreader {
+
+
+struct ClusterLocation;
+class BufferPool;
+
+
+/// A parsed file, shared by any number of MatroskaCursors.  It's immutable once
+/// opened, so it may be used from multiple threads at once.
+class MatroskaFile: boost::noncopyable {
+public:
+    /// Parses a file's metadata & locates its clusters.  Throws on failure.
+    static boost::shared_ptr< const MatroskaFile > Open( const char *filename );
+    ~MatroskaFile();
+
+    const std::vector< MatroskaTrackInfo > &GetTracks() const { return m_Tracks; }
+    uint16 FindTrack( uint16 trackNum ) const;
+    uint64 GetTimecodeScale() const { return m_TimecodeScale; }
+    /// In seconds.
+    double GetDuration() const { return m_Duration; }
+    const std::vector< ClusterLocation > &GetClusters() const { return m_Clusters; }
+
+    /// Returns the index of the last cluster starting at or before timecode (in ns).
+    size_t FindCluster( uint64 timecode ) const;
+
+    /// Reads with pread(), which is safe to use concurrently.
+    size_t ReadAt( uint64 pos, void *buffer, size_t size ) const;
+
+    /// Converts a block's timecode, in units of the segment's TimecodeScale, to ns.
+    uint64 BlockTimecode( uint16 trackIdx, uint64 timecode ) const;
+
+private:
+    explicit MatroskaFile( const char *filename );
+
+    std::vector< MatroskaTrackInfo > m_Tracks;
+    uint64 m_TimecodeScale;
+    double m_Duration;
+    std::vector< ClusterLocation > m_Clusters;
+    int m_Fd;
+};
+
+typedef boost::shared_ptr< const MatroskaFile > matroska_file_ptr;
+
+
+/// Reads frames from a MatroskaFile, with a position & queues of its own.  Each
+/// cursor should be used by one thread at a time.  Frames refer to the cluster
+/// they were read from, rather than copying their payloads.
+class MatroskaCursor: boost::noncopyable {
+public:
+    explicit MatroskaCursor( matroska_file_ptr file );
+    ~MatroskaCursor();
+
+    const MatroskaFile &GetFile() const { return *m_File; }
+
+    /// Enable reading data from a given track.
+    void EnableTrack( uint16 trackIdx );
+
+    /// Positions the cursor so that the next frame of each enabled track is its
+    /// first at or after timecode (in ns).
+    /// \return false if timecode is beyond the end of the file.
+    bool Seek( uint64 timecode );
+
+    /// Returns the next frame of a track, or NULL at the end of the file.
+    MatroskaFrame *ReadSingleFrame( uint16 trackIdx );
+
+    /// Indicates whether the end of the file has been reached.
+    bool IsEof() const;
+
+private:
+    /// Queues the frames of the next cluster.
+    /// \return false at the end of the file.
+    bool ReadNextCluster();
+    void QueueBlock( const uint8 *block, size_t size, uint64 clusterTimecode,
+        bool keyframe, const uint64 *duration );
+
+    typedef boost::ptr_deque< MatroskaFrame > FrameQueue;
+    typedef std::map< uint16, FrameQueue > FrameQueueMap;
+
+    matroska_file_ptr m_File;
+    std::set< uint16 > m_EnabledTracks;
+    FrameQueueMap m_FrameQueues;
+    size_t m_NextCluster;
+    uint64 m_SkipUntil;
+    boost::shared_ptr< ByteArray > m_ClusterData;
+    std::vector< PayloadView > m_Laces;
+    boost::scoped_ptr< BufferPool > m_BufferPool;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _MATROSKA_CURSOR_H_
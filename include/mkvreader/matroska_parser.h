@@ -38,9 +38,13 @@
 #include <map>
 #include <set>
 #include <list>
+#include <sys/uio.h>
+#include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/ptr_container/ptr_deque.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
 // libebml includes
 #include "ebml/StdIOCallback.h"
@@ -59,6 +63,7 @@
 // libmatroska includes
 #include "matroska/KaxConfig.h"
 #include "matroska/KaxBlock.h"
+#include "matroska/KaxBlockData.h"
 #include "matroska/KaxSegment.h"
 #include "matroska/KaxContexts.h"
 #include "matroska/KaxSeekHead.h"
@@ -70,13 +75,20 @@
 // #include "matroska/KaxTagMulti.h"    TO_DO: obsolete?
 #include "matroska/KaxCluster.h"
 #include "matroska/KaxClusterData.h"
+#include "matroska/KaxCues.h"
 #include "matroska/KaxTrackAudio.h"
 #include "matroska/KaxTrackVideo.h"
 #include "matroska/KaxAttachments.h"
 #include "matroska/KaxAttached.h"
 #include "matroska/KaxChapters.h"
+#include "matroska/KaxContentEncoding.h"
 #include "matroska/KaxVersion.h"
 
+#include "mkvreader/chapter_index.h"
+#include "mkvreader/io_callbacks.h"
+#include "mkvreader/timebase.h"
+#include "mkvreader/track_index.h"
+
 
 namespace mkvreader {
 
@@ -107,6 +119,24 @@ public:
 	uint64 SourceDataLength;
 };
 
+/// Refers to payload bytes held elsewhere.
+struct PayloadView {
+    PayloadView() : data( NULL ), size( 0 ) {}
+    PayloadView( const uint8 *data, size_t size ) : data( data ), size( size ) {}
+
+    const uint8 *data;
+    size_t size;
+};
+
+/// Where payload bytes are in the file.
+struct PayloadLocation {
+    PayloadLocation() : pos( 0 ), size( 0 ) {}
+    PayloadLocation( uint64 pos, size_t size ) : pos( pos ), size( size ) {}
+
+    uint64 pos;
+    size_t size;
+};
+
 class MatroskaFrame {
 public:
 	MatroskaFrame();
@@ -121,32 +151,73 @@ public:
         return static_cast<double>(timecode) / 1000000000.0;
     }
 
+    /// Returns the number of laces in the frame (usually 1).
+    size_t get_lace_count() const;
+
+    /// Returns the payload of a lace, regardless of whether it's held in
+    /// dataBuffer or dataViews.
+    PayloadView get_lace( size_t i ) const;
+
     template< typename DestType > void get_payload( DestType &dest ) const
     {
         size_t total_size = 0;
-        for (std::vector<ByteArray>::const_iterator i = dataBuffer.begin();
-            i != dataBuffer.end(); ++i)
+        for (size_t i = 0; i < get_lace_count(); i++)
         {
-            total_size += i->size();
+            total_size += get_lace( i ).size;
         }
 
         dest.reserve( dest.size() + total_size );
-        for (std::vector<ByteArray>::const_iterator i = dataBuffer.begin();
-            i != dataBuffer.end(); ++i)
+        for (size_t i = 0; i < get_lace_count(); i++)
         {
-            dest.insert( dest.end(), i->begin(), i->end() );
+            PayloadView lace = get_lace( i );
+            dest.insert( dest.end(), lace.data, lace.data + lace.size );
         }
     }
 
+    /// Appends an iovec for each lace to dest, referring to the frame's own buffers,
+    /// for passing to writev() or sendmsg() without gathering the payload first.
+    /// The iovecs are valid only as long as the frame.
+    /// \return the number of payload bytes covered.
+    size_t get_iovecs( std::vector< iovec > &dest ) const;
+
 	uint64 timecode;
 	uint64 duration;
+	/// Whether the frame can be decoded without reference to others.
+	bool keyframe;
+	/// Set on frames delivered only so that later ones may be decoded, after
+	/// MatroskaParser::SeekKeyframe().  They should be decoded, but not presented.
+	bool preroll;
 	std::vector<ByteArray> dataBuffer;
+	/// For frames read from an in-memory source, the laces point directly into the
+	/// source buffer, rather than being copied into dataBuffer.
+	std::vector<PayloadView> dataViews;
+	/// Keeps the memory referenced by dataViews alive, if the source was a shared buffer.
+	boost::shared_ptr<const void> dataOwner;
 	/// Linked-list for laced frames
     uint64 add_id;
     ByteArray additional_data_buffer;
+    /// The payload bytes charged to the parser's byte budgets, while it's queued.
+    size_t queuedBytes;
+    /// Where the laces are, while the frame is queued with its payload still in the
+    /// file.  See MatroskaParser::SetDeferredPayloads().  Empty, once it's popped.
+    std::vector<PayloadLocation> deferredLaces;
 };
 
 
+/// Appends iovecs for the payloads of a range of frames, in order, to dest.
+/// Note that writev() accepts at most IOV_MAX of them per call.
+/// \return the number of payload bytes covered.
+template< typename FrameIter > size_t get_iovecs( FrameIter begin, FrameIter end, std::vector< iovec > &dest )
+{
+    size_t total_size = 0;
+    for (FrameIter frame = begin; frame != end; ++frame)
+    {
+        total_size += frame->get_iovecs( dest );
+    }
+    return total_size;
+}
+
+
 struct MatroskaMetaSeekClusterEntry {
 	uint32 clusterNo;
 	uint64 filePos;
@@ -216,6 +287,18 @@ public:
 	std::vector<uint64> tracks;
 };
 
+/// How a track's data was encoded, so that it may be decoded.
+class MatroskaContentEncoding {
+public:
+	MatroskaContentEncoding();
+
+	uint64 order;
+	uint64 scope;       ///< 1: frames, 2: codec private data.
+	uint64 type;        ///< 0: compression, 1: encryption.
+	uint64 compAlgo;    ///< 0: zlib, 3: header stripping.  Others aren't supported.
+	ByteArray compSettings;
+};
+
 class MatroskaTrackInfo {
 	public:
 		/// Initializes the class
@@ -244,27 +327,120 @@ class MatroskaTrackInfo {
         uint8 bitsPerSample;
         uint32 avgBytesPerSec; 
         uint64 defaultDuration;
+		/// TrackTimecodeScale, which multiplies the timecodes of the track's blocks.
+		Rational timecodeScale;
+
+		/// In the order they must be decoded.  Frames are decoded as they're read,
+		/// as is codecPrivate.
+		std::vector<MatroskaContentEncoding> contentEncodings;
 };
 
 typedef boost::shared_ptr<MatroskaMetaSeekClusterEntry> cluster_entry_ptr;
 
+/// An entry of the Cues element, locating a keyframe of a track.
+struct MatroskaCuePoint {
+	uint64 timecode;        ///< In ns.
+	uint16 trackNumber;
+	uint64 clusterPos;      ///< Absolute file position of the cluster.
+	uint64 relativePos;     ///< Position of the block, relative to the cluster's data, or 0 if unknown.
+};
+
+/// Where the duration of the file came from.
+enum duration_source {
+	duration_unknown,       ///< Not found.
+	duration_from_info,     ///< The segment's Info/Duration.
+	duration_measured,      ///< The end of the last frame, found by MatroskaParser::MeasureDuration().
+};
+
+/// Where decoding of a video track resumes, after MatroskaParser::SeekKeyframe().
+struct KeyframeSeekPoint {
+	uint16 trackIdx;
+	uint64 keyframeTimecode;    ///< The last keyframe at or before the target.
+};
+
+/// Describes a block found by MatroskaParser::ScanBlocks(), whose payload isn't read.
+struct MatroskaBlockInfo {
+	uint16 trackIdx;
+	uint64 timecode;    ///< In ns, as for frames.
+	uint64 duration;    ///< In ns.  Either its BlockDuration, or the track's default, per lace.
+	bool keyframe;
+	uint32 numLaces;
+	uint64 filePos;     ///< Of the SimpleBlock or BlockGroup element.
+	uint64 size;        ///< Of that element, including its head.
+};
+
+struct BlockDescriptor;
+
+class FileWatcher;
+struct AsyncReadRequest;
+class BufferPool;
+class DecodeWorkers;
+
 
 class MatroskaParser {
 public:
 	explicit MatroskaParser(const char *filename /*, abort_callback & p_abort */ );
+
+	/// Parses a file, reading it in the manner specified by options.
+	MatroskaParser(const char *filename, const IoOptions &options);
+
+	/// Parses a file that's already in memory, without copying it.  The data must
+	/// outlive the parser and any frames read from it, since their payloads point into it.
+	MatroskaParser(const uint8 *data, size_t size);
+
+	/// Parses a file held in a shared buffer, without copying it.  Frames read from
+	/// it hold a reference to the buffer.
+	explicit MatroskaParser(boost::shared_ptr<const ByteArray> buffer);
 	~MatroskaParser();
 
+	/// Switches to a new file, with the same sources as the constructors.  The parser
+	/// is Reset() first, so it keeps its settings & the capacity of its buffers.  To
+	/// process many small files, reusing one parser this way avoids reallocating them.
+	void Open(const char *filename);
+	void Open(const char *filename, const IoOptions &options);
+	void Open(const uint8 *data, size_t size);
+	void Open(boost::shared_ptr<const ByteArray> buffer);
+
+	/// Discards everything about the current file, including queued frames, whose
+	/// buffers are kept for reuse.  Settings, such as the queue depth, lace splitting,
+	/// decode threads, and follow mode, are kept.  Call Open() before parsing again.
+	void Reset();
+
 	/// The main header parsing function
 	/// \return 0 File parsed ok
 	/// \return 1 Failed
 	int Parse(bool bInfoOnly = false, bool bBreakAtClusters = true);
 
+	/// With lazy metadata, Parse() reads the head of the file in one large read and
+	/// parses Info & Tracks from memory.  Elements that don't fit are hopped over with
+	/// small reads of their heads.  Chapters, Tags & Attachments are only located,
+	/// either there or via the SeekHead, and are parsed when first accessed.  This only
+	/// applies to files (not memory) when breaking at clusters.  Off by default.
+	void SetLazyMetadata(bool lazy);
+
+	/// When enabled, Parse() calls MeasureDuration() for files without a Duration, as
+	/// is the case with interrupted recordings.  That reads the tail of the file, so
+	/// it's off by default, & never done in follow mode.
+	void SetMeasureMissingDuration(bool measure);
+
 	MatroskaTrackInfo &GetTrack(uint16 trackNo) { return m_Tracks.at(trackNo); };
 	uint16 FindTrack(uint16 trackNum) const;
 	uint64 GetTimecodeScale() { return m_TimecodeScale; };
+	uint64 GetFileSize() const { return m_FileSize; }
+	/// Returns the position of the first cluster, or 0 if it wasn't found while parsing.
+	uint64 GetFirstClusterPos() const { return m_FirstClusterPos; }
 
 	/// Returns an adjusted duration of the file
 	double GetDuration();
+	/// Tells whether the duration was reported by the file or measured.  See
+	/// SetMeasureMissingDuration().
+	duration_source GetDurationSource() const { return m_DurationSource; }
+	/// Finds the end of the last frame, by searching backwards from the end of the file for
+	/// the last cluster, & reading the headers of its blocks.  That takes a few KB of I/O,
+	/// unless the last cluster is large.  Use it when the file's duration can't be trusted.
+	/// \return false if it couldn't be found, or the file's still growing (follow mode),
+	/// in which case the duration is unchanged.
+	bool MeasureDuration();
 
 	/// Returns an adjusted duration of the track
 	double GetTrackDuration( uint32 trackIdx ) const;
@@ -273,6 +449,7 @@ public:
 	int32 GetFirstTrack( track_type type ) const;
 
 	double TimecodeToSeconds(uint64 code,unsigned samplerate_hint = 44100);
+	/// Rounds to the nearest ns, so that it exactly inverts TimecodeToSeconds().
 	uint64 SecondsToTimecode(double seconds);
 
 	/// Enable reading data from a given track.
@@ -287,16 +464,91 @@ public:
     /// up frames for another.  Note: this is not a hard limit.
     /// \param depth number of frames; 0 disables.
     void SetMaxQueueDepth( unsigned int depth );
-
-	std::vector<MatroskaEditionInfo> &GetEditions() { return m_Editions; };
-	std::vector<MatroskaChapterInfo> &GetChapters() { return m_Chapters; };
+    unsigned int GetMaxQueueDepth() const { return m_MaxQueueDepth; }
+
+    /// When enabled, frames queued beyond the max queue depth are kept as descriptors,
+    /// with their payloads left in the file, and read with positioned reads when popped.
+    /// A full queue then no longer stops the others from filling, so tracks muxed far
+    /// apart cost only a small, fixed amount of memory per frame.  Only applies to
+    /// files, since in-memory sources already refer to payloads without copying them.
+    void SetDeferredPayloads( bool defer );
+
+    /// Limits the payload bytes queued for all tracks, or for one track (by index).
+    /// Unlike the queue depth, these are hard limits: a frame that doesn't fit stays
+    /// in the file until there's room, and FillQueue() returns -1 meanwhile.  The only
+    /// exceptions are a frame bigger than a track's budget, let into its empty queue,
+    /// and one bigger than the overall budget, let in when every queue is empty.
+    /// Frames are charged their decoded size, so, while budgets are set, compressed
+    /// frames are decoded as they're read, rather than by the decode threads.
+    /// Deferred payloads are charged their size in the file, then their decoded size,
+    /// once they're loaded.  SeekKeyframe() lifts the budgets, while it fills the
+    /// queues with a GOP.
+    /// \param bytes the limit; 0 disables.
+    void SetByteBudget( uint64 bytes );
+    void SetTrackByteBudget( uint16 trackIdx, uint64 bytes );
+
+    /// Returns the payload bytes queued for all tracks, or for one track, after any
+    /// decompression.  Frames still being decoded by the decode threads count as read.
+    uint64 GetQueuedBytes() const;
+    uint64 GetQueuedBytes( uint16 trackIdx ) const;
+
+    /// Called when a frame of a track doesn't fit into the byte budgets, so that the
+    /// application may make room, with DropQueuedFrames() or PopQueuedFrame(), before
+    /// the parser gives up.  It mustn't read frames with ReadSingleFrame().
+    typedef boost::function< void ( MatroskaParser &parser, uint16 trackIdx, uint64 bytesNeeded ) > PressureCallback;
+    void SetPressureCallback( const PressureCallback &callback );
+
+    /// Recycles the oldest frames queued for a track, until at least bytes have been freed.
+    /// \return the number of bytes freed.
+    uint64 DropQueuedFrames( uint16 trackIdx, uint64 bytes );
+
+    /// Removes the oldest frame queued for a track, without reading any more of the
+    /// file, so it can be spilled elsewhere.  Pass it to RecycleFrame(), when done.
+    /// \return NULL if the queue is empty.
+    MatroskaFrame *PopQueuedFrame( uint16 trackIdx );
+
+    /// Follow mode is for reading files that are still being written.  When enabled,
+    /// reaching the end of the file means "no data yet", rather than EOF, and a
+    /// partially-written cluster is resumed where it left off, once more data arrives.
+    /// Every file-based source supports it.  In-memory sources can't grow, so they
+    /// throw std::runtime_error, and opening one disables follow mode.
+    /// \param follow enables or disables follow mode.
+    /// \param timeout_ms how long a read may block, waiting for the file to grow.
+    void SetFollowMode( bool follow, unsigned int timeout_ms = 0 );
+
+    /// When enabled, each lace of a laced block is delivered as a frame of its own,
+    /// with the block's duration divided evenly among them.  Their payloads refer
+    /// to the block's data, rather than copying it.
+    void SetLaceSplitting( bool split );
+
+    /// Sets the number of threads for decompressing frames of zlib-compressed tracks.
+    /// With 0 (the default), they're decompressed while parsing.  Otherwise, those of
+    /// each cluster are decompressed in parallel.
+    void SetDecodeThreads( unsigned int num_threads );
+
+    /// Deletes a frame, keeping its buffers for reading subsequent frames.
+    void RecycleFrame( MatroskaFrame *frame );
+
+	std::vector<MatroskaEditionInfo> &GetEditions() { LoadChapters(); return m_Editions; };
+	std::vector<MatroskaChapterInfo> &GetChapters() { LoadChapters(); return m_Chapters; };
 	std::vector<MatroskaTrackInfo> &GetTracks() { return m_Tracks; };
+
+	/// Returns the chapter (at any level) with a given UID, or NULL.
+	const MatroskaChapterInfo *FindChapter(uint64 chapterUID);
+	/// Appends the chapters (at any level) in effect at timecode (in ns) that apply to
+	/// a track, in order of start time.  With trackNum 0, those for any track.
+	void GetChaptersAt(uint64 timecode, uint16 trackNum, std::vector<const MatroskaChapterInfo *> &chapters);
+	/// Appends the tags that apply at timecode (in ns) to a track: those targeting it
+	/// alone, then those targeting the chapters in effect, for it or for any track.
+	void GetTagsAt(uint64 timecode, uint16 trackNum, std::vector<const MatroskaTagInfo *> &tags);
 	uint32 GetTrackCount() const;
 	/// Returns the number of tracks of a given type.
 	uint32 GetTrackCount( track_type type ) const;
 	/// Returns the absolute index for the Nth track of a specified type.
 	int32 GetTrackIndex( track_type type, uint32 index) const;
 
+	/// Returns the average bitrate of the whole file, in kbits/s.  See AnalyzeStream(),
+	/// in stream_analyzer.h, for that of each track, over time.
 	int32 GetAvgBitrate();
 
 	/// Seek to a position
@@ -308,8 +560,72 @@ public:
 	bool skip_frames_until(double destination, unsigned hint_samplerate);
 	bool Seek(double seconds, unsigned samplerate_hint);
 
+	/// Integer forms of skip_frames_until() & Seek(), which take a timecode in ns.
+	/// Use TimebaseToTimecode() to seek to a position in another timebase.
+	/// SeekTimecode() jumps to the cluster holding timecode, so it can also seek backwards,
+	/// except in follow mode, where it only skips forward, like SkipFramesUntil().
+	bool SkipFramesUntil(uint64 timecode);
+	bool SeekTimecode(uint64 timecode);
+
+	/// Indexes the clusters, by hopping from one to the next by their sizes, reading only
+	/// the head of each, with a positioned read.  SeekTimecode() calls it when first needed.
+	/// Clusters after one of unknown size can't be found this way.
+	/// \return false if the file has no clusters.
+	bool BuildClusterIndex();
+	const std::vector<cluster_entry_ptr> &GetClusterIndex() const { return m_ClusterIndex; }
+
+	/// Seeks so that each enabled video track resumes at its last keyframe at or before
+	/// timecode (in ns).  Their frames before timecode are delivered with preroll set.
+	/// Frames of other tracks start at timecode.  The Cues are used to find the keyframes,
+	/// if the file has them.  Otherwise, it reads from the cluster holding timecode (see
+	/// BuildClusterIndex()), or that of the last keyframe before it, if the frame index
+	/// (see BuildFrameIndexes()) has one, stepping back a cluster at a time, as needed.
+	/// \param keyframes receives the keyframe position of each enabled video track.
+	/// \return false if timecode is beyond the end of the file.
+	bool SeekKeyframe(uint64 timecode, std::vector<KeyframeSeekPoint> &keyframes);
+
+	/// Reads the Cues, if they haven't been already.  Works whether or not they were
+	/// found while parsing, as long as the SeekHead locates them.
+	/// \return false if the file has none.
+	bool LoadCues();
+	const std::vector<MatroskaCuePoint> &GetCuePoints() const { return m_CuePoints; }
+
+	/// Indexes every track's frames (i.e. blocks, regardless of lacing), by scanning
+	/// the clusters with positioned reads.  Doesn't disturb the reading of frames.
+	bool BuildFrameIndexes();
+	/// Called by ScanBlocks() for each block.  Returns false to stop the scan.
+	typedef boost::function< bool ( const MatroskaBlockInfo &block ) > BlockScanCallback;
+	/// Describes every block of the file, in order, without reading their payloads,
+	/// so it's limited by the number of blocks, rather than their size.  Like
+	/// BuildFrameIndexes(), it uses positioned reads & doesn't disturb reading frames.
+	/// \return false if the file has no clusters, or reading them failed.
+	bool ScanBlocks( const BlockScanCallback &callback );
+	/// Builds keyframe-only indexes, from the Cues.
+	bool LoadFrameIndexesFromCues();
+	/// Saves the frame indexes to a sidecar file, or loads them from one.
+	bool SaveFrameIndexes(const char *filename) const;
+	bool LoadFrameIndexes(const char *filename);
+	/// Returns the frame index of a track, or NULL if there's none.
+	const TrackIndex *GetFrameIndex(uint16 trackIdx) const;
+
 	MatroskaFrame * ReadSingleFrame( uint16 trackIdx);
 
+	/// For reading frames without blocking, as the coroutine interface (async_frames.h)
+	/// does: once the request returned by ReadAhead() completes, ReadCluster() parses the
+	/// next cluster from its buffer.  Only files opened with IoOptions::asyncReadAhead
+	/// are read ahead, so ReadAhead() returns NULL for others, as it does when the data's
+	/// already been read.
+	AsyncReadRequest *ReadAhead();
+	/// Reads the next cluster, queuing the frames of the enabled tracks.
+	/// \return 0 on success, 1 at EOF, -1 if another queue is full, or 3 if no more data
+	/// is available, yet (follow mode).
+	int ReadCluster();
+	/// Returns the timecode (in ns) of the cluster last read by ReadCluster() or
+	/// ReadSingleFrame(), or 0 if none has been since the last seek.
+	uint64 GetReadTimecode() const;
+	/// Returns the next frame of a track, leaving it queued, or NULL if none is queued.
+	const MatroskaFrame *PeekQueuedFrame( uint16 trackIdx ) const;
+
     /// Seeks to the beginning of the stream.
     bool Restart(); // Untested & might not work.
 
@@ -318,6 +634,22 @@ public:
 	const attachment_list &GetAttachmentList() const;
     ByteArray ReadAttachment( attachment_list::const_iterator attachment );
 
+    /// Reads part of an attachment.  Neither this nor CopyAttachmentToFd() moves
+    /// the demuxer's file position, so they may be used in the middle of reading frames.
+    /// \return the number of bytes read, which is less than size only at the end of the attachment.
+    size_t ReadAttachment( attachment_list::const_iterator attachment, uint64 offset, void *buffer, size_t size );
+
+    /// Writes an attachment to fd's current position, using in-kernel copies when
+    /// reading from a file.
+    void CopyAttachmentToFd( attachment_list::const_iterator attachment, int fd );
+
+    /// Returns I/O statistics, when the file is read through a BufferedReadCallback
+    /// (see IoOptions::bufferSize).
+    /// \param requested receives the reads & seeks made by the parser.
+    /// \param issued receives the reads & seeks that reached the file.
+    /// \return false if no statistics are available.
+    bool GetIoStats( IoStats &requested, IoStats &issued ) const;
+
     /// Indicates whether the end of the file has been reached.
     /// When reading multiple tracks, use this to decide when to stop reading.
     bool IsEof() const;
@@ -328,17 +660,32 @@ protected:
 	void Parse_Chapter_Atom(libmatroska::KaxChapterAtom *ChapterAtom);
 	void Parse_Chapter_Atom(libmatroska::KaxChapterAtom *ChapterAtom, std::vector<MatroskaChapterInfo> &p_chapters);
 	void Parse_Tags(libmatroska::KaxTags *tagsElement);
+	void Parse_ContentEncodings(libmatroska::KaxContentEncodings &encodingsElement, MatroskaTrackInfo &track);
+	void Parse_Attachments(ElementPtr attachmentsElement, int &UpperElementLevel, ElementPtr &ElementLevel2);
+
+	int ParseElements(bool bInfoOnly, bool bBreakAtClusters);
+	int ParseHead(size_t headSize, bool bInfoOnly);
+	void LocateDeferredMetadata();
+	void ParseDeferred(uint64 &pos, const libebml::EbmlCallbacks &callbacks);
+	void LoadChapters();
+	void LoadTags();
+	void LoadAttachments();
 
 	/// Reads frames from file.
 	/// \return -1 If another queue is full.
 	/// \return 0 If read ok	
 	/// \return 1 End of file
-	/// \return 2 If no cluster at current timecode
+	/// \return 3 If no more data is available yet (follow mode, only)
 	int FillQueue();
+	/// Reads a Block or SimpleBlock into a frame, if its track is enabled.
+	/// \return The index of the block's track, or 0xffff if it's not enabled.
+	uint16 ReadBlock(libmatroska::KaxInternalBlock &DataBlock, libmatroska::KaxCluster &SegmentCluster, MatroskaFrame &frame);
+	int QueueBlockFrame(MatroskaFrame *newFrame, uint16 trackIdx, ElementPtr cluster, uint64 blockPos);
 	uint64 GetClusterTimecode(uint64 filePos);
 	cluster_entry_ptr FindCluster(uint64 timecode);
 	void CountClusters();
 	void FixChapterEndTimes();
+	bool ShouldMeasureDuration() const;
 	// See if the edition uid is already in our vector
 	// \return true Yes, we already have this uid
 	// \return false Nope
@@ -351,13 +698,53 @@ protected:
 	MatroskaTagInfo *FindTagWithTrackUID(uint64 trackUID);
 	MatroskaTagInfo *FindTagWithEditionUID(uint64 editionUID, uint64 trackUID = 0);
 	MatroskaTagInfo *FindTagWithChapterUID(uint64 chapterUID, uint64 trackUID = 0);
-
+	/// The tags' positions in m_Tags, in order, by target UID.
+	typedef boost::unordered_map<uint64, std::vector<size_t> > TagIndexMap;
+	MatroskaTagInfo *FindTagInIndex(const TagIndexMap &index, uint64 uid, uint64 trackUID);
+	void IndexChapters();
+	void IndexTags();
+
+    void InitMembers();
+    void SetSource( libebml::IOCallback *callback, const char *filename, const uint8 *memory, uint64 size );
     bool TrackNumIsEnabled( uint16 trackNum ) const;
     bool IsAnyQueueFull() const;
+    bool DefersPayloads() const;
+    bool MayDeferPayloads() const;
+    bool ShouldDeferPayload( uint16 trackIdx ) const;
+    void ReadPayload( MatroskaFrame &frame );
+    void LoadDeferredPayload( uint16 trackIdx, MatroskaFrame &frame );
+    uint64 GetFrameBytes( const MatroskaFrame &frame ) const;
+    bool HasByteBudgets() const;
+    bool FitsByteBudgets( uint16 trackIdx, uint64 bytes ) const;
+    bool MakeRoom( uint16 trackIdx, uint64 bytes );
+    void ChargeFrame( uint16 trackIdx, MatroskaFrame &frame );
+    void UnchargeFrame( uint16 trackIdx, const MatroskaFrame &frame );
+    void RechargeFrame( uint16 trackIdx, MatroskaFrame &frame );
+    void RecountQueuedBytes();
+    void DiscardQueuedFrames();
+    bool IsElementComplete( const libebml::EbmlElement &element );
+    int WaitForMoreData();
+    int GetPreadFd();
+    size_t ReadBytesAt( uint64 pos, void *buffer, size_t size );
+    uint64 FindSeekEntry( uint64 seekHeadPos, uint32 id );
+    bool ReadElementAt( uint64 pos, uint32 id, ByteArray &element );
+    uint64 FindCuedKeyframes( uint64 timecode, const std::vector<uint16> &videoTracks );
+    size_t FindKeyframeCluster( uint64 timecode, const std::vector<uint16> &videoTracks );
+    bool HasKeyframesAt( uint64 timecode, const std::vector<uint16> &videoTracks );
+    bool ReadKeyframesFrom( uint64 startPos, uint64 timecode, const std::vector<uint16> &videoTracks );
+    void PruneForPreroll( uint64 timecode );
+    bool SeekToCluster( uint64 timecode );
+
+    typedef std::map<uint16, TrackIndex> FrameIndexMap;
+    bool DescribeBlock( const BlockScanCallback &callback, const BlockDescriptor &block ) const;
+    bool IndexBlock( FrameIndexMap &indexes, const MatroskaBlockInfo &block ) const;
 
     std::string m_filename;
 	boost::scoped_ptr<IOCallback> m_IOCallback;
-	libebml::EbmlStream m_InputStream;
+	boost::scoped_ptr<libebml::EbmlStream> m_InputStream;
+	/// For in-memory sources, the start of the buffer.  Otherwise, NULL.
+	const uint8 *m_MemoryBase;
+	boost::shared_ptr<const void> m_MemoryOwner;
 	/// The main/base/master element, should be the segment
 	ElementPtr m_ElementLevel0;
 
@@ -368,12 +755,32 @@ protected:
 	std::vector<MatroskaEditionInfo> m_Editions;
 	std::vector<MatroskaChapterInfo> m_Chapters;
 	std::vector<MatroskaTagInfo> m_Tags;
+
+	/// Indexes of the above, rebuilt as they're parsed.
+	boost::unordered_set<uint64> m_EditionUIDs;
+	boost::unordered_set<uint64> m_ChapterUIDs;
+	boost::unordered_map<uint64, const MatroskaChapterInfo *> m_ChaptersByUID;
+	ChapterIndex m_ChapterIndex;
+	TagIndexMap m_TagsByTrackUID;
+	TagIndexMap m_TagsByEditionUID;
+	TagIndexMap m_TagsByChapterUID;
 	
 	/// This is the queue of buffered frames to deliver
     typedef boost::ptr_deque< MatroskaFrame > FrameQueue;
     typedef std::map<uint32, FrameQueue> FrameQueueMap;
 	FrameQueueMap m_FrameQueues;
 
+    /// Queues a frame, or its laces, & decodes them, unless they've been already.
+    /// Returns the last frame queued.
+    MatroskaFrame *QueueFrame( MatroskaFrame *frame, uint16 trackIdx, FrameQueue &queue, bool decoded );
+    void DecodeQueuedFrame( uint16 trackIdx, MatroskaFrame &frame );
+    void FinishDecoding();
+    uint64 ScaleTrackTimecode( uint16 trackIdx, uint64 timecode ) const;
+
+    /// Buffers for payloads.  The decode workers use it, so it must outlive them.
+    boost::scoped_ptr<BufferPool> m_BufferPool;
+    boost::scoped_ptr<DecodeWorkers> m_DecodeWorkers;
+
 	/// This is the index of clusters in the file, it's used to seek in the file
 	// std::vector<MatroskaMetaSeekClusterEntry> m_ClusterIndex;
     std::vector<cluster_entry_ptr> m_ClusterIndex;
@@ -381,7 +788,9 @@ protected:
     attachment_list m_AttachmentList;
 
 	uint64 m_CurrentTimecode;
+	uint64 m_ReadTimecode;      ///< Of the cluster last read, by FillQueue().
 	double m_Duration;
+	duration_source m_DurationSource;
 	uint64 m_TimecodeScale;
 	UTFstring m_WritingApp;
 	UTFstring m_MuxingApp;
@@ -389,13 +798,58 @@ protected:
 	int64 m_FileDate;
 	UTFstring m_SegmentFilename;
 	uint32    m_MaxQueueDepth;
+	bool      m_DeferPayloads;
+
+    /// Byte budgets & what's charged against them.  When a frame didn't fit, its block
+    /// is left pending (see m_PendingCluster), with its track & size kept here.
+    uint64 m_ByteBudget;
+    std::map<uint16, uint64> m_TrackByteBudgets;
+    uint64 m_TotalQueuedBytes;
+    std::map<uint16, uint64> m_QueuedBytes;
+    PressureCallback m_PressureCallback;
+    uint16 m_BlockedTrack;
+    uint64 m_BlockedBytes;
+    /// Set when frames are handed to the decode workers, so they're recharged after.
+    bool m_RechargeDecoded;
 
 	uint64 m_FileSize;
 	bool   m_Eof;
+
+    /// Follow mode state.  When a cluster is only partially written, it's kept in
+    /// m_PendingCluster and parsing resumes from m_ResumePos.
+    bool         m_Follow;
+    unsigned int m_FollowTimeoutMs;
+    boost::scoped_ptr<FileWatcher> m_Watcher;
+    ElementPtr   m_PendingCluster;
+    uint64       m_ResumePos;
+
+    bool m_SplitLaces;
+
+    /// Descriptor for positioned reads of attachments & cues, opened on first use.
+    int m_PreadFd;
+
+    /// Where level-1 elements were found while parsing, or 0 if they weren't.
+    uint64 m_FirstClusterPos;
+    uint64 m_SeekHeadPos;
+    uint64 m_CuesPos;
+
+    bool m_CuesLoaded;
+    std::vector<MatroskaCuePoint> m_CuePoints;
+
+    /// Frame indexes, by track index.
+    FrameIndexMap m_FrameIndexes;
+
 	uint64 m_TagPos;
 	uint32 m_TagSize;
 	uint32 m_TagScanRange;
 
+	/// Lazy metadata state.  The deferred positions are of elements not yet parsed, or 0.
+	bool m_LazyMetadata;
+	bool m_MeasureMissingDuration;
+	uint64 m_DeferredChaptersPos;
+	uint64 m_DeferredTagsPos;
+	uint64 m_DeferredAttachmentsPos;
+
 	//int UpperElementLevel;
 };
 
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file matroska_trim.h
+    \brief Fast extraction of a time range from a Matroska file.
+*/
+
+#ifndef _MATROSKA_TRIM_H_
+#define _MATROSKA_TRIM_H_
+
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+/// Summarizes the work done by TrimFile().
+struct TrimStats {
+    TrimStats();
+
+    uint64 clustersCopied;      ///< Interior clusters, copied verbatim.
+    uint64 clustersRewritten;   ///< Boundary clusters, filtered block-by-block.
+    uint64 bytesCopied;
+    uint64 bytesRewritten;
+};
+
+
+/// Writes the portion of a file between start_ns and end_ns to a new file.
+///
+/// Clusters that lie wholly within the range are copied byte-for-byte, without
+/// passing through user space.  Only the boundary clusters are rewritten, to keep
+/// just the blocks in range, plus those needed to decode each track from its last
+/// keyframe at or before start_ns, which may be several clusters earlier.
+/// Timestamps are not shifted.
+///
+/// Of the header elements, Info is rewritten with a Duration that reaches the end
+/// of the range, since the timestamps still start where they did; Tracks,
+/// Chapters, Tags & Attachments are copied.  SeekHead and Cues are dropped,
+/// since the positions they hold no longer apply.
+///
+/// \throws std::runtime_error on failure.
+TrimStats TrimFile( const char *src_filename, const char *dst_filename, uint64 start_ns, uint64 end_ns );
+
+
+}   // namespace mkvreader
+
+
+#endif // _MATROSKA_TRIM_H_
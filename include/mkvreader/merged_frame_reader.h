@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file merged_frame_reader.h
+    \brief Reads the frames of several tracks, merged in order of timecode.
+*/
+
+#ifndef _MERGED_FRAME_READER_H_
+#define _MERGED_FRAME_READER_H_
+
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "mkvreader/matroska_parser.h"
+
+
+namespace mkvreader {
+
+
+/// Reads the frames of a set of tracks, in order of timecode, as if from one queue.
+///
+/// It holds the next frame of each track in a heap, so only the track whose frame was
+/// last returned is read from.  Frames with equal timecodes come in the order the tracks
+/// were given.
+///
+/// Order needs the next frame of every track, so clusters are read past the max queue
+/// depth (see MatroskaParser::SetMaxQueueDepth()) 'til each track has one, but no
+/// further than the lookahead past the earliest frame held (see SetLookahead()).  A
+/// track without a frame by then, such as subtitles that have ended, is taken to have
+/// none in that window, & its frames that turn up later are returned when they do.
+/// So, besides the frames held, at most one lookahead (plus a cluster) of the other
+/// tracks is queued.  MatroskaParser::SetDeferredPayloads() keeps that cheap.  If the
+/// lookahead can't be read, yet, because the file has yet to grow, in follow mode, or
+/// a frame is over the byte budgets, no frames are returned until it can be.
+class MergedFrameReader: boost::noncopyable {
+public:
+    /// Enables the tracks, by index, on the parser.
+    MergedFrameReader( MatroskaParser &parser, const std::vector< uint16 > &trackIdxs );
+    ~MergedFrameReader();
+
+    /// Sets how far (in ns) past the earliest frame held the file is read, for tracks
+    /// without one.  Defaults to 5 s.
+    void SetLookahead( uint64 timecode ) { m_Lookahead = timecode; }
+
+    /// Returns the next frame, which the caller then owns, & the index of its track.
+    /// Pass it to MatroskaParser::RecycleFrame(), when done.
+    /// \return NULL at the end of all of the tracks, or if a track can't be read, yet.
+    /// IsEnd() tells which.
+    MatroskaFrame *ReadFrame( uint16 &trackIdx );
+
+    /// For reading without blocking, as AsyncFrameReader does: while NeedsCluster(),
+    /// ReadCluster(), then TakeFrame(), which is ReadFrame() without reading the file.
+    /// NeedsCluster() returns whether more must be read before the next frame is known.
+    /// ReadCluster() calls MatroskaParser::ReadCluster() past the max queue depth, &
+    /// returns what it does.
+    bool NeedsCluster();
+    int ReadCluster();
+    MatroskaFrame *TakeFrame( uint16 &trackIdx );
+
+    /// Whether all of the tracks have ended.
+    bool IsEnd() const;
+
+private:
+        // The next frame of a track.
+    struct Head {
+        MatroskaFrame *frame;
+        uint16 trackIdx;
+        size_t order;       ///< Of the track, as given.
+
+        bool operator<( const Head &other ) const;
+    };
+
+    void TakeQueuedFrames();
+
+    MatroskaParser &m_Parser;
+    std::vector< uint16 > m_Tracks;
+    uint64 m_Lookahead;
+
+        // A min-heap, by timecode.
+    std::vector< Head > m_Heads;
+
+        // Tracks (by order) without a head, which are to be read, up to the lookahead, before the next frame's returned.
+    std::vector< size_t > m_Pending;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _MERGED_FRAME_READER_H_
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file stream_analyzer.h
+    \brief Per-track bitrates, frame sizes, timing & interleaving, from a scan of the blocks.
+*/
+
+#ifndef _STREAM_ANALYZER_H_
+#define _STREAM_ANALYZER_H_
+
+
+#include <vector>
+
+#include "mkvreader/matroska_parser.h"
+
+
+namespace mkvreader {
+
+
+/// Where a track's frames are further apart than usual.
+struct TimestampGap {
+    uint64 timecode;    ///< Of the frame before the gap, in ns.
+    uint64 length;      ///< From that frame's timecode to the next's, in ns.
+};
+
+
+/// What AnalyzeStream() found of a track.  Times are in ns & bitrates in bits/s.
+struct TrackAnalysis {
+    TrackAnalysis();
+
+    uint16 trackIdx;
+    uint64 frames;          ///< I.e. blocks, regardless of lacing.
+    uint64 keyframes;
+    uint64 bytes;           ///< Of its blocks, including their element heads.
+    uint64 firstTimecode;
+    uint64 lastTimecode;
+
+    /// Over the duration of the whole stream.
+    double avgBitrate;
+    /// Over each window, starting from time 0.
+    std::vector< double > bitrates;
+    double peakBitrate;
+    uint64 peakTimecode;    ///< Where the window with the peak bitrate starts.
+
+    uint32 minFrameSize;
+    uint32 maxFrameSize;
+    /// Frame counts by size: entry i counts those of [2^i, 2^(i+1)) bytes.
+    std::vector< uint64 > sizeHistogram;
+
+    /// The median time from one frame to the next, in timecode order.
+    uint64 frameInterval;
+    /// The standard deviation of the time from one frame to the next.
+    double jitter;
+    /// Where frames are more than twice frameInterval apart.
+    std::vector< TimestampGap > gaps;
+
+    /// The most frames of this track read ahead of the frame of another track that
+    /// was being read, i.e. the queue depth it needs, to demux without stalling.
+    uint64 maxQueueDepth;
+};
+
+
+/// What AnalyzeStream() found of the whole file.
+struct StreamAnalysis {
+    StreamAnalysis();
+
+    uint64 windowSize;      ///< Of the bitrate windows, in ns.
+    uint64 duration;        ///< Up to the end of the last frame, in ns.
+
+    uint64 fileSize;
+    uint64 blockBytes;      ///< Of all tracks' blocks.
+    uint64 attachmentBytes;
+    uint64 overheadBytes;   ///< The rest: headers, metadata, cues, etc.
+    double avgBitrate;      ///< Of the blocks, in bits/s.
+
+    /// One for each track of the file, by track index.
+    std::vector< TrackAnalysis > tracks;
+
+    /// The queue depth needed by every track, to demux without stalling.  See
+    /// MatroskaParser::SetMaxQueueDepth().
+    uint64 maxInterleaveDepth;
+    /// How far ahead of another track's frames any track's frames were muxed, at most, in ns.
+    uint64 maxInterleaveTime;
+};
+
+
+/// Analyzes the file of a parser, in a single pass of MatroskaParser::ScanBlocks(),
+/// so payloads aren't read.  Doesn't disturb the reading of frames.
+/// \param windowSize the duration over which each windowed bitrate is measured, in ns.
+/// \return false if the scan failed.
+bool AnalyzeStream( MatroskaParser &parser, uint64 windowSize, StreamAnalysis &analysis );
+
+
+}   // namespace mkvreader
+
+
+#endif // _STREAM_ANALYZER_H_
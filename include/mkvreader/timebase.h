@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file timebase.h
+    \brief Exact integer conversions between timebases.
+*/
+
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+/// A timebase or scale factor, as num/den.  E.g. {1, 48000} for audio samples, or
+/// {1001, 30000} for NTSC frames.
+struct Rational {
+    Rational() : num( 1 ), den( 1 ) {}
+    Rational( uint32 num, uint32 den ) : num( num ), den( den ) {}
+
+    bool IsOne() const { return num == den; }
+
+    uint32 num;
+    uint32 den;
+};
+
+/// The timebase of frame timecodes.
+static const Rational NanosecondTimebase( 1, 1000000000 );
+
+
+/// Returns a * b / c, rounded to the nearest integer, without overflowing in between.
+uint64 MulDiv( uint64 a, uint64 b, uint64 c );
+
+/// Converts value from one timebase to another, rounding to the nearest integer.
+inline uint64 Rescale( uint64 value, Rational from, Rational to )
+{
+    return MulDiv( value, uint64( from.num ) * to.den, uint64( from.den ) * to.num );
+}
+
+/// Converts a timecode (in ns) to the nearest tick of timebase.
+inline uint64 TimecodeToTimebase( uint64 timecode, Rational timebase )
+{
+    return Rescale( timecode, NanosecondTimebase, timebase );
+}
+
+/// Converts ticks of timebase to the nearest ns.  For any timebase with ticks of at
+/// least 1 ns, TimecodeToTimebase() returns exactly the ticks passed to this.
+inline uint64 TimebaseToTimecode( uint64 ticks, Rational timebase )
+{
+    return Rescale( ticks, timebase, NanosecondTimebase );
+}
+
+/// Returns the closest rational approximation of value, with a denominator no
+/// larger than max_den.  Used for the floating-point TrackTimecodeScale.
+Rational ApproximateRational( double value, uint32 max_den = 1000000 );
+
+
+}   // namespace mkvreader
+
+
+#endif // _TIMEBASE_H_
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file track_index.h
+    \brief A compact index of a track's frames, by number & by time.
+*/
+
+#ifndef _TRACK_INDEX_H_
+#define _TRACK_INDEX_H_
+
+
+#include <vector>
+#include <iosfwd>
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+/// Where a frame (i.e. a block) is in the file.
+struct FrameLocation {
+    uint64 timecode;    ///< In ns.
+    uint64 filePos;     ///< Absolute position of the BlockGroup or SimpleBlock element.
+    uint32 size;        ///< Size of the element, including its header.  0 if unknown.
+    bool keyframe;
+};
+
+
+/// An index of one track's frames, numbered in file order.
+///
+/// Entries are grouped into chunks of ChunkSize.  Each chunk stores its first entry in
+/// full, and the rest as varint-coded deltas: timecodes as the change in frame duration,
+/// and positions as the gap after the previous frame.  For a track of evenly-spaced
+/// frames, that comes to about 6 bytes per frame.  Finding a frame by number decodes
+/// at most one chunk (O(1)).  Finding one by time searches the chunks (O(log n)).
+class TrackIndex {
+public:
+    static const size_t ChunkSize = 64;
+    static const size_t npos = size_t( -1 );
+
+    TrackIndex();
+
+    /// Adds a frame to the end of the index.  Frames must be added in file order.
+    void Append( const FrameLocation &frame );
+
+    /// Set for indexes built from Cues, which have only keyframes.  Their frame
+    /// numbers don't correspond to those of the track.
+    void SetKeyframesOnly( bool keyframes_only ) { m_KeyframesOnly = keyframes_only; }
+    bool IsKeyframesOnly() const { return m_KeyframesOnly; }
+
+    size_t GetFrameCount() const { return m_Count; }
+
+    /// Returns frame number frame_number, which must be < GetFrameCount().
+    FrameLocation GetFrame( size_t frame_number ) const;
+
+    /// Returns the number of the last frame, in file order, with a timecode <= timecode,
+    /// or npos if there's none.  Timecodes may be out of file order (B-frames), by less
+    /// than a chunk.
+    size_t FindFrame( uint64 timecode ) const;
+
+    /// Returns the number of the last keyframe at or before frame_number, or npos.
+    size_t FindKeyframe( size_t frame_number ) const;
+
+    /// Releases spare capacity, once the index is complete.
+    void Compact();
+
+    /// Returns the bytes used by the index.
+    size_t GetMemoryUsage() const;
+
+    void Write( std::ostream &out ) const;
+
+    /// \return false if the data is truncated or corrupt, after which the index is unusable.
+    bool Read( std::istream &in );
+
+private:
+    struct Chunk {
+        FrameLocation first;
+        uint64 lastTimecode;    ///< The chunk's greatest, for searching by time.
+        uint32 dataOffset;      ///< Where the chunk's deltas start, in m_Data.
+    };
+
+    /// State carried from one entry to the next, while encoding or decoding a chunk.
+    struct Cursor {
+        FrameLocation frame;
+        int64 duration;
+    };
+
+    const uint8 *GetData( size_t offset ) const;
+
+    /// Decodes the next entry of a chunk.
+    /// \return false if it would overrun m_Data.
+    bool Advance( Cursor &cursor, const uint8 *&p ) const;
+
+    std::vector< Chunk > m_Chunks;
+    std::vector< uint8 > m_Data;
+    size_t m_Count;
+    Cursor m_Last;
+    bool m_KeyframesOnly;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _TRACK_INDEX_H_
@@ -0,0 +1,508 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file async_io.cpp
+    \brief Asynchronous read-ahead, shared by all parsers in the process.
+*/
+
+#include "mkvreader/async_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <deque>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifdef MKVREADER_HAVE_IO_URING
+#   include <liburing.h>
+#endif
+
+
+using namespace LIBEBML_NAMESPACE;
+
+
+namespace mkvreader {
+
+
+    // Maximum number of requests the ring can hold, across all parsers.
+static const unsigned int RingEntries = 256;
+
+    // Read-ahead requests start on a page boundary.
+static const uint64 ReadAlignment = 4096;
+
+    // Threads doing preads, when there's no io_uring.
+static const unsigned int FallbackThreads = 4;
+
+    // Requests a callback keeps in flight: the one being consumed & at least one beyond it.
+static const unsigned int MinWindowDepth = 2;
+
+
+static int64 ReadAt( int fd, uint8 *buffer, size_t size, uint64 offset )
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        ssize_t num_read = pread( fd, buffer + total, size - total, off_t( offset + total ) );
+        if (num_read < 0)
+        {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (num_read == 0) break;
+        total += size_t( num_read );
+    }
+    return int64( total );
+}
+
+
+AsyncReadRequest::AsyncReadRequest()
+:
+    fd( -1 ),
+    offset( 0 ),
+    result( 0 ),
+    in_flight( false ),
+    done( false )
+{
+}
+
+
+#ifdef MKVREADER_HAVE_IO_URING
+struct AsyncIoContext::Ring {
+    struct io_uring ring;
+};
+#else
+struct AsyncIoContext::Ring {};
+#endif
+
+
+struct AsyncIoContext::Fallback {
+    Fallback(): stopping( false ) {}
+
+    boost::condition_variable work_ready;
+    std::deque< AsyncReadRequest * > work;
+    bool stopping;
+    boost::thread_group threads;
+};
+
+
+AsyncIoContext &AsyncIoContext::Instance()
+{
+    static AsyncIoContext instance;
+    return instance;
+}
+
+
+AsyncIoContext::AsyncIoContext()
+:
+    m_Reaping( false )
+{
+#ifdef MKVREADER_HAVE_IO_URING
+    m_Ring.reset( new Ring() );
+    if (io_uring_queue_init( RingEntries, &m_Ring->ring, 0 ) < 0) m_Ring.reset();
+#endif
+
+    if (!m_Ring)
+    {
+        m_Fallback.reset( new Fallback() );
+        for (unsigned int i = 0; i < FallbackThreads; i++)
+        {
+            m_Fallback->threads.create_thread( boost::bind( &AsyncIoContext::RunFallbackThread, this ) );
+        }
+    }
+}
+
+
+AsyncIoContext::~AsyncIoContext()
+{
+    if (m_Fallback)
+    {
+        {
+            boost::unique_lock< boost::mutex > lock( m_Mutex );
+            m_Fallback->stopping = true;
+            m_Fallback->work_ready.notify_all();
+        }
+        m_Fallback->threads.join_all();
+    }
+
+#ifdef MKVREADER_HAVE_IO_URING
+    if (m_Ring) io_uring_queue_exit( &m_Ring->ring );
+#endif
+}
+
+
+bool AsyncIoContext::UsingIoUring() const
+{
+    return bool( m_Ring );
+}
+
+
+void AsyncIoContext::Queue( AsyncReadRequest &request )
+{
+    request.in_flight = true;
+    request.done = false;
+
+    boost::unique_lock< boost::mutex > lock( m_Mutex );
+    m_Queued.push_back( &request );
+}
+
+
+void AsyncIoContext::Submit()
+{
+    boost::unique_lock< boost::mutex > lock( m_Mutex );
+    SubmitLocked();
+}
+
+
+void AsyncIoContext::Wait( AsyncReadRequest &request )
+{
+    boost::unique_lock< boost::mutex > lock( m_Mutex );
+    SubmitLocked();
+    while (!request.done)
+    {
+            // Only one thread reaps completions at a time.  The others wait for it,
+            // as they do for the fallback threads.
+        if (m_Reaping || !m_Ring) m_Reaped.wait( lock );
+        else Reap( true, lock );
+    }
+    request.in_flight = false;
+}
+
+
+bool AsyncIoContext::Poll( AsyncReadRequest &request )
+{
+    boost::unique_lock< boost::mutex > lock( m_Mutex );
+    SubmitLocked();
+
+        // If another thread is reaping, it'll collect ours, too.
+    if (!request.done && m_Ring && !m_Reaping) Reap( false, lock );
+
+    if (request.done) request.in_flight = false;
+    return request.done;
+}
+
+
+void AsyncIoContext::SubmitLocked()
+{
+    if (m_Queued.empty()) return;
+
+#ifdef MKVREADER_HAVE_IO_URING
+    if (m_Ring)
+    {
+        for (std::vector< AsyncReadRequest * >::iterator i = m_Queued.begin(); i != m_Queued.end(); ++i)
+        {
+            AsyncReadRequest &request = **i;
+            struct io_uring_sqe *sqe = io_uring_get_sqe( &m_Ring->ring );
+            if (!sqe)
+            {
+                    // The submission queue is full; make room.
+                io_uring_submit( &m_Ring->ring );
+                sqe = io_uring_get_sqe( &m_Ring->ring );
+            }
+            if (!sqe)
+            {
+                request.result = ReadAt( request.fd, &request.buffer.front(), request.buffer.size(), request.offset );
+                request.done = true;
+                continue;
+            }
+            io_uring_prep_read( sqe, request.fd, &request.buffer.front(), unsigned( request.buffer.size() ), request.offset );
+            io_uring_sqe_set_data( sqe, &request );
+        }
+        m_Queued.clear();
+        io_uring_submit( &m_Ring->ring );
+        return;
+    }
+#endif
+
+        // No io_uring, so hand the reads to the fallback threads, which do them unlocked.
+    m_Fallback->work.insert( m_Fallback->work.end(), m_Queued.begin(), m_Queued.end() );
+    m_Queued.clear();
+    m_Fallback->work_ready.notify_all();
+}
+
+
+void AsyncIoContext::RunFallbackThread()
+{
+    boost::unique_lock< boost::mutex > lock( m_Mutex );
+    while (true)
+    {
+        while (m_Fallback->work.empty() && !m_Fallback->stopping) m_Fallback->work_ready.wait( lock );
+        if (m_Fallback->work.empty()) return;
+
+        AsyncReadRequest &request = *m_Fallback->work.front();
+        m_Fallback->work.pop_front();
+
+        lock.unlock();
+        int64 result = ReadAt( request.fd, &request.buffer.front(), request.buffer.size(), request.offset );
+        lock.lock();
+
+        request.result = result;
+        request.done = true;
+        m_Reaped.notify_all();
+    }
+}
+
+
+void AsyncIoContext::Reap( bool block, boost::unique_lock< boost::mutex > &lock )
+{
+#ifdef MKVREADER_HAVE_IO_URING
+    if (m_Ring)
+    {
+        m_Reaping = true;
+        struct io_uring_cqe *cqe = NULL;
+        int err = 0;
+        if (block)
+        {
+                // Let other threads queue & submit while we're blocked.
+            lock.unlock();
+            err = io_uring_wait_cqe( &m_Ring->ring, &cqe );
+            lock.lock();
+        }
+        else err = io_uring_peek_cqe( &m_Ring->ring, &cqe );
+
+        while (err == 0 && cqe)
+        {
+            AsyncReadRequest *request = static_cast< AsyncReadRequest * >( io_uring_cqe_get_data( cqe ) );
+            request->result = cqe->res;
+            request->done = true;
+            io_uring_cqe_seen( &m_Ring->ring, cqe );
+
+            cqe = NULL;
+            err = io_uring_peek_cqe( &m_Ring->ring, &cqe );
+        }
+        m_Reaping = false;
+        m_Reaped.notify_all();
+        return;
+    }
+#else
+    (void) block;
+    (void) lock;
+#endif
+}
+
+
+AsyncReadCallback::AsyncReadCallback( const char *filename, size_t read_size, unsigned int depth )
+:
+    m_Context( AsyncIoContext::Instance() ),
+    m_Fd( open( filename, O_RDONLY | O_CLOEXEC ) ),
+    m_FileSize( 0 ),
+    m_Pos( 0 ),
+    m_NextOffset( 0 ),
+    m_ReadSize( std::max( read_size, size_t( ReadAlignment ) ) ),
+    m_Window( std::max( depth, MinWindowDepth ) )
+{
+    if (m_Fd < 0) throw std::runtime_error( boost::str(
+        boost::format( "AsyncReadCallback: failed to open %s: %s" ) % filename % strerror( errno ) ) );
+
+    UpdateFileSize();
+
+    for (std::vector< AsyncReadRequest >::iterator i = m_Window.begin(); i != m_Window.end(); ++i)
+    {
+        i->fd = m_Fd;
+        i->buffer.resize( m_ReadSize );
+    }
+}
+
+
+AsyncReadCallback::~AsyncReadCallback()
+{
+    close();
+}
+
+
+AsyncReadRequest *AsyncReadCallback::FindRequest( uint64 pos )
+{
+    for (std::vector< AsyncReadRequest >::iterator i = m_Window.begin(); i != m_Window.end(); ++i)
+    {
+        if ((i->in_flight || i->done) && pos >= i->offset && pos < i->offset + m_ReadSize) return &*i;
+    }
+    return NULL;
+}
+
+
+    // Whether a request is for data that's already been consumed, or, since a seek, won't be.
+bool AsyncReadCallback::IsStale( const AsyncReadRequest &request ) const
+{
+    return request.offset + m_ReadSize <= m_Pos || request.offset >= m_NextOffset;
+}
+
+
+void AsyncReadCallback::Retire( AsyncReadRequest &request )
+{
+        // The kernel may still be writing into the buffer.
+    if (request.in_flight) m_Context.Wait( request );
+    request.done = false;
+}
+
+
+void AsyncReadCallback::RestartWindow( uint64 pos )
+{
+        // Requests still in flight are left to finish; FillWindow() recycles them, after.
+    m_NextOffset = pos - (pos % ReadAlignment);
+    FillWindow();
+
+        // If they're all still in flight, wait for one, so there's room for the read we need.
+    if (!FindRequest( pos ) && pos < m_FileSize)
+    {
+        Retire( m_Window.front() );
+        FillWindow();
+    }
+}
+
+
+void AsyncReadCallback::FillWindow()
+{
+    bool queued = false;
+    for (std::vector< AsyncReadRequest >::iterator i = m_Window.begin(); i != m_Window.end(); ++i)
+    {
+            // Recycle requests which have completed, without waiting for any.
+        if (i->in_flight && IsStale( *i )) m_Context.Poll( *i );
+        if (!i->in_flight && i->done && IsStale( *i )) i->done = false;
+
+        if (!i->in_flight && !i->done && m_NextOffset < m_FileSize)
+        {
+            i->offset = m_NextOffset;
+            m_NextOffset += m_ReadSize;
+            m_Context.Queue( *i );
+            queued = true;
+        }
+    }
+
+        // Everything we queued goes out in one batch, along with anything queued by other parsers.
+    if (queued) m_Context.Submit();
+}
+
+
+AsyncReadRequest *AsyncReadCallback::ReadAhead( uint64 pos )
+{
+    if (pos >= m_FileSize) return NULL;
+
+    AsyncReadRequest *request = FindRequest( pos );
+    if (!request)
+    {
+        RestartWindow( pos );
+        request = FindRequest( pos );
+    }
+
+    return (request && request->in_flight) ? request : NULL;
+}
+
+
+bool AsyncReadCallback::UpdateFileSize()
+{
+    struct stat st;
+    if (fstat( m_Fd, &st ) != 0 || uint64( st.st_size ) <= m_FileSize) return false;
+
+    m_FileSize = uint64( st.st_size );
+    return true;
+}
+
+
+uint32 AsyncReadCallback::read( void *buffer, size_t size )
+{
+    uint8 *dest = static_cast< uint8 * >( buffer );
+    size_t total = 0;
+        // At the end, check whether the file has grown (e.g. in follow mode).  A short
+        // read at the old end is then reissued, below.
+    while (total < size && (m_Pos < m_FileSize || UpdateFileSize()))
+    {
+        AsyncReadRequest *request = FindRequest( m_Pos );
+        if (!request)
+        {
+            RestartWindow( m_Pos );
+            request = FindRequest( m_Pos );
+            if (!request) break;
+        }
+
+        if (request->in_flight) m_Context.Wait( *request );
+        if (request->result < 0) throw std::runtime_error( boost::str(
+            boost::format( "AsyncReadCallback::read(): %s" ) % strerror( int( -request->result ) ) ) );
+
+        uint64 avail_end = request->offset + uint64( request->result );
+        if (m_Pos >= avail_end)
+        {
+                // A short read, before the end of the file.  Start over from here.
+            if (avail_end >= m_FileSize) break;
+            request->done = false;
+            RestartWindow( m_Pos );
+            continue;
+        }
+
+        size_t num = size_t( std::min( uint64( size - total ), avail_end - m_Pos ) );
+        memcpy( dest + total, &request->buffer[ size_t( m_Pos - request->offset ) ], num );
+        total += num;
+        m_Pos += num;
+
+        FillWindow();
+    }
+    return uint32( total );
+}
+
+
+void AsyncReadCallback::setFilePointer( int64 offset, seek_mode mode )
+{
+    int64 base = 0;
+    if (mode == seek_current) base = int64( m_Pos );
+    else if (mode == seek_end) base = int64( m_FileSize );
+
+    int64 pos = base + offset;
+    m_Pos = (pos < 0) ? 0 : uint64( pos );
+}
+
+
+size_t AsyncReadCallback::write( const void *, size_t )
+{
+    throw std::runtime_error( "AsyncReadCallback::write(): read-only" );
+}
+
+
+uint64 AsyncReadCallback::getFilePointer()
+{
+    return m_Pos;
+}
+
+
+void AsyncReadCallback::close()
+{
+    if (m_Fd < 0) return;
+
+    for (std::vector< AsyncReadRequest >::iterator i = m_Window.begin(); i != m_Window.end(); ++i)
+    {
+        Retire( *i );
+    }
+    ::close( m_Fd );
+    m_Fd = -1;
+}
+
+
+}   // namespace mkvreader
+
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file chapter_index.cpp
+    \brief Finds the chapters in effect at a given time.
+*/
+
+#include "mkvreader/chapter_index.h"
+#include "mkvreader/matroska_parser.h"
+
+#include <algorithm>
+
+
+namespace mkvreader {
+
+
+void ChapterIndex::Build( const std::vector< MatroskaChapterInfo > &chapters )
+{
+    Clear();
+    Add( chapters, 0 );
+
+    std::stable_sort( m_Entries.begin(), m_Entries.end() );
+    m_MaxEnd.resize( m_Entries.size() );
+    BuildMaxEnd( 0, m_Entries.size() );
+}
+
+
+void ChapterIndex::Clear()
+{
+    m_Entries.clear();
+    m_MaxEnd.clear();
+}
+
+
+void ChapterIndex::Find( uint64 timecode, std::vector< const MatroskaChapterInfo * > &dest ) const
+{
+    Find( 0, m_Entries.size(), timecode, dest );
+}
+
+
+void ChapterIndex::Add( const std::vector< MatroskaChapterInfo > &chapters, uint64 parent_end )
+{
+    for (size_t i = 0; i < chapters.size(); i++)
+    {
+        const MatroskaChapterInfo &chapter = chapters[i];
+
+        Entry entry;
+        entry.start = chapter.timeStart;
+        entry.end = chapter.timeEnd ? chapter.timeEnd : parent_end;
+        entry.end = std::max( entry.end, entry.start + 1 );     // So that instants can be found.
+        entry.chapter = &chapter;
+        m_Entries.push_back( entry );
+
+        Add( chapter.subChapters, entry.end );
+    }
+}
+
+
+uint64 ChapterIndex::BuildMaxEnd( size_t begin, size_t end )
+{
+    if (begin >= end) return 0;
+
+    const size_t mid = begin + (end - begin) / 2;
+    const uint64 left = BuildMaxEnd( begin, mid );
+    const uint64 right = BuildMaxEnd( mid + 1, end );
+    m_MaxEnd[mid] = std::max( m_Entries[mid].end, std::max( left, right ) );
+    return m_MaxEnd[mid];
+}
+
+
+void ChapterIndex::Find( size_t begin, size_t end, uint64 timecode,
+    std::vector< const MatroskaChapterInfo * > &dest ) const
+{
+    if (begin >= end) return;
+
+    const size_t mid = begin + (end - begin) / 2;
+    if (m_MaxEnd[mid] <= timecode) return;     // Everything in this subtree has ended.
+
+    Find( begin, mid, timecode, dest );
+
+        // Nothing after this starts any earlier.
+    const Entry &entry = m_Entries[mid];
+    if (entry.start > timecode) return;
+
+    if (timecode < entry.end) dest.push_back( entry.chapter );
+    Find( mid + 1, end, timecode, dest );
+}
+
+
+}   // namespace mkvreader
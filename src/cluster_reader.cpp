@@ -0,0 +1,333 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file cluster_reader.cpp
+    \brief Locating clusters & decoding blocks from raw bytes.
+*/
+
+#include "cluster_reader.h"
+#include "ebml_util.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+
+namespace mkvreader {
+
+
+    // Enough for a cluster's header, a CRC-32, and its Timecode, which comes first.
+static const size_t ClusterHeadReadSize = 64;
+
+    // How much FindLastCluster() reads at a time.
+static const size_t TailScanChunkSize = 64 * 1024;
+
+    // How much ScanClusterBlocks() reads at a time.  It's worth reading past a small
+    // payload, to get at the next element, rather than seeking over it.
+static const size_t ScanWindowSize = 4096;
+
+    // Enough for a block's track number, timecode, flags & lace count.
+static const size_t MaxBlockHeaderSize = 12;
+
+
+    // Reads the head of a cluster, from the avail bytes of the file at pos, in buffer.
+    // Returns false if it's not a cluster or its Timecode isn't there, in which case
+    // the timecode is left as 0.
+static bool ReadClusterHead( const uint8 *buffer, size_t avail, uint64 pos, uint64 end,
+    ClusterLocation &cluster )
+{
+    ElementHead head;
+    if (!ReadElementHead( buffer, avail, head ) || head.id != IdCluster) return false;
+
+    cluster.filePos = pos;
+    cluster.dataPos = pos + head.headSize;
+    cluster.size = head.size;
+    cluster.timecode = 0;
+    if (head.unknownSize || cluster.dataPos + head.size > end)
+    {
+        cluster.size = (cluster.dataPos < end) ? end - cluster.dataPos : 0;
+    }
+
+    ElementHead child;
+    for (size_t p = head.headSize; p < avail; p += child.headSize + size_t( child.size ))
+    {
+        if (!ReadElementHead( buffer + p, avail - p, child ) || child.unknownSize) break;
+        if (child.id == IdClusterTimecode)
+        {
+            if (p + child.headSize + child.size > avail) break;
+
+            cluster.timecode = ReadUInt( buffer + p + child.headSize, size_t( child.size ) );
+            return true;
+        }
+        if (child.id != IdCrc32 && child.id != IdVoid) break;
+    }
+
+    return false;
+}
+
+
+uint64 FindClusters( const ReadAtFunction &read_at, uint64 pos, uint64 end,
+    std::vector< ClusterLocation > &clusters )
+{
+    uint8 buffer[ClusterHeadReadSize];
+    while (pos < end)
+    {
+        const size_t avail = read_at( pos, buffer, size_t( std::min( uint64( sizeof( buffer ) ), end - pos ) ) );
+
+        ElementHead head;
+        if (!ReadElementHead( buffer, avail, head ) || head.unknownSize) break;
+
+        if (head.id == IdCluster)
+        {
+            ClusterLocation cluster;
+            if (!ReadClusterHead( buffer, avail, pos, end, cluster ))
+            {
+                cluster.timecode = clusters.empty() ? 0 : clusters.back().timecode;
+            }
+            clusters.push_back( cluster );
+        }
+
+        pos += head.headSize + head.size;
+    }
+
+    return pos;
+}
+
+
+    // Holds the bytes of the file last read, to serve reads near each other.
+class ScanWindow {
+public:
+    ScanWindow( const ReadAtFunction &read_at, uint64 end )
+        : m_ReadAt( read_at ), m_End( end ), m_Pos( 0 ), m_Size( 0 ), m_Buffer( ScanWindowSize )
+    {
+    }
+
+        // Returns the bytes at pos, of which there are avail, up to size.
+    const uint8 *Get( uint64 pos, size_t size, size_t &avail )
+    {
+        if (pos < m_Pos || pos + size > m_Pos + m_Size)
+        {
+            m_Pos = pos;
+            m_Size = (pos < m_End) ? m_ReadAt( pos, &m_Buffer.front(), size_t( std::min( uint64( m_Buffer.size() ), m_End - pos ) ) ) : 0;
+        }
+
+        const size_t offset = size_t( pos - m_Pos );
+        avail = (offset < m_Size) ? std::min( size, m_Size - offset ) : 0;
+        return &m_Buffer.front() + offset;
+    }
+
+private:
+    const ReadAtFunction &m_ReadAt;
+    uint64 m_End;
+    uint64 m_Pos;
+    size_t m_Size;
+    ByteArray m_Buffer;
+};
+
+
+bool FindLastCluster( const ReadAtFunction &read_at, uint64 start, uint64 end, uint64 range,
+    ClusterLocation &cluster )
+{
+    const uint8 clusterId[] = { 0x1F, 0x43, 0xB6, 0x75 };
+    const uint64 limit = (end - std::min( start, end ) > range) ? end - range : start;
+
+        // Each chunk is read with the head of anything starting near its end.
+    ByteArray chunk( TailScanChunkSize + ClusterHeadReadSize );
+    uint64 chunkEnd = end;
+    while (chunkEnd > limit)
+    {
+        const uint64 chunkPos = (chunkEnd - limit > TailScanChunkSize) ? chunkEnd - TailScanChunkSize : limit;
+        const size_t avail = read_at( chunkPos, &chunk.front(), size_t( std::min( uint64( chunk.size() ), end - chunkPos ) ) );
+
+        for (size_t i = size_t( std::min( chunkEnd - chunkPos, uint64( avail ) ) ); i-- > 0; )
+        {
+            if (chunk[i] != clusterId[0] || avail - i < sizeof( clusterId )
+                || memcmp( &chunk[i], clusterId, sizeof( clusterId ) ) != 0) continue;
+
+            if (ReadClusterHead( &chunk[i], avail - i, chunkPos + i, end, cluster )) return true;
+        }
+        chunkEnd = chunkPos;
+    }
+
+    return false;
+}
+
+
+bool ReadBlockHeader( const uint8 *p, size_t size, BlockHeader &header )
+{
+    const unsigned int trackLen = ReadVint( p, size, header.trackNum );
+    if (trackLen == 0 || trackLen + 3 > size) return false;
+
+    header.relTimecode = int16( (p[trackLen] << 8) | p[trackLen + 1] );
+    header.flags = p[trackLen + 2];
+    header.size = trackLen + 3;
+    header.numLaces = 1;
+    if (header.Lacing() != 0)
+    {
+        if (header.size >= size) return false;
+        header.numLaces = p[header.size++] + 1u;
+    }
+
+    return true;
+}
+
+
+bool ReadLaces( const uint8 *p, size_t size, const BlockHeader &header, std::vector< PayloadView > &laces )
+{
+    laces.clear();
+    size_t pos = header.size;
+    if (pos > size) return false;
+
+    std::vector< size_t > sizes( header.numLaces );
+    const size_t last = header.numLaces - 1;
+    size_t total = 0;
+    switch (header.Lacing())
+    {
+    case 0:
+        break;
+
+    case 1:     // Xiph: each size is a run of 255s plus a final byte.
+        for (size_t i = 0; i < last; i++)
+        {
+            uint8 byte;
+            do
+            {
+                if (pos >= size) return false;
+                byte = p[pos++];
+                sizes[i] += byte;
+            } while (byte == 255);
+            total += sizes[i];
+        }
+        break;
+
+    case 2:     // Fixed: the laces divide the rest evenly.
+        if ((size - pos) % header.numLaces != 0) return false;
+        for (size_t i = 0; i < last; i++)
+        {
+            sizes[i] = (size - pos) / header.numLaces;
+            total += sizes[i];
+        }
+        break;
+
+    case 3:     // EBML: the first size, then signed differences from the previous.
+        for (size_t i = 0; i < last; i++)
+        {
+            uint64 value = 0;
+            const unsigned int len = ReadVint( p + pos, size - pos, value );
+            if (len == 0) return false;
+            pos += len;
+
+            int64 lace_size = int64( value );
+            if (i > 0) lace_size += int64( sizes[i - 1] ) - ((int64( 1 ) << (7 * len - 1)) - 1);
+            if (lace_size < 0) return false;
+            sizes[i] = size_t( lace_size );
+            total += sizes[i];
+        }
+        break;
+    }
+
+    if (pos + total > size) return false;
+    sizes[last] = size - pos - total;
+
+    laces.reserve( header.numLaces );
+    for (size_t i = 0; i < header.numLaces; i++)
+    {
+        laces.push_back( PayloadView( p + pos, sizes[i] ) );
+        pos += sizes[i];
+    }
+
+    return true;
+}
+
+
+bool ScanClusterBlocks( const ReadAtFunction &read_at, const ClusterLocation &cluster,
+    const BlockDescriptorFunction &callback )
+{
+    const uint64 end = cluster.dataPos + cluster.size;
+    ScanWindow window( read_at, end );
+    int64 clusterTimecode = int64( cluster.timecode );
+
+    ElementHead child;
+    for (uint64 pos = cluster.dataPos; pos < end; pos += child.headSize + child.size)
+    {
+        size_t avail;
+        const uint8 *p = window.Get( pos, MaxElementHeadSize, avail );
+        if (!ReadElementHead( p, avail, child ) || child.unknownSize) break;
+
+        const uint64 dataPos = pos + child.headSize;
+        BlockDescriptor block;
+        block.filePos = pos;
+        block.size = child.headSize + child.size;
+        block.duration = 0;
+        block.keyframe = true;
+        bool haveBlock = false;
+        if (child.id == IdClusterTimecode)
+        {
+            p = window.Get( dataPos, size_t( child.size ), avail );
+            if (avail == child.size) clusterTimecode = int64( ReadUInt( p, avail ) );
+        }
+        else if (child.id == IdSimpleBlock)
+        {
+            p = window.Get( dataPos, MaxBlockHeaderSize, avail );
+            haveBlock = ReadBlockHeader( p, size_t( std::min( uint64( avail ), child.size ) ), block.header );
+            block.keyframe = block.header.IsKeyframe();
+        }
+        else if (child.id == IdBlockGroup)
+        {
+            ElementHead groupChild;
+            for (uint64 q = dataPos; q < dataPos + child.size; q += groupChild.headSize + groupChild.size)
+            {
+                p = window.Get( q, MaxElementHeadSize, avail );
+                if (!ReadElementHead( p, avail, groupChild ) || groupChild.unknownSize) break;
+
+                const uint64 groupDataPos = q + groupChild.headSize;
+                if (groupChild.id == IdBlock)
+                {
+                    p = window.Get( groupDataPos, MaxBlockHeaderSize, avail );
+                    haveBlock = ReadBlockHeader( p, size_t( std::min( uint64( avail ), groupChild.size ) ), block.header );
+                }
+                else if (groupChild.id == IdReferenceBlock)
+                {
+                    block.keyframe = false;
+                }
+                else if (groupChild.id == IdBlockDuration)
+                {
+                    p = window.Get( groupDataPos, size_t( groupChild.size ), avail );
+                    if (avail == groupChild.size) block.duration = ReadUInt( p, avail );
+                }
+            }
+        }
+        if (!haveBlock) continue;
+
+        block.timecode = clusterTimecode + block.header.relTimecode;
+        if (!callback( block )) return false;
+    }
+
+    return true;
+}
+
+
+}   // namespace mkvreader
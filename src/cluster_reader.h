@@ -0,0 +1,124 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file cluster_reader.h
+    \brief Locating clusters & decoding blocks from raw bytes, for readers that
+        don't go through libmatroska's stateful stream.
+*/
+
+#ifndef _CLUSTER_READER_H_
+#define _CLUSTER_READER_H_
+
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "mkvreader/matroska_parser.h"
+
+
+namespace mkvreader {
+
+
+/// Where a cluster is in the file.
+struct ClusterLocation {
+    uint64 filePos;     ///< Of the Cluster element.
+    uint64 dataPos;     ///< Of its first child.
+    uint64 size;        ///< Of its data.
+    uint64 timecode;    ///< In units of the segment's TimecodeScale.
+};
+
+
+/// Reads up to size bytes at pos, returning the number read.
+typedef boost::function< size_t ( uint64 pos, void *buffer, size_t size ) > ReadAtFunction;
+
+
+/// Hops from the level-1 element at pos to end, by element sizes alone, recording
+/// the clusters it passes.  Only the head of each cluster is read.  Stops at an
+/// element of unknown size, since it can't be hopped over.
+/// \return the position where it stopped.
+uint64 FindClusters( const ReadAtFunction &read_at, uint64 pos, uint64 end,
+    std::vector< ClusterLocation > &clusters );
+
+
+/// Searches backwards from end, through at most range bytes (but not before start),
+/// for the head of the last cluster.  One of unknown size, or cut short, is taken to
+/// end with the file.  Candidates are only accepted if their Timecode follows.
+/// \return false if there's none within range.
+bool FindLastCluster( const ReadAtFunction &read_at, uint64 start, uint64 end, uint64 range,
+    ClusterLocation &cluster );
+
+
+/// The fields at the start of a Block or SimpleBlock.
+struct BlockHeader {
+    uint64 trackNum;
+    int16 relTimecode;  ///< Relative to the cluster.
+    uint8 flags;
+    size_t size;        ///< Of the header, including the lace count.
+    unsigned int numLaces;
+
+    bool IsKeyframe() const { return (flags & 0x80) != 0; }     ///< Of SimpleBlocks, only.
+    unsigned int Lacing() const { return (flags >> 1) & 3; }
+};
+
+
+/// Decodes the header of the Block or SimpleBlock data at p.
+/// \return false if it's truncated or invalid.
+bool ReadBlockHeader( const uint8 *p, size_t size, BlockHeader &header );
+
+
+/// Locates each lace of the Block or SimpleBlock data at p, after its header.
+/// \return false if the lace sizes are inconsistent with the block's.
+bool ReadLaces( const uint8 *p, size_t size, const BlockHeader &header, std::vector< PayloadView > &laces );
+
+
+/// What can be learned of a block from the heads of its elements, without its payload.
+struct BlockDescriptor {
+    uint64 filePos;     ///< Of the SimpleBlock or BlockGroup.
+    uint64 size;        ///< Of that element, including its head.
+    BlockHeader header;
+    int64 timecode;     ///< The cluster's, plus the block's relative timecode.
+    uint64 duration;    ///< From its BlockDuration, or 0 if it has none.
+    bool keyframe;      ///< Either flagged as such, or without a ReferenceBlock.
+};
+
+
+/// Called for each block found by ScanClusterBlocks().  Returns false to stop.
+typedef boost::function< bool ( const BlockDescriptor &block ) > BlockDescriptorFunction;
+
+
+/// Describes the blocks of a cluster, in order, by reading only the heads of its
+/// elements & the headers of its blocks.  Elements close together are read in one go,
+/// so small blocks cost no extra reads, while large payloads are skipped over.
+/// \return false if the callback stopped the scan.
+bool ScanClusterBlocks( const ReadAtFunction &read_at, const ClusterLocation &cluster,
+    const BlockDescriptorFunction &callback );
+
+
+}   // namespace mkvreader
+
+
+#endif // _CLUSTER_READER_H_
@@ -0,0 +1,308 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file content_decoder.cpp
+    \brief Decoding of ContentEncodings (header stripping & zlib) in frame payloads.
+*/
+
+#include "content_decoder.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+
+namespace mkvreader {
+
+
+BufferPool::BufferPool( size_t max_buffers )
+:
+    m_MaxBuffers( max_buffers )
+{
+    m_Free.reserve( max_buffers );
+}
+
+
+void BufferPool::Acquire( ByteArray &dest )
+{
+    dest.clear();
+    if (dest.capacity() > 0) return;
+
+    boost::mutex::scoped_lock lock( m_Mutex );
+    if (m_Free.empty()) return;
+
+    dest.swap( m_Free.back() );
+    m_Free.pop_back();
+}
+
+
+void BufferPool::Release( ByteArray &buffer )
+{
+    buffer.clear();
+    if (buffer.capacity() == 0) return;
+
+    boost::mutex::scoped_lock lock( m_Mutex );
+    if (m_Free.size() >= m_MaxBuffers)
+    {
+        ByteArray().swap( buffer );
+        return;
+    }
+
+    m_Free.push_back( ByteArray() );
+    m_Free.back().swap( buffer );
+}
+
+
+bool EncodesFrames( const MatroskaTrackInfo &track )
+{
+    for (size_t i = 0; i < track.contentEncodings.size(); i++)
+    {
+        if (track.contentEncodings[i].scope & ContentScopeFrames) return true;
+    }
+    return false;
+}
+
+
+static bool IsDecodable( const MatroskaContentEncoding &encoding )
+{
+    return encoding.type == 0
+        && (encoding.compAlgo == ContentCompZlib || encoding.compAlgo == ContentCompHeaderStripping);
+}
+
+
+bool IsDecodable( const MatroskaTrackInfo &track )
+{
+    for (size_t i = 0; i < track.contentEncodings.size(); i++)
+    {
+        if (!IsDecodable( track.contentEncodings[i] )) return false;
+    }
+    return true;
+}
+
+
+static bool Inflate( PayloadView src, ByteArray &dest )
+{
+    z_stream stream;
+    memset( &stream, 0, sizeof( stream ) );
+    if (inflateInit( &stream ) != Z_OK) return false;
+
+    stream.next_in = const_cast< Bytef * >( src.data );
+    stream.avail_in = uInt( src.size );
+
+        // Only what's handed to zlib is zero-filled, so it grows with the output, rather
+        // than filling the whole capacity the buffer brought from the pool.
+    size_t out_size = 0;
+    size_t step = src.size * 2 + 64;
+    int result = Z_OK;
+    while (result == Z_OK)
+    {
+        if (out_size == dest.size())
+        {
+            dest.resize( out_size + step );
+            step = dest.size();
+        }
+
+        stream.next_out = &dest[out_size];
+        stream.avail_out = uInt( dest.size() - out_size );
+        result = inflate( &stream, Z_NO_FLUSH );
+        out_size = dest.size() - stream.avail_out;
+    }
+    inflateEnd( &stream );
+
+    dest.resize( out_size );
+    return result == Z_STREAM_END;
+}
+
+
+static bool Decode( const MatroskaContentEncoding &encoding, PayloadView src, ByteArray &dest )
+{
+    if (encoding.type != 0) return false;   // Encryption isn't supported.
+
+    switch (encoding.compAlgo)
+    {
+    case ContentCompHeaderStripping:
+        dest.reserve( encoding.compSettings.size() + src.size );
+        dest.assign( encoding.compSettings.begin(), encoding.compSettings.end() );
+        dest.insert( dest.end(), src.data, src.data + src.size );
+        return true;
+
+    case ContentCompZlib:
+        return Inflate( src, dest );
+    }
+
+    return false;
+}
+
+
+bool DecodeData( const std::vector< MatroskaContentEncoding > &encodings, unsigned int scope,
+    PayloadView src, ByteArray &dest, BufferPool &pool )
+{
+    bool first = true;
+    ByteArray scratch;
+    for (std::vector< MatroskaContentEncoding >::const_iterator encoding = encodings.begin();
+        encoding != encodings.end();
+        ++encoding)
+    {
+        if (!(encoding->scope & scope)) continue;
+
+            // After the first, each encoding is decoded from dest into scratch, which then replaces it.
+        if (!first) pool.Acquire( scratch );
+        ByteArray &out = first ? dest : scratch;
+        out.clear();
+        if (!Decode( *encoding, src, out ))
+        {
+            if (!first) pool.Release( scratch );
+            return false;
+        }
+
+        if (!first)
+        {
+            dest.swap( scratch );
+            pool.Release( scratch );
+        }
+        src = PayloadView( dest.empty() ? NULL : &dest.front(), dest.size() );
+        first = false;
+    }
+
+    if (first) dest.assign( src.data, src.data + src.size );
+    return true;
+}
+
+
+bool DecodeFrame( const std::vector< MatroskaContentEncoding > &encodings, MatroskaFrame &frame, BufferPool &pool )
+{
+    bool success = true;
+    if (!frame.dataViews.empty())
+    {
+            // Decoded laces can't refer to the source, so they move into dataBuffer.
+        frame.dataBuffer.resize( frame.dataViews.size() );
+        for (size_t i = 0; i < frame.dataViews.size(); i++)
+        {
+            const PayloadView &src = frame.dataViews[i];
+            ByteArray &dest = frame.dataBuffer[i];
+            pool.Acquire( dest );
+            if (!DecodeData( encodings, ContentScopeFrames, src, dest, pool ))
+            {
+                dest.assign( src.data, src.data + src.size );
+                success = false;
+            }
+        }
+        frame.dataViews.clear();
+        frame.dataOwner.reset();
+    }
+    else
+    {
+        ByteArray decoded;
+        for (size_t i = 0; i < frame.dataBuffer.size(); i++)
+        {
+            pool.Acquire( decoded );
+            if (DecodeData( encodings, ContentScopeFrames, frame.get_lace( i ), decoded, pool ))
+            {
+                frame.dataBuffer[i].swap( decoded );
+            }
+            else success = false;
+            pool.Release( decoded );
+        }
+    }
+
+    return success;
+}
+
+
+DecodeWorkers::DecodeWorkers( unsigned int num_threads, BufferPool &pool )
+:
+    m_Pool( pool ),
+    m_Busy( 0 ),
+    m_Failures( 0 ),
+    m_Stopping( false )
+{
+    for (unsigned int i = 0; i < num_threads; i++)
+    {
+        m_Threads.create_thread( boost::bind( &DecodeWorkers::Run, this ) );
+    }
+}
+
+
+DecodeWorkers::~DecodeWorkers()
+{
+    {
+        boost::mutex::scoped_lock lock( m_Mutex );
+        m_Stopping = true;
+    }
+    m_JobReady.notify_all();
+    m_Threads.join_all();
+}
+
+
+void DecodeWorkers::Post( const std::vector< MatroskaContentEncoding > &encodings, MatroskaFrame &frame )
+{
+    Job job = { &encodings, &frame };
+    {
+        boost::mutex::scoped_lock lock( m_Mutex );
+        m_Jobs.push_back( job );
+    }
+    m_JobReady.notify_one();
+}
+
+
+unsigned int DecodeWorkers::Wait()
+{
+    boost::mutex::scoped_lock lock( m_Mutex );
+    while (!m_Jobs.empty() || m_Busy > 0) m_Idle.wait( lock );
+
+    unsigned int failures = m_Failures;
+    m_Failures = 0;
+    return failures;
+}
+
+
+void DecodeWorkers::Run()
+{
+    boost::mutex::scoped_lock lock( m_Mutex );
+    while (true)
+    {
+        while (m_Jobs.empty() && !m_Stopping) m_JobReady.wait( lock );
+        if (m_Jobs.empty()) return;     // Stopping, with nothing left to do.
+
+        Job job = m_Jobs.front();
+        m_Jobs.pop_front();
+        m_Busy++;
+
+        lock.unlock();
+        bool success = DecodeFrame( *job.encodings, *job.frame, m_Pool );
+        lock.lock();
+
+        if (!success) m_Failures++;
+        m_Busy--;
+        if (m_Jobs.empty() && m_Busy == 0) m_Idle.notify_all();
+    }
+}
+
+
+}   // namespace mkvreader
+
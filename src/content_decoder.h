@@ -0,0 +1,136 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file content_decoder.h
+    \brief Decoding of ContentEncodings (header stripping & zlib) in frame payloads.
+*/
+
+#ifndef _CONTENT_DECODER_H_
+#define _CONTENT_DECODER_H_
+
+
+#include <deque>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "mkvreader/matroska_parser.h"
+
+
+namespace mkvreader {
+
+
+/// ContentCompAlgo values.
+enum ContentCompAlgo {
+    ContentCompZlib = 0,
+    ContentCompBzlib = 1,
+    ContentCompLzo = 2,
+    ContentCompHeaderStripping = 3
+};
+
+/// ContentEncodingScope bits.
+enum ContentEncodingScope {
+    ContentScopeFrames = 1,
+    ContentScopeCodecPrivate = 2
+};
+
+
+/// Holds payload buffers for reuse, so that reading frames needn't allocate once
+/// the pool has warmed up.  Thread-safe.
+class BufferPool {
+public:
+    explicit BufferPool( size_t max_buffers = 1024 );
+
+    /// Provides dest with storage from the pool, if it has none.  dest is left empty.
+    void Acquire( ByteArray &dest );
+
+    /// Takes buffer's storage back into the pool, leaving buffer empty.
+    void Release( ByteArray &buffer );
+
+private:
+    boost::mutex m_Mutex;
+    std::vector< ByteArray > m_Free;
+    size_t m_MaxBuffers;
+};
+
+
+/// Returns whether a track's frames need decoding.
+bool EncodesFrames( const MatroskaTrackInfo &track );
+
+/// Returns whether all of a track's encodings can be decoded.
+bool IsDecodable( const MatroskaTrackInfo &track );
+
+/// Decodes data, applying the encodings with the given scope, in order, into dest.
+/// \return false if any of them couldn't be decoded.
+bool DecodeData( const std::vector< MatroskaContentEncoding > &encodings, unsigned int scope,
+    PayloadView src, ByteArray &dest, BufferPool &pool );
+
+/// Replaces each lace of frame with its decoded form.  Laces that can't be decoded are
+/// left as they were.
+/// \return false if any lace couldn't be decoded.
+bool DecodeFrame( const std::vector< MatroskaContentEncoding > &encodings, MatroskaFrame &frame, BufferPool &pool );
+
+
+/// Worker threads for DecodeFrame().
+class DecodeWorkers {
+public:
+    DecodeWorkers( unsigned int num_threads, BufferPool &pool );
+
+    /// Finishes any queued work, then stops the threads.
+    ~DecodeWorkers();
+
+    /// Queues a frame for decoding.  The frame & encodings must remain valid until Wait() returns.
+    void Post( const std::vector< MatroskaContentEncoding > &encodings, MatroskaFrame &frame );
+
+    /// Blocks until all queued frames are decoded.
+    /// \return the number of frames with laces that couldn't be decoded, since the last call.
+    unsigned int Wait();
+
+private:
+    struct Job {
+        const std::vector< MatroskaContentEncoding > *encodings;
+        MatroskaFrame *frame;
+    };
+
+    void Run();
+
+    BufferPool &m_Pool;
+    boost::mutex m_Mutex;
+    boost::condition_variable m_JobReady;
+    boost::condition_variable m_Idle;
+    std::deque< Job > m_Jobs;
+    unsigned int m_Busy;
+    unsigned int m_Failures;
+    bool m_Stopping;
+    boost::thread_group m_Threads;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _CONTENT_DECODER_H_
@@ -0,0 +1,198 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file ebml_util.h
+    \brief Minimal EBML decoding & encoding, for code that walks raw bytes
+        instead of going through libebml.
+*/
+
+#ifndef _EBML_UTIL_H_
+#define _EBML_UTIL_H_
+
+
+#include <string.h>
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+    // Element IDs, with their length markers.
+static const uint32 IdEbmlHead       = 0x1A45DFA3;
+static const uint32 IdSegment        = 0x18538067;
+static const uint32 IdSeekHead       = 0x114D9B74;
+static const uint32 IdInfo           = 0x1549A966;
+static const uint32 IdTimecodeScale  = 0x2AD7B1;
+static const uint32 IdDuration       = 0x4489;
+static const uint32 IdTracks         = 0x1654AE6B;
+static const uint32 IdChapters       = 0x1043A770;
+static const uint32 IdTags           = 0x1254C367;
+static const uint32 IdAttachments    = 0x1941A469;
+static const uint32 IdCluster        = 0x1F43B675;
+static const uint32 IdClusterTimecode = 0xE7;
+static const uint32 IdClusterPosition = 0xA7;
+static const uint32 IdClusterPrevSize = 0xAB;
+static const uint32 IdSimpleBlock    = 0xA3;
+static const uint32 IdBlockGroup     = 0xA0;
+static const uint32 IdBlock          = 0xA1;
+static const uint32 IdBlockDuration  = 0x9B;
+static const uint32 IdReferenceBlock = 0xFB;
+static const uint32 IdCues           = 0x1C53BB6B;
+static const uint32 IdCuePoint       = 0xBB;
+static const uint32 IdCueTime        = 0xB3;
+static const uint32 IdCueTrackPositions = 0xB7;
+static const uint32 IdCueTrack       = 0xF7;
+static const uint32 IdCueClusterPosition = 0xF1;
+static const uint32 IdCueRelativePosition = 0xF0;
+static const uint32 IdSeek           = 0x4DBB;
+static const uint32 IdSeekID         = 0x53AB;
+static const uint32 IdSeekPosition   = 0x53AC;
+static const uint32 IdCrc32          = 0xBF;
+static const uint32 IdVoid           = 0xEC;
+
+    // Longest possible element header: a 4-byte ID & an 8-byte size.
+static const size_t MaxElementHeadSize = 12;
+
+
+/// The ID & size of an element, as decoded from its header.
+struct ElementHead {
+    uint32 id;
+    uint64 size;
+    unsigned int headSize;  ///< Length of the ID & size fields.
+    bool unknownSize;
+};
+
+
+/// Returns the length of a variable-length integer from its first byte, or 0 if invalid.
+inline unsigned int VintLength( uint8 first )
+{
+    for (unsigned int len = 1; len <= 8; len++)
+    {
+        if (first & (0x80 >> (len - 1))) return len;
+    }
+    return 0;
+}
+
+
+/// Decodes a variable-length integer, such as an element size.
+/// \return the number of bytes used, or 0 if it's invalid or incomplete.
+inline unsigned int ReadVint( const uint8 *p, size_t avail, uint64 &value, bool *all_ones = NULL )
+{
+    if (avail == 0) return 0;
+    unsigned int len = VintLength( p[0] );
+    if (len == 0 || len > avail) return 0;
+
+    value = p[0] & (0xFF >> len);
+    bool ones = (value == uint64( 0xFF >> len ));
+    for (unsigned int i = 1; i < len; i++)
+    {
+        value = (value << 8) | p[i];
+        ones = ones && (p[i] == 0xFF);
+    }
+    if (all_ones) *all_ones = ones;
+    return len;
+}
+
+
+/// Decodes an element header.
+/// \return false if it's invalid or incomplete.
+inline bool ReadElementHead( const uint8 *p, size_t avail, ElementHead &head )
+{
+    if (avail == 0) return false;
+    unsigned int id_len = VintLength( p[0] );
+    if (id_len == 0 || id_len > 4 || id_len > avail) return false;
+
+    head.id = 0;
+    for (unsigned int i = 0; i < id_len; i++) head.id = (head.id << 8) | p[i];
+
+    unsigned int size_len = ReadVint( p + id_len, avail - id_len, head.size, &head.unknownSize );
+    if (size_len == 0) return false;
+
+    head.headSize = id_len + size_len;
+    return true;
+}
+
+
+/// Decodes a big-endian unsigned integer element's value.
+inline uint64 ReadUInt( const uint8 *p, size_t len )
+{
+    uint64 value = 0;
+    for (size_t i = 0; i < len; i++) value = (value << 8) | p[i];
+    return value;
+}
+
+
+/// Decodes a float element's value (4 or 8 bytes).
+inline double ReadFloat( const uint8 *p, size_t len )
+{
+    uint64 bits = ReadUInt( p, len );
+    if (len == 4)
+    {
+        uint32 bits32 = uint32( bits );
+        float value;
+        memcpy( &value, &bits32, sizeof( value ) );
+        return value;
+    }
+
+    double value = 0.0;
+    if (len == 8) memcpy( &value, &bits, sizeof( value ) );
+    return value;
+}
+
+
+/// Encodes an element ID.
+/// \return the number of bytes written (at most 4).
+inline size_t WriteId( uint8 *p, uint32 id )
+{
+    size_t len = (id > 0xFFFFFF) ? 4 : (id > 0xFFFF) ? 3 : (id > 0xFF) ? 2 : 1;
+    for (size_t i = 0; i < len; i++) p[i] = uint8( id >> (8 * (len - 1 - i)) );
+    return len;
+}
+
+
+/// Encodes an element size in a fixed 8 bytes, so it can be patched later.
+/// \return the number of bytes written.
+inline size_t WriteSize8( uint8 *p, uint64 size )
+{
+    p[0] = 0x01;
+    for (size_t i = 1; i < 8; i++) p[i] = uint8( size >> (8 * (7 - i)) );
+    return 8;
+}
+
+
+/// Encodes a complete element header, using an 8-byte size.
+/// \return the number of bytes written (at most MaxElementHeadSize).
+inline size_t WriteElementHead( uint8 *p, uint32 id, uint64 size )
+{
+    size_t len = WriteId( p, id );
+    return len + WriteSize8( p + len, size );
+}
+
+
+}   // namespace mkvreader
+
+
+#endif // _EBML_UTIL_H_
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file file_watcher.cpp
+    \brief Waits for a file that's still being written to grow.
+*/
+
+#include "file_watcher.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#   include <sys/inotify.h>
+#endif
+
+
+namespace mkvreader {
+
+
+    // Interval at which the file size is polled, when inotify isn't available.
+static const unsigned int PollIntervalMs = 5;
+
+
+static uint64 NowMs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return uint64( ts.tv_sec ) * 1000 + uint64( ts.tv_nsec ) / 1000000;
+}
+
+
+FileWatcher::FileWatcher( const std::string &filename )
+:
+    m_filename( filename ),
+    m_InotifyFd( -1 )
+{
+#ifdef __linux__
+    m_InotifyFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    if (m_InotifyFd >= 0 && inotify_add_watch( m_InotifyFd, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE ) < 0)
+    {
+        close( m_InotifyFd );
+        m_InotifyFd = -1;
+    }
+#endif
+}
+
+
+FileWatcher::~FileWatcher()
+{
+    if (m_InotifyFd >= 0) close( m_InotifyFd );
+}
+
+
+uint64 FileWatcher::GetSize() const
+{
+    struct stat st;
+    if (stat( m_filename.c_str(), &st ) != 0) return 0;
+    return uint64( st.st_size );
+}
+
+
+uint64 FileWatcher::WaitForGrowth( uint64 known_size, unsigned int timeout_ms )
+{
+    const uint64 deadline = NowMs() + timeout_ms;
+    for (;;)
+    {
+        uint64 size = GetSize();
+        if (size > known_size) return size;
+
+        uint64 now = NowMs();
+        if (now >= deadline) return size;
+        int wait_ms = int( deadline - now );
+
+        if (m_InotifyFd >= 0)
+        {
+            struct pollfd pfd = { m_InotifyFd, POLLIN, 0 };
+            if (poll( &pfd, 1, wait_ms ) < 0 && errno != EINTR) return GetSize();
+
+                // Drain the events.  We only care that something happened.
+            char events[4096];
+            while (read( m_InotifyFd, events, sizeof( events ) ) > 0) {}
+        }
+        else usleep( 1000 * std::min( wait_ms, int( PollIntervalMs ) ) );
+    }
+}
+
+
+}   // namespace mkvreader
+
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file file_watcher.h
+    \brief Waits for a file that's still being written to grow.
+*/
+
+#ifndef _FILE_WATCHER_H_
+#define _FILE_WATCHER_H_
+
+
+#include <string>
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+/// Used by follow mode, to wait for a recorder to append more data to a file.
+/// Uses inotify, where available, and falls back to polling the file size.
+class FileWatcher {
+public:
+    explicit FileWatcher( const std::string &filename );
+    ~FileWatcher();
+
+    /// Returns the current size of the file, or 0 if it can't be determined.
+    uint64 GetSize() const;
+
+    /// Blocks until the file is larger than known_size, or timeout_ms elapses.
+    /// \return The current size of the file, which is <= known_size on timeout.
+    uint64 WaitForGrowth( uint64 known_size, unsigned int timeout_ms );
+
+private:
+    FileWatcher( const FileWatcher & );
+    FileWatcher &operator=( const FileWatcher & );
+
+    std::string m_filename;
+    int m_InotifyFd;
+};
+
+
+}   // namespace mkvreader
+
+
+#endif // _FILE_WATCHER_H_
@@ -0,0 +1,418 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file io_callbacks.cpp
+    \brief IOCallback implementations used by MatroskaParser.
+*/
+
+#include "mkvreader/io_callbacks.h"
+#include "mkvreader/async_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <new>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include "ebml/StdIOCallback.h"
+
+
+using namespace LIBEBML_NAMESPACE;
+
+
+namespace mkvreader {
+
+
+IoOptions::IoOptions()
+:
+    asyncReadAhead( false ),
+    readAheadSize( 1024 * 1024 ),
+    readAheadDepth( 4 ),
+    bufferSize( 0 ),
+    directScan( false )
+{
+}
+
+
+IoStats::IoStats()
+:
+    reads( 0 ),
+    seeks( 0 ),
+    bytesRead( 0 )
+{
+}
+
+
+IOCallback *OpenFileCallback( const char *filename, const IoOptions &options )
+{
+    if (options.directScan)
+    {
+        return new DirectReadCallback( filename, options.bufferSize ? options.bufferSize : 1024 * 1024 );
+    }
+
+    IOCallback *callback = NULL;
+    if (options.asyncReadAhead)
+    {
+        callback = new AsyncReadCallback( filename, options.readAheadSize, options.readAheadDepth );
+    }
+    else callback = new StdIOCallback( filename, MODE_READ );
+
+    if (options.bufferSize) callback = new BufferedReadCallback( callback, options.bufferSize );
+
+    return callback;
+}
+
+
+MemoryReadCallback::MemoryReadCallback( const uint8 *data, size_t size )
+:
+    m_Data( data ),
+    m_Size( size ),
+    m_Pos( 0 )
+{
+}
+
+
+uint32 MemoryReadCallback::read( void *buffer, size_t size )
+{
+    if (m_Pos >= m_Size) return 0;
+
+    size_t num_read = std::min( size, m_Size - m_Pos );
+    memcpy( buffer, m_Data + m_Pos, num_read );
+    m_Pos += num_read;
+    return uint32( num_read );
+}
+
+
+void MemoryReadCallback::setFilePointer( int64 offset, seek_mode mode )
+{
+    int64 base = 0;
+    if (mode == seek_current) base = int64( m_Pos );
+    else if (mode == seek_end) base = int64( m_Size );
+
+        // Seeking past the end is allowed, as with files; reads just return nothing.
+    int64 pos = base + offset;
+    m_Pos = (pos < 0) ? 0 : size_t( pos );
+}
+
+
+size_t MemoryReadCallback::write( const void *, size_t )
+{
+    throw std::runtime_error( "MemoryReadCallback::write(): read-only" );
+}
+
+
+uint64 MemoryReadCallback::getFilePointer()
+{
+    return m_Pos;
+}
+
+
+void MemoryReadCallback::close()
+{
+}
+
+
+static const uint64 UnknownPos = std::numeric_limits< uint64 >::max();
+
+
+BufferedReadCallback::BufferedReadCallback( IOCallback *inner, size_t block_size )
+:
+    m_Inner( inner ),
+    m_Buffer( std::max( block_size, size_t( 1 ) ) ),
+    m_BufferPos( 0 ),
+    m_BufferLen( 0 ),
+    m_Pos( 0 ),
+    m_InnerPos( UnknownPos )
+{
+}
+
+
+void BufferedReadCallback::Reset( IOCallback *inner )
+{
+    m_Inner.reset( inner );
+    m_BufferPos = 0;
+    m_BufferLen = 0;
+    m_Pos = 0;
+    m_InnerPos = UnknownPos;
+    m_Stats = IoStats();
+    m_InnerStats = IoStats();
+}
+
+
+size_t BufferedReadCallback::ReadInner( uint64 pos, uint8 *buffer, size_t size )
+{
+    if (pos != m_InnerPos)
+    {
+        m_Inner->setFilePointer( int64( pos ) );
+        m_InnerStats.seeks++;
+    }
+
+    size_t num_read = m_Inner->read( buffer, size );
+    m_InnerStats.reads++;
+    m_InnerStats.bytesRead += num_read;
+
+        // Re-seek after a short read, which also clears any EOF condition on the file.
+    m_InnerPos = (num_read == size) ? pos + num_read : UnknownPos;
+
+    return num_read;
+}
+
+
+uint32 BufferedReadCallback::read( void *buffer, size_t size )
+{
+    m_Stats.reads++;
+
+    uint8 *dest = static_cast< uint8 * >( buffer );
+    size_t total = 0;
+    while (total < size)
+    {
+        if (m_Pos >= m_BufferPos && m_Pos < m_BufferPos + m_BufferLen)
+        {
+            size_t offset = size_t( m_Pos - m_BufferPos );
+            size_t num = std::min( size - total, m_BufferLen - offset );
+            memcpy( dest + total, &m_Buffer[offset], num );
+            total += num;
+            m_Pos += num;
+            continue;
+        }
+
+        size_t remaining = size - total;
+        if (remaining >= m_Buffer.size())
+        {
+                // Too big to be worth buffering.
+            size_t num_read = ReadInner( m_Pos, dest + total, remaining );
+            total += num_read;
+            m_Pos += num_read;
+            break;
+        }
+
+        m_BufferPos = m_Pos;
+        m_BufferLen = ReadInner( m_Pos, &m_Buffer.front(), m_Buffer.size() );
+        if (m_BufferLen == 0) break;
+    }
+
+    m_Stats.bytesRead += total;
+    return uint32( total );
+}
+
+
+void BufferedReadCallback::setFilePointer( int64 offset, seek_mode mode )
+{
+    m_Stats.seeks++;
+
+    int64 base = 0;
+    if (mode == seek_current) base = int64( m_Pos );
+    else if (mode == seek_end)
+    {
+            // We don't know the size, so this one has to go through.
+        m_Inner->setFilePointer( offset, seek_end );
+        m_InnerStats.seeks++;
+        m_Pos = m_InnerPos = m_Inner->getFilePointer();
+        return;
+    }
+
+    int64 pos = base + offset;
+    m_Pos = (pos < 0) ? 0 : uint64( pos );
+}
+
+
+size_t BufferedReadCallback::write( const void *, size_t )
+{
+    throw std::runtime_error( "BufferedReadCallback::write(): read-only" );
+}
+
+
+uint64 BufferedReadCallback::getFilePointer()
+{
+    return m_Pos;
+}
+
+
+void BufferedReadCallback::close()
+{
+    m_Inner->close();
+    m_BufferLen = 0;
+}
+
+
+    // O_DIRECT requires the buffer, file offset & size to be aligned to the
+    // logical block size of the device.  This covers anything we'd encounter.
+static const size_t DirectAlignment = 4096;
+
+
+DirectReadCallback::DirectReadCallback( const char *filename, size_t block_size )
+:
+    m_Fd( -1 ),
+    m_Direct( false ),
+    m_Buffer( NULL ),
+    m_BlockSize( (std::max( block_size, DirectAlignment ) + DirectAlignment - 1) / DirectAlignment * DirectAlignment ),
+    m_BufferPos( 0 ),
+    m_BufferLen( 0 ),
+    m_Pos( 0 ),
+    m_FileSize( 0 )
+{
+#ifdef O_DIRECT
+    m_Fd = open( filename, O_RDONLY | O_CLOEXEC | O_DIRECT );
+    m_Direct = (m_Fd >= 0);
+#endif
+        // Some filesystems (e.g. tmpfs) refuse O_DIRECT.
+    if (m_Fd < 0) m_Fd = open( filename, O_RDONLY | O_CLOEXEC );
+    if (m_Fd < 0) throw std::runtime_error( boost::str(
+        boost::format( "DirectReadCallback: failed to open %s: %s" ) % filename % strerror( errno ) ) );
+
+    UpdateFileSize();
+
+    posix_fadvise( m_Fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+    void *buffer = NULL;
+    if (posix_memalign( &buffer, DirectAlignment, m_BlockSize ) != 0)
+    {
+        ::close( m_Fd );
+        throw std::bad_alloc();
+    }
+    m_Buffer = static_cast< uint8 * >( buffer );
+}
+
+
+DirectReadCallback::~DirectReadCallback()
+{
+    close();
+    free( m_Buffer );
+}
+
+
+bool DirectReadCallback::Fill( uint64 pos )
+{
+    uint64 prev_pos = m_BufferPos;
+    size_t prev_len = m_BufferLen;
+
+    m_BufferPos = pos - (pos % DirectAlignment);
+    m_BufferLen = 0;
+    while (m_BufferLen < m_BlockSize)
+    {
+        ssize_t num_read = pread( m_Fd, m_Buffer + m_BufferLen, m_BlockSize - m_BufferLen, off_t( m_BufferPos + m_BufferLen ) );
+        if (num_read < 0)
+        {
+            if (errno == EINTR) continue;
+#ifdef O_DIRECT
+            if (errno == EINVAL && m_Direct)
+            {
+                    // The device has stricter alignment requirements.  Give up on O_DIRECT.
+                fcntl( m_Fd, F_SETFL, fcntl( m_Fd, F_GETFL ) & ~O_DIRECT );
+                m_Direct = false;
+                continue;
+            }
+#endif
+            throw std::runtime_error( boost::str(
+                boost::format( "DirectReadCallback::read(): %s" ) % strerror( errno ) ) );
+        }
+        if (num_read == 0) break;
+        m_BufferLen += size_t( num_read );
+
+            // With O_DIRECT, anything but a full read means we're at the end of the file.
+        if (m_Direct) break;
+    }
+
+        // Without O_DIRECT, drop what we've finished with from the page cache.
+    if (!m_Direct && prev_len) posix_fadvise( m_Fd, off_t( prev_pos ), off_t( prev_len ), POSIX_FADV_DONTNEED );
+
+    return m_BufferLen > 0;
+}
+
+
+bool DirectReadCallback::UpdateFileSize()
+{
+    struct stat st;
+    if (fstat( m_Fd, &st ) != 0 || uint64( st.st_size ) <= m_FileSize) return false;
+
+    m_FileSize = uint64( st.st_size );
+    return true;
+}
+
+
+uint32 DirectReadCallback::read( void *buffer, size_t size )
+{
+    uint8 *dest = static_cast< uint8 * >( buffer );
+    size_t total = 0;
+        // At the end, check whether the file has grown (e.g. in follow mode).
+    while (total < size && (m_Pos < m_FileSize || UpdateFileSize()))
+    {
+        if (m_Pos < m_BufferPos || m_Pos >= m_BufferPos + m_BufferLen)
+        {
+            if (!Fill( m_Pos ) || m_Pos >= m_BufferPos + m_BufferLen) break;
+        }
+
+        size_t offset = size_t( m_Pos - m_BufferPos );
+        size_t num = std::min( size - total, m_BufferLen - offset );
+        memcpy( dest + total, m_Buffer + offset, num );
+        total += num;
+        m_Pos += num;
+    }
+    return uint32( total );
+}
+
+
+void DirectReadCallback::setFilePointer( int64 offset, seek_mode mode )
+{
+    int64 base = 0;
+    if (mode == seek_current) base = int64( m_Pos );
+    else if (mode == seek_end) base = int64( m_FileSize );
+
+    int64 pos = base + offset;
+    m_Pos = (pos < 0) ? 0 : uint64( pos );
+}
+
+
+size_t DirectReadCallback::write( const void *, size_t )
+{
+    throw std::runtime_error( "DirectReadCallback::write(): read-only" );
+}
+
+
+uint64 DirectReadCallback::getFilePointer()
+{
+    return m_Pos;
+}
+
+
+void DirectReadCallback::close()
+{
+    if (m_Fd < 0) return;
+
+    if (!m_Direct && m_BufferLen) posix_fadvise( m_Fd, off_t( m_BufferPos ), off_t( m_BufferLen ), POSIX_FADV_DONTNEED );
+    ::close( m_Fd );
+    m_Fd = -1;
+}
+
+
+}   // namespace mkvreader
+
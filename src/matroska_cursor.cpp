@@ -0,0 +1,306 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file matroska_cursor.cpp
+    \brief Independent readers of one parsed file.
+*/
+
+#include "mkvreader/matroska_cursor.h"
+#include "cluster_reader.h"
+#include "content_decoder.h"
+#include "ebml_util.h"
+#include "posix_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+
+namespace mkvreader {
+
+
+boost::shared_ptr< const MatroskaFile > MatroskaFile::Open( const char *filename )
+{
+    return boost::shared_ptr< const MatroskaFile >( new MatroskaFile( filename ) );
+}
+
+
+MatroskaFile::MatroskaFile( const char *filename )
+:
+    m_TimecodeScale( DefaultTimecodeScale ),
+    m_Duration( 0.0 ),
+    m_Fd( -1 )
+{
+        // The parser is needed only for the metadata.  Its own file handle closes with it.
+    uint64 first_cluster = 0;
+    uint64 file_size = 0;
+    {
+        MatroskaParser parser( filename );
+        if (parser.Parse() != 0) throw std::runtime_error(
+            boost::str( boost::format( "MatroskaFile: failed to parse %s" ) % filename ) );
+
+        m_Tracks = parser.GetTracks();
+        m_TimecodeScale = parser.GetTimecodeScale();
+        m_Duration = parser.GetDuration();
+        first_cluster = parser.GetFirstClusterPos();
+        file_size = parser.GetFileSize();
+    }
+
+    m_Fd = open( filename, O_RDONLY | O_CLOEXEC );
+    if (m_Fd < 0) throw std::runtime_error(
+        boost::str( boost::format( "MatroskaFile: failed to open %s: %s" ) % filename % strerror( errno ) ) );
+
+    if (first_cluster != 0)
+    {
+        FindClusters( boost::bind( &MatroskaFile::ReadAt, this, _1, _2, _3 ), first_cluster, file_size, m_Clusters );
+    }
+}
+
+
+MatroskaFile::~MatroskaFile()
+{
+    if (m_Fd >= 0) close( m_Fd );
+}
+
+
+uint16 MatroskaFile::FindTrack( uint16 trackNum ) const
+{
+    for (size_t i = 0; i != m_Tracks.size(); i++)
+    {
+        if (m_Tracks[i].trackNumber == trackNum) return (uint16) i;
+    }
+    return 0xffff;
+}
+
+
+    // Orders clusters by timecode, for binary search.
+static bool ClusterStartsAfter( uint64 timecode, const ClusterLocation &cluster )
+{
+    return timecode < cluster.timecode;
+}
+
+
+size_t MatroskaFile::FindCluster( uint64 timecode ) const
+{
+    const uint64 cluster_timecode = timecode / m_TimecodeScale;
+    std::vector< ClusterLocation >::const_iterator after =
+        std::upper_bound( m_Clusters.begin(), m_Clusters.end(), cluster_timecode, ClusterStartsAfter );
+
+    return (after == m_Clusters.begin()) ? 0 : size_t( after - m_Clusters.begin() ) - 1;
+}
+
+
+size_t MatroskaFile::ReadAt( uint64 pos, void *buffer, size_t size ) const
+{
+    return mkvreader::ReadAt( m_Fd, buffer, size, pos );
+}
+
+
+uint64 MatroskaFile::BlockTimecode( uint16 trackIdx, uint64 timecode ) const
+{
+    const Rational &scale = m_Tracks.at( trackIdx ).timecodeScale;
+    timecode *= m_TimecodeScale;
+    return scale.IsOne() ? timecode : MulDiv( timecode, scale.num, scale.den );
+}
+
+
+MatroskaCursor::MatroskaCursor( matroska_file_ptr file )
+:
+    m_File( file ),
+    m_NextCluster( 0 ),
+    m_SkipUntil( 0 ),
+    m_BufferPool( new BufferPool() )
+{
+}
+
+
+MatroskaCursor::~MatroskaCursor()
+{
+}
+
+
+void MatroskaCursor::EnableTrack( uint16 trackIdx )
+{
+    if (trackIdx >= m_File->GetTracks().size()) throw std::runtime_error(
+        boost::str( boost::format( "MatroskaCursor::EnableTrack(): no track %d" ) % trackIdx ) );
+
+    m_EnabledTracks.insert( trackIdx );
+    m_FrameQueues[trackIdx];
+}
+
+
+bool MatroskaCursor::Seek( uint64 timecode )
+{
+    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        track->second.clear();
+    }
+
+    m_NextCluster = m_File->FindCluster( timecode );
+    m_SkipUntil = timecode;
+    return m_NextCluster < m_File->GetClusters().size()
+        && (m_File->GetDuration() <= 0.0 || timecode <= uint64( m_File->GetDuration() * 1e9 ));
+}
+
+
+MatroskaFrame *MatroskaCursor::ReadSingleFrame( uint16 trackIdx )
+{
+    FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
+    if (track == m_FrameQueues.end()) return NULL;
+
+    FrameQueue &track_queue = track->second;
+    while (track_queue.empty())
+    {
+        if (!ReadNextCluster()) return NULL;
+    }
+
+    return track_queue.pop_front().release();
+}
+
+
+bool MatroskaCursor::IsEof() const
+{
+    if (m_NextCluster < m_File->GetClusters().size()) return false;
+
+    for (FrameQueueMap::const_iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        if (!track->second.empty()) return false;
+    }
+    return true;
+}
+
+
+bool MatroskaCursor::ReadNextCluster()
+{
+    const std::vector< ClusterLocation > &clusters = m_File->GetClusters();
+    if (m_NextCluster >= clusters.size()) return false;
+
+    const ClusterLocation &cluster = clusters[m_NextCluster++];
+
+        // Frames still queued from the previous cluster keep its buffer alive.
+    if (!m_ClusterData || !m_ClusterData.unique()) m_ClusterData.reset( new ByteArray() );
+    ByteArray &data = *m_ClusterData;
+    data.resize( size_t( cluster.size ) );
+    if (data.empty()) return true;
+    data.resize( m_File->ReadAt( cluster.dataPos, &data.front(), data.size() ) );
+
+    ElementHead child;
+    for (size_t p = 0; p < data.size(); p += child.headSize + size_t( child.size ))
+    {
+        if (!ReadElementHead( &data[p], data.size() - p, child )
+            || child.unknownSize || p + child.headSize + child.size > data.size()) break;
+
+        const uint8 *payload = &data[p + child.headSize];
+        if (child.id == IdSimpleBlock)
+        {
+            BlockHeader header;
+            const bool keyframe = ReadBlockHeader( payload, size_t( child.size ), header ) && header.IsKeyframe();
+            QueueBlock( payload, size_t( child.size ), cluster.timecode, keyframe, NULL );
+        }
+        else if (child.id == IdBlockGroup)
+        {
+            const uint8 *block = NULL;
+            size_t block_size = 0;
+            bool keyframe = true;
+            uint64 duration = 0;
+            bool has_duration = false;
+
+            ElementHead group_child;
+            for (size_t q = 0; q < child.size; q += group_child.headSize + size_t( group_child.size ))
+            {
+                if (!ReadElementHead( payload + q, size_t( child.size ) - q, group_child )
+                    || q + group_child.headSize + group_child.size > child.size) break;
+
+                const uint8 *group_payload = payload + q + group_child.headSize;
+                if (group_child.id == IdBlock)
+                {
+                    block = group_payload;
+                    block_size = size_t( group_child.size );
+                }
+                else if (group_child.id == IdReferenceBlock)
+                {
+                    keyframe = false;
+                }
+                else if (group_child.id == IdBlockDuration)
+                {
+                    duration = ReadUInt( group_payload, size_t( group_child.size ) );
+                    has_duration = true;
+                }
+            }
+
+            if (block) QueueBlock( block, block_size, cluster.timecode, keyframe, has_duration ? &duration : NULL );
+        }
+    }
+
+    return true;
+}
+
+
+void MatroskaCursor::QueueBlock( const uint8 *block, size_t size, uint64 clusterTimecode,
+    bool keyframe, const uint64 *duration )
+{
+    BlockHeader header;
+    if (!ReadBlockHeader( block, size, header )) return;
+
+    const uint16 trackIdx = m_File->FindTrack( uint16( header.trackNum ) );
+    if (m_EnabledTracks.find( trackIdx ) == m_EnabledTracks.end()) return;
+
+    const int64 timecode = std::max( int64( clusterTimecode ) + header.relTimecode, int64( 0 ) );
+    const uint64 frame_timecode = m_File->BlockTimecode( trackIdx, uint64( timecode ) );
+    if (frame_timecode < m_SkipUntil) return;
+
+    const MatroskaTrackInfo &track = m_File->GetTracks()[trackIdx];
+    if (!ReadLaces( block, size, header, m_Laces )) throw std::runtime_error(
+        boost::str( boost::format( "MatroskaCursor: bad lacing in block of track %d at %d" )
+            % track.trackNumber % frame_timecode ) );
+
+    FrameQueue &queue = m_FrameQueues[trackIdx];
+    queue.push_back( new MatroskaFrame() );
+    MatroskaFrame &frame = queue.back();
+    frame.timecode = frame_timecode;
+    frame.duration = duration ? m_File->BlockTimecode( trackIdx, *duration ) : track.defaultDuration * header.numLaces;
+    frame.keyframe = keyframe;
+    frame.dataViews = m_Laces;
+    frame.dataOwner = m_ClusterData;
+
+    if (EncodesFrames( track ) && !DecodeFrame( track.contentEncodings, frame, *m_BufferPool ))
+    {
+        queue.pop_back();
+        throw std::runtime_error(
+            boost::str( boost::format( "MatroskaCursor: failed to decode frame of track %d at %d" )
+                % track.trackNumber % frame_timecode ) );
+    }
+}
+
+
+}   // namespace mkvreader
@@ -32,14 +32,27 @@
 */
 
 #include "mkvreader/matroska_parser.h"
+#include "mkvreader/async_io.h"
+#include "cluster_reader.h"
+#include "content_decoder.h"
+#include "ebml_util.h"
+#include "file_watcher.h"
+#include "posix_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <cmath>
+#include <fstream>
 #include <limits>
 #include <string>
 #include <typeinfo>
 #include <iostream>
 #include <algorithm>
 
+#include <boost/bind.hpp>
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -51,6 +64,13 @@ using namespace LIBMATROSKA_NAMESPACE;
 
 
 #define MAX_UINT64      std::numeric_limits<uint64>::max()
+
+// How much of the head of the file to read at once, with lazy metadata.
+static const size_t LazyHeadSize = 64 * 1024;
+// Size of each read made beyond the head, with lazy metadata.
+static const size_t HeadSpillSize = 4 * 1024;
+// How far back from the end of the file to look for the last cluster.
+static const uint64 MaxTailScanSize = 16 * 1024 * 1024;
 #define _DELETE(x)      if (x) { delete (x); (x) = NULL; }
 
 
@@ -109,7 +129,7 @@ static bool IsSeekable(const IOCallback &)
 
 uint64 MatroskaParser::SecondsToTimecode(double seconds)
 {
-	return (uint64)floor(seconds * 1000000000);
+	return (uint64)floor(seconds * 1000000000 + 0.5);
 };
 
 double MatroskaParser::TimecodeToSeconds(uint64 code, unsigned /*samplerate_hint*/ )
@@ -121,8 +141,41 @@ double MatroskaParser::TimecodeToSeconds(uint64 code, unsigned /*samplerate_hint
 MatroskaFrame::MatroskaFrame() 
 : timecode( 0 ),
   duration( 0 ),
-  add_id( 0 )
+  keyframe( true ),
+  preroll( false ),
+  add_id( 0 ),
+  queuedBytes( 0 )
+{
+}
+
+size_t MatroskaFrame::get_lace_count() const
+{
+    return dataViews.empty() ? dataBuffer.size() : dataViews.size();
+}
+
+PayloadView MatroskaFrame::get_lace( size_t i ) const
+{
+    if (!dataViews.empty()) return dataViews.at( i );
+
+    const ByteArray &lace = dataBuffer.at( i );
+    return PayloadView( lace.empty() ? NULL : &lace.front(), lace.size() );
+}
+
+size_t MatroskaFrame::get_iovecs( std::vector< iovec > &dest ) const
 {
+    size_t total_size = 0;
+    const size_t num_laces = get_lace_count();
+    dest.reserve( dest.size() + num_laces );
+    for (size_t i = 0; i < num_laces; i++)
+    {
+        PayloadView lace = get_lace( i );
+        iovec vec;
+        vec.iov_base = const_cast< uint8 * >( lace.data );
+        vec.iov_len = lace.size;
+        dest.push_back( vec );
+        total_size += lace.size;
+    }
+    return total_size;
 }
 
 MatroskaAttachment::MatroskaAttachment()
@@ -139,7 +192,10 @@ void MatroskaFrame::Reset()
 {
 	timecode = 0;
 	duration = 0;
+	keyframe = true;
+	preroll = false;
     add_id = 0;
+    queuedBytes = 0;
 };
 
 MatroskaSimpleTag::MatroskaSimpleTag()
@@ -221,6 +277,13 @@ MatroskaEditionInfo::MatroskaEditionInfo() {
 	editionUID = 0;
 }
 
+MatroskaContentEncoding::MatroskaContentEncoding() {
+	order = 0;
+	scope = 1;
+	type = 0;
+	compAlgo = 0;
+}
+
 MatroskaTrackInfo::MatroskaTrackInfo() {
 	trackType = (track_type) 0;
 	trackNumber = 0;
@@ -243,31 +306,418 @@ MatroskaParser::MatroskaParser(const char *filename )
 	:
 		m_filename(filename),
 		m_IOCallback(new StdIOCallback(filename, MODE_READ)), // TO_DO: revisit mode
-		m_InputStream(*m_IOCallback),
-		m_MaxQueueDepth( 0 ),
-		m_Eof( false )
+		m_InputStream(new EbmlStream(*m_IOCallback)),
+		m_MemoryBase( NULL )
+{
+	InitMembers();
+	m_FileSize = boost::filesystem::file_size(filename); // TO_DO: throws
+};
+
+MatroskaParser::MatroskaParser(const char *filename, const IoOptions &options)
+	:
+		m_filename(filename),
+		m_IOCallback(OpenFileCallback(filename, options)),
+		m_InputStream(new EbmlStream(*m_IOCallback)),
+		m_MemoryBase( NULL )
+{
+	InitMembers();
+	m_FileSize = boost::filesystem::file_size(filename); // TO_DO: throws
+};
+
+MatroskaParser::MatroskaParser(const uint8 *data, size_t size)
+	:
+		m_IOCallback(new MemoryReadCallback(data, size)),
+		m_InputStream(new EbmlStream(*m_IOCallback)),
+		m_MemoryBase( data )
+{
+	InitMembers();
+	m_FileSize = size;
+};
+
+MatroskaParser::MatroskaParser(boost::shared_ptr<const ByteArray> buffer)
+	:
+		m_IOCallback(new MemoryReadCallback(buffer->empty() ? NULL : &buffer->front(), buffer->size())),
+		m_InputStream(new EbmlStream(*m_IOCallback)),
+		m_MemoryBase( buffer->empty() ? NULL : &buffer->front() ),
+		m_MemoryOwner( buffer )
+{
+	InitMembers();
+	m_FileSize = buffer->size();
+};
+
+void MatroskaParser::InitMembers()
 {
 	m_TimecodeScale = mkvreader::DefaultTimecodeScale;
 	m_FileDate = 0;
 	m_Duration = 0;
+	m_DurationSource = duration_unknown;
 	m_CurrentTimecode = 0;
+	m_ReadTimecode = 0;
 	//m_ElementLevel0 = NULL;
 	//UpperElementLevel = 0;
 	m_CurrentChapter = 0;
-	m_FileSize = boost::filesystem::file_size(filename); // TO_DO: throws
+	m_MaxQueueDepth = 0;
+	m_DeferPayloads = false;
+	m_ByteBudget = 0;
+	m_TotalQueuedBytes = 0;
+	m_BlockedTrack = 0;
+	m_BlockedBytes = 0;
+	m_RechargeDecoded = false;
+	m_FileSize = 0;
+	m_Eof = false;
+	m_Follow = false;
+	m_FollowTimeoutMs = 0;
+	m_ResumePos = 0;
+	m_SplitLaces = false;
+	m_BufferPool.reset(new BufferPool());
+	m_PreadFd = -1;
+	m_FirstClusterPos = 0;
+	m_SeekHeadPos = 0;
+	m_CuesPos = 0;
+	m_CuesLoaded = false;
 	m_TagPos = 0;
 	m_TagSize = 0;
 	m_TagScanRange = 1024 * 64;
+	m_LazyMetadata = false;
+	m_MeasureMissingDuration = false;
+	m_DeferredChaptersPos = 0;
+	m_DeferredTagsPos = 0;
+	m_DeferredAttachmentsPos = 0;
 	m_CurrentTrackNo = 0;
-};
+}
 
 MatroskaParser::~MatroskaParser() {
+	if (m_PreadFd >= 0) close(m_PreadFd);
 	//if (m_ElementLevel0 != NULL)
 	//	_DELETE(m_ElementLevel0);
 		//delete m_ElementLevel0;
 };
 
-int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters) 
+void MatroskaParser::Reset()
+{
+    FinishDecoding();
+    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        FrameQueue &queue = track->second;
+        while (!queue.empty()) RecycleFrame( queue.pop_front().release() );
+    }
+    m_FrameQueues.clear();
+    m_TotalQueuedBytes = 0;
+    m_QueuedBytes.clear();
+    m_BlockedBytes = 0;
+
+        // clear() keeps the capacity of the vectors, for the next file's metadata.
+    m_ElementLevel0.reset();
+    m_CurrentChapter = NULL;
+    m_CurrentTrackNo = 0;
+    m_EnabledTrackNumbers.clear();
+    m_Tracks.clear();
+    m_Editions.clear();
+    m_Chapters.clear();
+    m_Tags.clear();
+    m_EditionUIDs.clear();
+    m_ChapterUIDs.clear();
+    m_ChaptersByUID.clear();
+    m_ChapterIndex.Clear();
+    m_TagsByTrackUID.clear();
+    m_TagsByEditionUID.clear();
+    m_TagsByChapterUID.clear();
+    m_ClusterIndex.clear();
+    m_AttachmentList.clear();
+    m_CuePoints.clear();
+    m_CuesLoaded = false;
+    m_FrameIndexes.clear();
+
+    m_CurrentTimecode = 0;
+    m_ReadTimecode = 0;
+    m_Duration = 0;
+    m_DurationSource = duration_unknown;
+    m_TimecodeScale = DefaultTimecodeScale;
+    m_WritingApp = L"";
+    m_MuxingApp = L"";
+    m_FileTitle = L"";
+    m_FileDate = 0;
+    m_SegmentFilename = L"";
+
+    m_FileSize = 0;
+    m_Eof = false;
+    m_Watcher.reset();
+    m_PendingCluster.reset();
+    m_ResumePos = 0;
+    if (m_PreadFd >= 0) close( m_PreadFd );
+    m_PreadFd = -1;
+    m_FirstClusterPos = 0;
+    m_SeekHeadPos = 0;
+    m_CuesPos = 0;
+    m_TagPos = 0;
+    m_TagSize = 0;
+    m_DeferredChaptersPos = 0;
+    m_DeferredTagsPos = 0;
+    m_DeferredAttachmentsPos = 0;
+}
+
+void MatroskaParser::Open( const char *filename )
+{
+    Reset();
+    SetSource( new StdIOCallback( filename, MODE_READ ), filename, NULL, boost::filesystem::file_size( filename ) );
+}
+
+void MatroskaParser::Open( const char *filename, const IoOptions &options )
+{
+    Reset();
+
+        // Keep the read buffer, if it's the right size.
+    BufferedReadCallback *buffered = dynamic_cast< BufferedReadCallback * >( m_IOCallback.get() );
+    if (buffered && !options.directScan && options.bufferSize == buffered->GetBlockSize())
+    {
+        IoOptions inner_options = options;
+        inner_options.bufferSize = 0;
+        buffered->Reset( OpenFileCallback( filename, inner_options ) );
+        SetSource( NULL, filename, NULL, boost::filesystem::file_size( filename ) );
+    }
+    else SetSource( OpenFileCallback( filename, options ), filename, NULL, boost::filesystem::file_size( filename ) );
+}
+
+void MatroskaParser::Open( const uint8 *data, size_t size )
+{
+    Reset();
+    m_MemoryOwner.reset();
+    SetSource( new MemoryReadCallback( data, size ), "", data, size );
+}
+
+void MatroskaParser::Open( boost::shared_ptr<const ByteArray> buffer )
+{
+    Reset();
+    const uint8 *data = buffer->empty() ? NULL : &buffer->front();
+    m_MemoryOwner = buffer;
+    SetSource( new MemoryReadCallback( data, buffer->size() ), "", data, buffer->size() );
+}
+
+    // Switches to a new source.  If callback is NULL, the current one has been reset in place.
+void MatroskaParser::SetSource( IOCallback *callback, const char *filename, const uint8 *memory, uint64 size )
+{
+    if (callback)
+    {
+            // The stream refers to the callback, so it must go first.
+        m_InputStream.reset();
+        m_IOCallback.reset( callback );
+        m_InputStream.reset( new EbmlStream( *m_IOCallback ) );
+    }
+
+    m_filename = filename;
+    m_MemoryBase = memory;
+    if (!memory) m_MemoryOwner.reset();
+    m_FileSize = size;
+    if (m_Follow && memory)
+    {
+        LOG_WARN_S( "MatroskaParser::SetSource(): follow mode disabled, since in-memory sources can't grow" );
+        m_Follow = false;
+        m_Watcher.reset();
+    }
+    else if (m_Follow) m_Watcher.reset( new FileWatcher( m_filename ) );
+}
+
+int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
+{
+	if (m_LazyMetadata && bBreakAtClusters && !m_MemoryBase) {
+		const int result = ParseHead(LazyHeadSize, bInfoOnly);
+		if (result == 0 && ShouldMeasureDuration()) MeasureDuration();
+		if (result >= 0) return result;
+	}
+
+	int result = ParseElements(bInfoOnly, bBreakAtClusters);
+	if (result == 0 && m_LazyMetadata) LocateDeferredMetadata();
+	if (result == 0 && ShouldMeasureDuration()) MeasureDuration();
+	return result;
+}
+
+// Whether Parse() is to measure a duration the file didn't report.
+bool MatroskaParser::ShouldMeasureDuration() const
+{
+	return m_MeasureMissingDuration && !m_Follow && m_Duration <= 0;
+}
+
+namespace {
+
+	// Serves reads from a copy of the head of the file and, beyond it, from small reads
+	// of the file.  Elements past the head, such as large Attachments, are skipped by
+	// seeking, so only the heads of those after them are read.
+class HeadReadCallback : public IOCallback {
+public:
+	HeadReadCallback(const ByteArray &head, const ReadAtFunction &readAt, uint64 fileSize)
+	:
+		m_Head(head),
+		m_ReadAt(readAt),
+		m_FileSize(fileSize),
+		m_Spill(HeadSpillSize),
+		m_SpillPos(0),
+		m_SpillLen(0),
+		m_Pos(0)
+	{
+	}
+
+	virtual uint32 read(void *buffer, size_t size)
+	{
+		uint8 *dest = static_cast<uint8 *>(buffer);
+		size_t total = 0;
+		while (total < size && m_Pos < m_FileSize) {
+			const size_t wanted = size - total;
+			const uint8 *src = NULL;
+			size_t avail = 0;
+			if (m_Pos < m_Head.size()) {
+				src = &m_Head[size_t(m_Pos)];
+				avail = m_Head.size() - size_t(m_Pos);
+			} else if (m_Pos >= m_SpillPos && m_Pos < m_SpillPos + m_SpillLen) {
+				src = &m_Spill[size_t(m_Pos - m_SpillPos)];
+				avail = size_t(m_SpillPos + m_SpillLen - m_Pos);
+			} else if (wanted >= m_Spill.size()) {
+				// Large reads, e.g. of CodecPrivate, go straight to the caller.
+				const size_t num = m_ReadAt(m_Pos, dest + total, wanted);
+				total += num;
+				m_Pos += num;
+				break;
+			} else {
+				m_SpillPos = m_Pos;
+				m_SpillLen = m_ReadAt(m_Pos, &m_Spill.front(), m_Spill.size());
+				if (m_SpillLen == 0) break;
+				continue;
+			}
+
+			const size_t num = std::min(avail, wanted);
+			memcpy(dest + total, src, num);
+			total += num;
+			m_Pos += num;
+		}
+		return uint32(total);
+	}
+
+	virtual void setFilePointer(int64 offset, seek_mode mode = seek_beginning)
+	{
+		int64 base = 0;
+		if (mode == seek_current) base = int64(m_Pos);
+		else if (mode == seek_end) base = int64(m_FileSize);
+
+		const int64 pos = base + offset;
+		m_Pos = (pos < 0) ? 0 : uint64(pos);
+	}
+
+	virtual size_t write(const void *, size_t)
+	{
+		throw std::runtime_error("HeadReadCallback::write(): read-only");
+	}
+
+	virtual uint64 getFilePointer() { return m_Pos; }
+	virtual void close() {}
+
+private:
+	const ByteArray &m_Head;
+	ReadAtFunction m_ReadAt;
+	uint64 m_FileSize;
+	ByteArray m_Spill;		///< The last read made beyond the head.
+	uint64 m_SpillPos;
+	size_t m_SpillLen;
+	uint64 m_Pos;
+};
+
+}	// namespace
+
+	// Parses a copy of the head of the file, read in one go.  Positions within it are
+	// the same as in the file, so it just stands in for the file while parsing.  The
+	// elements before the first cluster needn't all fit: the parser hops over those
+	// beyond it, as FindClusters() does, with a small read for each of their heads.
+int MatroskaParser::ParseHead(size_t headSize, bool bInfoOnly)
+{
+	ByteArray head(size_t(std::min(uint64(headSize), m_FileSize)));
+	if (!head.empty()) head.resize(ReadBytesAt(0, &head.front(), head.size()));
+	if (head.empty()) return -1;
+
+	const ReadAtFunction readAt = boost::bind(&MatroskaParser::ReadBytesAt, this, _1, _2, _3);
+	boost::scoped_ptr<IOCallback> io(new HeadReadCallback(head, readAt, m_FileSize));
+	boost::scoped_ptr<EbmlStream> stream(new EbmlStream(*io));
+	m_IOCallback.swap(io);
+	m_InputStream.swap(stream);
+
+	int result = ParseElements(bInfoOnly, true);
+	const uint64 pos = m_IOCallback->getFilePointer();
+
+	m_IOCallback.swap(io);
+	m_InputStream.swap(stream);
+
+	m_IOCallback->setFilePointer(pos);
+	if (result == 0) LocateDeferredMetadata();
+	return result;
+}
+
+	// Chapters, Tags & Attachments after the clusters can only be found via the SeekHead.
+void MatroskaParser::LocateDeferredMetadata()
+{
+	if (m_SeekHeadPos == 0) return;
+
+	try {
+		if (m_DeferredChaptersPos == 0) m_DeferredChaptersPos = FindSeekEntry(m_SeekHeadPos, IdChapters);
+		if (m_DeferredTagsPos == 0) m_DeferredTagsPos = FindSeekEntry(m_SeekHeadPos, IdTags);
+		if (m_DeferredAttachmentsPos == 0) m_DeferredAttachmentsPos = FindSeekEntry(m_SeekHeadPos, IdAttachments);
+	} catch (std::exception &e) {
+		LOG_WARN_S("MatroskaParser::Parse(): can't read the SeekHead: " << e.what());
+	}
+}
+
+	// Parses a level-1 element that Parse() only located.  The file pointer is restored,
+	// so that this doesn't disturb the reading of frames.
+void MatroskaParser::ParseDeferred(uint64 &pos, const EbmlCallbacks &callbacks)
+{
+	if (pos == 0) return;
+
+	const uint64 elementPos = pos;
+	pos = 0;	// Only try once, whether or not it works.
+
+	const uint64 origPos = m_IOCallback->getFilePointer();
+	try {
+		m_IOCallback->setFilePointer(elementPos);
+		ElementPtr element(m_InputStream->FindNextID(callbacks, 0xFFFFFFFFFFFFFFFFL));
+		if (element && EbmlId(*element) == callbacks.GlobalId) {
+			if (callbacks.GlobalId == KaxChapters::ClassInfos.GlobalId) {
+				Parse_Chapters(static_cast<KaxChapters *>(element.get()));
+			} else if (callbacks.GlobalId == KaxTags::ClassInfos.GlobalId) {
+				Parse_Tags(static_cast<KaxTags *>(element.get()));
+			} else if (callbacks.GlobalId == KaxAttachments::ClassInfos.GlobalId) {
+				int UpperElementLevel = 0;
+				ElementPtr ElementLevel2;
+				Parse_Attachments(element, UpperElementLevel, ElementLevel2);
+			}
+		}
+	} catch (std::exception &e) {
+		LOG_WARN_S("MatroskaParser::ParseDeferred(): failed at " << elementPos << ": " << e.what());
+	}
+	m_IOCallback->setFilePointer(origPos);
+}
+
+void MatroskaParser::LoadChapters()
+{
+	ParseDeferred(m_DeferredChaptersPos, KaxChapters::ClassInfos);
+}
+
+void MatroskaParser::LoadTags()
+{
+	ParseDeferred(m_DeferredTagsPos, KaxTags::ClassInfos);
+}
+
+void MatroskaParser::LoadAttachments()
+{
+	ParseDeferred(m_DeferredAttachmentsPos, KaxAttachments::ClassInfos);
+}
+
+void MatroskaParser::SetLazyMetadata(bool lazy)
+{
+	m_LazyMetadata = lazy;
+}
+
+void MatroskaParser::SetMeasureMissingDuration(bool measure)
+{
+	m_MeasureMissingDuration = measure;
+}
+
+int MatroskaParser::ParseElements(bool bInfoOnly, bool bBreakAtClusters)
 {
 	try {
 		int UpperElementLevel = 0;
@@ -283,18 +733,18 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 		// Be sure we are at the beginning of the file
 		m_IOCallback->setFilePointer(0);
 		// Find the EbmlHead element. Must be the first one.
-		m_ElementLevel0 = ElementPtr(m_InputStream.FindNextID(EbmlHead::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+		m_ElementLevel0 = ElementPtr(m_InputStream->FindNextID(EbmlHead::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
 		if (m_ElementLevel0 == NullElement) {
 			LOG_ERROR_S( "No EbmlHead/level 0 element found." );
 			return 1;
 		}
 		//We must have found the EBML head :)
-		m_ElementLevel0->SkipData(m_InputStream, m_ElementLevel0->Generic().Context);
+		m_ElementLevel0->SkipData(*m_InputStream, m_ElementLevel0->Generic().Context);
 		//delete m_ElementLevel0;
 		//_DELETE(m_ElementLevel0);
 
 		// Next element must be a segment
-		m_ElementLevel0 = ElementPtr(m_InputStream.FindNextID(KaxSegment::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+		m_ElementLevel0 = ElementPtr(m_InputStream->FindNextID(KaxSegment::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
 		if (m_ElementLevel0 == NullElement) {
 			LOG_ERROR_S( "No segment/level 0 element found." );
 			return 1;
@@ -309,7 +759,7 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 
 		UpperElementLevel = 0;
 		// We've got our segment, so let's find the tracks
-		ElementLevel1 = ElementPtr(m_InputStream.FindNextElement(m_ElementLevel0->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+		ElementLevel1 = ElementPtr(m_InputStream->FindNextElement(m_ElementLevel0->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 		while (ElementLevel1 != NullElement) {
 			if (UpperElementLevel > 0) {
                 LOG_DEBUG_S( "MatroskaParser::Parse(): UpperElementLevel = " << UpperElementLevel );
@@ -320,6 +770,7 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 			}
 
 			if (EbmlId(*ElementLevel1) == KaxSeekHead::ClassInfos.GlobalId) {
+				if (m_SeekHeadPos == 0) m_SeekHeadPos = ElementLevel1->GetElementPosition();
 				if (IsSeekable(*m_IOCallback)) {
 					Parse_MetaSeek(ElementLevel1, bInfoOnly);
 					if (m_TagPos == 0) {
@@ -342,7 +793,7 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 									m_IOCallback->setFilePointer(s_pos+pos+3);
 									uint64 startPos = m_IOCallback->getFilePointer();
 									m_IOCallback->setFilePointer(-4, seek_current);
-									ElementPtr levelUnknown = ElementPtr(m_InputStream.FindNextID(KaxTags::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+									ElementPtr levelUnknown = ElementPtr(m_InputStream->FindNextID(KaxTags::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
 									if ((levelUnknown != NullElement) 
 										&& (m_FileSize >= startPos + levelUnknown->GetSize()) 
 										&& (EbmlId(*levelUnknown) == KaxTags::ClassInfos.GlobalId))
@@ -368,7 +819,7 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 										//seek back 3 bytes, so libmatroska can find the Tags element Ebml ID
 										m_IOCallback->setFilePointer(-4, seek_current);
 
-										ElementPtr levelUnknown = ElementPtr(m_InputStream.FindNextID(KaxTags::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+										ElementPtr levelUnknown = ElementPtr(m_InputStream->FindNextID(KaxTags::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
 										if ((levelUnknown != NullElement) 
 											&& (m_FileSize >= startPos + levelUnknown->GetSize()) 
 											&& (EbmlId(*levelUnknown) == KaxTags::ClassInfos.GlobalId))
@@ -394,7 +845,7 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 				else LOG_INFO_S( "MatroskaParser::Parse(): IsSeekable() returned false." );
 			}else if (EbmlId(*ElementLevel1) == KaxInfo::ClassInfos.GlobalId) {
 				// General info about this Matroska file
-				ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, bAllowDummy));
+				ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, bAllowDummy));
 				while (ElementLevel2 != NullElement) {
 					if (UpperElementLevel > 0) {
 						break;
@@ -405,44 +856,45 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 
 					if (EbmlId(*ElementLevel2) == KaxTimecodeScale::ClassInfos.GlobalId) {
 						KaxTimecodeScale &TimeScale = *static_cast<KaxTimecodeScale *>(ElementLevel2.get());
-						TimeScale.ReadData(m_InputStream.I_O());
+						TimeScale.ReadData(m_InputStream->I_O());
 
 						//matroskaGlobalTrack->SetTimecodeScale(uint64(TimeScale));
 						m_TimecodeScale = uint64(TimeScale);
 					} else if (EbmlId(*ElementLevel2) == KaxDuration::ClassInfos.GlobalId) {
 						KaxDuration &duration = *static_cast<KaxDuration *>(ElementLevel2.get());
-						duration.ReadData(m_InputStream.I_O());
+						duration.ReadData(m_InputStream->I_O());
 
 						// it's in milliseconds? -- in nanoseconds.
 						m_Duration = double(duration) * double(m_TimecodeScale);
+						m_DurationSource = duration_from_info;
 
 					} else if (EbmlId(*ElementLevel2) == KaxDateUTC::ClassInfos.GlobalId) {
 						KaxDateUTC & DateUTC = *static_cast<KaxDateUTC *>(ElementLevel2.get());
-						DateUTC.ReadData(m_InputStream.I_O());
+						DateUTC.ReadData(m_InputStream->I_O());
 						
 						m_FileDate = DateUTC.GetEpochDate();
 
 					} else if (EbmlId(*ElementLevel2) == KaxSegmentFilename::ClassInfos.GlobalId) {
 						KaxSegmentFilename &tag_SegmentFilename = *static_cast<KaxSegmentFilename *>(ElementLevel2.get());
-						tag_SegmentFilename.ReadData(m_InputStream.I_O());
+						tag_SegmentFilename.ReadData(m_InputStream->I_O());
 
 						m_SegmentFilename = *static_cast<EbmlUnicodeString *>(&tag_SegmentFilename);
 
 					} else if (EbmlId(*ElementLevel2) == KaxMuxingApp::ClassInfos.GlobalId)	{
 						KaxMuxingApp &tag_MuxingApp = *static_cast<KaxMuxingApp *>(ElementLevel2.get());
-						tag_MuxingApp.ReadData(m_InputStream.I_O());
+						tag_MuxingApp.ReadData(m_InputStream->I_O());
 
 						m_MuxingApp = *static_cast<EbmlUnicodeString *>(&tag_MuxingApp);
 
 					} else if (EbmlId(*ElementLevel2) == KaxWritingApp::ClassInfos.GlobalId) {
 						KaxWritingApp &tag_WritingApp = *static_cast<KaxWritingApp *>(ElementLevel2.get());
-						tag_WritingApp.ReadData(m_InputStream.I_O());
+						tag_WritingApp.ReadData(m_InputStream->I_O());
 						
 						m_WritingApp = *static_cast<EbmlUnicodeString *>(&tag_WritingApp);
 
 					} else if (EbmlId(*ElementLevel2) == KaxTitle::ClassInfos.GlobalId) {
 						KaxTitle &Title = *static_cast<KaxTitle*>(ElementLevel2.get());
-						Title.ReadData(m_InputStream.I_O());
+						Title.ReadData(m_InputStream->I_O());
 						m_FileTitle = UTFstring(Title).c_str();
 					}
 
@@ -453,22 +905,24 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 						if (UpperElementLevel > 0)
 							break;
 					} else {
-						ElementLevel2->SkipData(m_InputStream, ElementLevel2->Generic().Context);
+						ElementLevel2->SkipData(*m_InputStream, ElementLevel2->Generic().Context);
 						//delete ElementLevel2;
 						//_DELETE(ElementLevel2);
-						ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, bAllowDummy));
+						ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, bAllowDummy));
 					}
 				}
 			}else if (EbmlId(*ElementLevel1) == KaxChapters::ClassInfos.GlobalId) {
-				Parse_Chapters(static_cast<KaxChapters *>(ElementLevel1.get()));
+				if (m_LazyMetadata) m_DeferredChaptersPos = ElementLevel1->GetElementPosition();
+				else Parse_Chapters(static_cast<KaxChapters *>(ElementLevel1.get()));
 			}else if (EbmlId(*ElementLevel1) == KaxTags::ClassInfos.GlobalId) {
-				Parse_Tags(static_cast<KaxTags *>(ElementLevel1.get()));
+				if (m_LazyMetadata) m_DeferredTagsPos = ElementLevel1->GetElementPosition();
+				else Parse_Tags(static_cast<KaxTags *>(ElementLevel1.get()));
 			} else if (EbmlId(*ElementLevel1) == KaxTracks::ClassInfos.GlobalId) {
 				// Yep, we've found our KaxTracks element. Now find all tracks
 				// contained in this segment. 
 				KaxTracks *Tracks = static_cast<KaxTracks *>(ElementLevel1.get());
 				EbmlElement* tmpElement = ElementLevel2.get();
-				Tracks->Read(m_InputStream, KaxTracks::ClassInfos.Context, UpperElementLevel, tmpElement, bAllowDummy);
+				Tracks->Read(*m_InputStream, KaxTracks::ClassInfos.Context, UpperElementLevel, tmpElement, bAllowDummy);
 
 				for (uint32 Index0 = 0; Index0 < Tracks->ListSize(); Index0++) {
 					if ((*Tracks)[Index0]->Generic().GlobalId == KaxTrackEntry::ClassInfos.GlobalId) {
@@ -490,9 +944,8 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 								newTrack.trackType = (track_type) (uint8) TrackType;    // TO_DO: check that this is a supported track type.
 
 							} else if (TrackEntry[Index1]->Generic().GlobalId == KaxTrackTimecodeScale::ClassInfos.GlobalId) {
-								//KaxTrackTimecodeScale &TrackTimecodeScale = *static_cast<KaxTrackTimecodeScale*>(TrackEntry[Index1]);
-								// TODO: Support Tracks with different timecode scales?
-								//newTrack->TrackTimecodeScale = TrackTimecodeScale;
+								KaxTrackTimecodeScale &TrackTimecodeScale = *static_cast<KaxTrackTimecodeScale*>(TrackEntry[Index1]);
+								newTrack.timecodeScale = ApproximateRational(double(TrackTimecodeScale));
 
 							} else if (TrackEntry[Index1]->Generic().GlobalId == KaxTrackDefaultDuration::ClassInfos.GlobalId) {
 								KaxTrackDefaultDuration &TrackDefaultDuration = *static_cast<KaxTrackDefaultDuration*>(TrackEntry[Index1]);
@@ -535,6 +988,9 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 								KaxTrackName &TrackName = *static_cast<KaxTrackName*>(TrackEntry[Index1]);
 								newTrack.name = TrackName;
 
+							} else if (TrackEntry[Index1]->Generic().GlobalId == KaxContentEncodings::ClassInfos.GlobalId) {
+								Parse_ContentEncodings(*static_cast<KaxContentEncodings*>(TrackEntry[Index1]), newTrack);
+
 							} else if (TrackEntry[Index1]->Generic().GlobalId == KaxTrackAudio::ClassInfos.GlobalId) {
 								KaxTrackAudio &TrackAudio = *static_cast<KaxTrackAudio*>(TrackEntry[Index1]);
 
@@ -566,19 +1022,23 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 								}
 							}
 						}
+						if (!newTrack.codecPrivate.empty() && !newTrack.contentEncodings.empty()) {
+							ByteArray decoded;
+							PayloadView codecPrivate(&newTrack.codecPrivate.front(), newTrack.codecPrivate.size());
+							if (DecodeData(newTrack.contentEncodings, ContentScopeCodecPrivate, codecPrivate, decoded, *m_BufferPool))
+								newTrack.codecPrivate.swap(decoded);
+							else
+								LOG_WARN_S("MatroskaParser::Parse(): can't decode codec private data of track " << newTrack.trackNumber);
+						}
 						if (newTrack.trackNumber != 0xFFFF)
 							m_Tracks.push_back(newTrack);
 					}
 				}
+			} else if (EbmlId(*ElementLevel1) == KaxCues::ClassInfos.GlobalId) {
+				m_CuesPos = ElementLevel1->GetElementPosition();
 			} else if (EbmlId(*ElementLevel1) == KaxCluster::ClassInfos.GlobalId) {
-#if 0
-                cluster_entry_ptr newCluster(new MatroskaMetaSeekClusterEntry());
-                newCluster->timecode = MAX_UINT64;
-                newCluster->filePos = ElementLevel1->GetElementPosition();
-                newCluster->clusterNo = m_ClusterIndex.size();
-                m_ClusterIndex.push_back(newCluster);
-                LOG_INFO_S( "MatroskaParser::Parse(): Got cluster @ " << (uint64) newCluster->filePos );
-#endif
+				// The clusters are indexed by BuildClusterIndex(), once it's needed.
+				if (m_FirstClusterPos == 0) m_FirstClusterPos = ElementLevel1->GetElementPosition();
 				if (bBreakAtClusters) {
 					m_IOCallback->setFilePointer(ElementLevel1->GetElementPosition());
 					//delete ElementLevel1;
@@ -589,80 +1049,8 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 			} else if (EbmlId(*ElementLevel1) == KaxAttachments::ClassInfos.GlobalId) {
 				// Yep, we've found our KaxAttachment element. Now find all attached files
 				// contained in this segment.
-#if 1
-				ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
-				while (ElementLevel2 != NullElement) {
-					if (UpperElementLevel > 0) {
-						break;
-					}
-					if (UpperElementLevel < 0) {
-						UpperElementLevel = 0;
-					}
-					if (EbmlId(*ElementLevel2) == KaxAttached::ClassInfos.GlobalId) {
-						// We actually found a attached file entry :D
-						MatroskaAttachment newAttachment;
-
-						ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
-						while (ElementLevel3 != NullElement) {
-							if (UpperElementLevel > 0) {
-								break;
-							}
-							if (UpperElementLevel < 0) {
-								UpperElementLevel = 0;
-							}
-
-							// Now evaluate the data belonging to this track
-							if (EbmlId(*ElementLevel3) == KaxFileName::ClassInfos.GlobalId) {
-								KaxFileName &attached_filename = *static_cast<KaxFileName *>(ElementLevel3.get());
-								attached_filename.ReadData(m_InputStream.I_O());
-								newAttachment.FileName = UTFstring(attached_filename);
-
-							} else if (EbmlId(*ElementLevel3) == KaxMimeType::ClassInfos.GlobalId) {
-								KaxMimeType &attached_mime_type = *static_cast<KaxMimeType *>(ElementLevel3.get());
-								attached_mime_type.ReadData(m_InputStream.I_O());
-								newAttachment.MimeType = std::string(attached_mime_type);
-
-							} else if (EbmlId(*ElementLevel3) == KaxFileDescription::ClassInfos.GlobalId) {
-								KaxFileDescription &attached_description = *static_cast<KaxFileDescription *>(ElementLevel3.get());
-								attached_description.ReadData(m_InputStream.I_O());
-								newAttachment.Description = UTFstring(attached_description);
-
-							} else if (EbmlId(*ElementLevel3) == KaxFileData::ClassInfos.GlobalId) {
-								KaxFileData &attached_data = *static_cast<KaxFileData *>(ElementLevel3.get());
-
-								//We don't what to read the data into memory because it could be very large
-								//attached_data.ReadData(m_InputStream.I_O());
-
-								//Instead we store the Matroska filename, the start of the data and the length, so we can read it
-								//later at the users request. IMHO This will save a lot of memory
-								newAttachment.SourceStartPos = attached_data.GetElementPosition() + attached_data.HeadSize();
-								newAttachment.SourceDataLength = attached_data.GetSize();
-							}
-
-							if (UpperElementLevel > 0) {	// we're coming from ElementLevel4
-								UpperElementLevel--;
-								ElementLevel3 = ElementLevel4;
-								if (UpperElementLevel > 0)
-									break;
-							} else {
-								ElementLevel3->SkipData(m_InputStream, ElementLevel3->Generic().Context);
-								ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
-							}					
-						} // while (ElementLevel3 != NULL)
-						m_AttachmentList.push_back(newAttachment);
-					}
-
-					if (UpperElementLevel > 0) {	// we're coming from ElementLevel3
-						UpperElementLevel--;
-						ElementLevel2 = ElementLevel3;
-						if (UpperElementLevel > 0)
-							break;
-					} else {
-						ElementLevel2->SkipData(m_InputStream, ElementLevel2->Generic().Context);
-						ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
-					}
-				} // while (ElementLevel2 != NULL)
-#endif
+				if (m_LazyMetadata) m_DeferredAttachmentsPos = ElementLevel1->GetElementPosition();
+				else Parse_Attachments(ElementLevel1, UpperElementLevel, ElementLevel2);
 			}
 			
 			if (UpperElementLevel > 0) {		// we're coming from ElementLevel2
@@ -673,12 +1061,12 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 				if (UpperElementLevel > 0)
 					break;
 			} else {
-				ElementLevel1->SkipData(m_InputStream, ElementLevel1->Generic().Context);
+				ElementLevel1->SkipData(*m_InputStream, ElementLevel1->Generic().Context);
 				//delete ElementLevel1;
 				//ElementLevel1 = NULL;
 				//_DELETE(ElementLevel1);
 
-				ElementLevel1 = ElementPtr(m_InputStream.FindNextElement(m_ElementLevel0->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+				ElementLevel1 = ElementPtr(m_InputStream->FindNextElement(m_ElementLevel0->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 			}
 		} // while (ElementLevel1 != NULL)
 		//_DELETE(ElementLevel3);
@@ -699,59 +1087,130 @@ int MatroskaParser::Parse(bool bInfoOnly, bool bBreakAtClusters)
 
 MatroskaTagInfo *MatroskaParser::FindTagWithTrackUID(uint64 trackUID) 
 {
-	MatroskaTagInfo *foundTag = NULL;
+	LoadTags();
+	TagIndexMap::const_iterator found = m_TagsByTrackUID.find(trackUID);
+	if (found == m_TagsByTrackUID.end()) return NULL;
 
-	for (size_t t = 0; t < m_Tags.size(); t++)
+	const std::vector<size_t> &tagIndexes = found->second;
+	for (size_t t = 0; t < tagIndexes.size(); t++)
 	{
-		MatroskaTagInfo& currentTag = m_Tags.at(t);
-		if (currentTag.targetTrackUID == trackUID &&
-			currentTag.targetEditionUID == 0 &&
+		MatroskaTagInfo& currentTag = m_Tags.at(tagIndexes[t]);
+		if (currentTag.targetEditionUID == 0 &&
 			currentTag.targetChapterUID == 0 &&
 			currentTag.targetAttachmentUID == 0)
 		{
-			foundTag = &currentTag;
-			break;
+			return &currentTag;
 		}
 	}
 
-	return foundTag;
+	return NULL;
 };
 
 MatroskaTagInfo *MatroskaParser::FindTagWithEditionUID(uint64 editionUID, uint64 trackUID)
 {
-	MatroskaTagInfo *foundTag = NULL;
+	LoadTags();
+	return FindTagInIndex(m_TagsByEditionUID, editionUID, trackUID);
+};
+
+MatroskaTagInfo *MatroskaParser::FindTagWithChapterUID(uint64 chapterUID, uint64 trackUID)
+{
+	LoadTags();
+	return FindTagInIndex(m_TagsByChapterUID, chapterUID, trackUID);
+};
+
+	// Returns the first tag with the given UID in index, that targets trackUID (if non-zero).
+MatroskaTagInfo *MatroskaParser::FindTagInIndex(const TagIndexMap &index, uint64 uid, uint64 trackUID)
+{
+	TagIndexMap::const_iterator found = index.find(uid);
+	if (found == index.end()) return NULL;
 
-	for (size_t t = 0; t < m_Tags.size(); t++)
+	const std::vector<size_t> &tagIndexes = found->second;
+	for (size_t t = 0; t < tagIndexes.size(); t++)
 	{
-		MatroskaTagInfo &currentTag = m_Tags.at(t);
-		if (currentTag.targetEditionUID == editionUID &&
-			(trackUID == 0 || (currentTag.targetTrackUID == trackUID)))
-		{
-			foundTag = &currentTag;
-			break;
-		}
+		MatroskaTagInfo &currentTag = m_Tags.at(tagIndexes[t]);
+		if (trackUID == 0 || (currentTag.targetTrackUID == trackUID))
+			return &currentTag;
 	}
 
-	return foundTag;
-};
+	return NULL;
+}
 
-MatroskaTagInfo *MatroskaParser::FindTagWithChapterUID(uint64 chapterUID, uint64 trackUID)
+const MatroskaChapterInfo *MatroskaParser::FindChapter(uint64 chapterUID)
 {
-	MatroskaTagInfo *foundTag = NULL;
+	LoadChapters();
+	boost::unordered_map<uint64, const MatroskaChapterInfo *>::const_iterator found = m_ChaptersByUID.find(chapterUID);
+	return (found == m_ChaptersByUID.end()) ? NULL : found->second;
+}
 
-	for (size_t t = 0; t < m_Tags.size(); t++)
-	{
-		MatroskaTagInfo &currentTag = m_Tags.at(t);
-		if (currentTag.targetChapterUID == chapterUID &&
-			(trackUID == 0 || (currentTag.targetTrackUID == trackUID)))
-		{
-			foundTag = &currentTag;
-			break;
+void MatroskaParser::GetChaptersAt(uint64 timecode, uint16 trackNum, std::vector<const MatroskaChapterInfo *> &chapters)
+{
+	LoadChapters();
+	const size_t first = chapters.size();
+	m_ChapterIndex.Find(timecode, chapters);
+	if (trackNum == 0) return;
+
+	// Chapters without tracks apply to all of them.
+	std::vector<const MatroskaChapterInfo *>::iterator kept = chapters.begin() + first;
+	for (std::vector<const MatroskaChapterInfo *>::iterator c = kept; c != chapters.end(); ++c) {
+		const std::vector<uint64> &tracks = (*c)->tracks;
+		if (tracks.empty() || std::find(tracks.begin(), tracks.end(), uint64(trackNum)) != tracks.end())
+			*kept++ = *c;
+	}
+	chapters.erase(kept, chapters.end());
+}
+
+void MatroskaParser::GetTagsAt(uint64 timecode, uint16 trackNum, std::vector<const MatroskaTagInfo *> &tags)
+{
+	LoadTags();
+	const uint16 trackIdx = FindTrack(trackNum);
+	const uint64 trackUID = (trackIdx == 0xffff) ? 0 : m_Tracks[trackIdx].trackUID;
+	if (trackUID != 0) {
+		if (const MatroskaTagInfo *trackTag = FindTagWithTrackUID(trackUID)) tags.push_back(trackTag);
+	}
+
+	std::vector<const MatroskaChapterInfo *> chapters;
+	GetChaptersAt(timecode, trackNum, chapters);
+	for (size_t c = 0; c < chapters.size(); c++) {
+		TagIndexMap::const_iterator found = m_TagsByChapterUID.find(chapters[c]->chapterUID);
+		if (found == m_TagsByChapterUID.end()) continue;
+
+		const std::vector<size_t> &tagIndexes = found->second;
+		for (size_t t = 0; t < tagIndexes.size(); t++) {
+			const MatroskaTagInfo &currentTag = m_Tags[tagIndexes[t]];
+			if (currentTag.targetTrackUID == 0 || currentTag.targetTrackUID == trackUID)
+				tags.push_back(&currentTag);
 		}
 	}
+}
 
-	return foundTag;
-};
+	// Called once chapters have been added, since they're held by value in nested vectors.
+void MatroskaParser::IndexChapters()
+{
+	m_ChapterIndex.Build(m_Chapters);
+
+	m_ChaptersByUID.clear();
+	std::vector<const MatroskaChapterInfo *> pending;
+	for (size_t c = 0; c < m_Chapters.size(); c++) pending.push_back(&m_Chapters[c]);
+	while (!pending.empty()) {
+		const MatroskaChapterInfo *chapter = pending.back();
+		pending.pop_back();
+		m_ChaptersByUID.insert(std::make_pair(chapter->chapterUID, chapter));
+		for (size_t c = 0; c < chapter->subChapters.size(); c++) pending.push_back(&chapter->subChapters[c]);
+	}
+}
+
+void MatroskaParser::IndexTags()
+{
+	m_TagsByTrackUID.clear();
+	m_TagsByEditionUID.clear();
+	m_TagsByChapterUID.clear();
+	for (size_t t = 0; t < m_Tags.size(); t++) {
+		const MatroskaTagInfo &currentTag = m_Tags[t];
+		m_TagsByTrackUID[currentTag.targetTrackUID].push_back(t);
+		m_TagsByEditionUID[currentTag.targetEditionUID].push_back(t);
+		m_TagsByChapterUID[currentTag.targetChapterUID].push_back(t);
+	}
+}
 
 double MatroskaParser::GetDuration()
 { 
@@ -761,6 +1220,53 @@ double MatroskaParser::GetDuration()
 	return m_Duration / 1000000000.0;
 }
 
+    // Extends end to that of a block.
+static bool ExtendToBlock( uint64 &end, const MatroskaBlockInfo &block )
+{
+    end = std::max( end, block.timecode + block.duration );
+    return true;
+}
+
+bool MatroskaParser::MeasureDuration()
+{
+    // A growing file's last cluster isn't its last for long.
+    if (m_Follow || m_FirstClusterPos == 0) return false;
+
+    uint64 end = 0;
+    try {
+        const ReadAtFunction read_at = boost::bind( &MatroskaParser::ReadBytesAt, this, _1, _2, _3 );
+        ClusterLocation last;
+        if (!FindLastCluster( read_at, m_FirstClusterPos, m_FileSize, MaxTailScanSize, last )) {
+            // It's a long way back, so hop forward from cluster to cluster, instead.
+            std::vector<ClusterLocation> clusters;
+            FindClusters( read_at, m_FirstClusterPos, m_FileSize, clusters );
+            if (clusters.empty()) return false;
+            last = clusters.back();
+        }
+
+        end = last.timecode * m_TimecodeScale;
+        const BlockScanCallback extend = boost::bind( &ExtendToBlock, boost::ref( end ), _1 );
+        ScanClusterBlocks( read_at, last, boost::bind( &MatroskaParser::DescribeBlock, this, boost::cref( extend ), _1 ) );
+    } catch (std::exception &e) {
+        LOG_WARN_S( "MatroskaParser::MeasureDuration(): " << e.what() );
+        return false;
+    }
+
+    LOG_INFO_S( "MatroskaParser::MeasureDuration(): " << end << " ns, vs. " << m_Duration << " reported" );
+    const uint64 oldEnd = static_cast<uint64>(m_Duration);
+    m_Duration = double(end);
+    m_DurationSource = duration_measured;
+
+    // If the last chapter was left open-ended, FixChapterEndTimes() ended it at the old
+    // duration, so it's reopened, to end at the new one.
+    if (!m_Chapters.empty()) {
+        if (m_Chapters.back().timeEnd == oldEnd) m_Chapters.back().timeEnd = 0;
+        FixChapterEndTimes();
+        IndexChapters();
+    }
+    return true;
+}
+
 double MatroskaParser::GetTrackDuration( uint32 trackIdx ) const
 {
     return double( m_Tracks.at(trackIdx).defaultDuration ) * double( m_TimecodeScale );
@@ -827,7 +1333,8 @@ bool MatroskaParser::TrackNumIsEnabled( uint16 trackNum ) const
 
 bool MatroskaParser::IsAnyQueueFull() const
 {
-    if (m_MaxQueueDepth == 0) return false;
+        // Frames past the limit are then queued without their payloads.
+    if (m_MaxQueueDepth == 0 || DefersPayloads()) return false;
 
     for(FrameQueueMap::const_iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
     {
@@ -850,6 +1357,7 @@ uint16 MatroskaParser::FindTrack( uint16 trackNum ) const
 
 void MatroskaParser::SetSubSong(int subsong)
 {
+	LoadChapters();
 	// As we don't (yet?) use several Editions, select the first (default) one as the current one.
 	m_CurrentChapter = NULL;
 	if (subsong < 0 || m_Chapters.size() > (size_t) subsong)
@@ -864,51 +1372,365 @@ void MatroskaParser::SetMaxQueueDepth( unsigned int depth )
 }
 
 
-int32 MatroskaParser::GetAvgBitrate() 
-{ 
-	double ret = 0;
-	ret = static_cast<double>(int64(m_FileSize)) / 1024;
-	ret = ret / (m_Duration / 1000000000.0);
-	ret = ret * 8;
-	return static_cast<int32>(ret);
-};
+void MatroskaParser::SetDeferredPayloads( bool defer )
+{
+    m_DeferPayloads = defer;
+}
+
 
-bool MatroskaParser::skip_frames_until(double destination, unsigned hint_samplerate)
+bool MatroskaParser::DefersPayloads() const
 {
-    bool have_data = false;
-    while (!have_data)
-    {
-        for(FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
-        {
-            FrameQueue &track_queue = track->second;
-            while (!track_queue.empty() && TimecodeToSeconds( track_queue.front().timecode, hint_samplerate ) < destination) track_queue.pop_front();
+    return m_DeferPayloads && !m_MemoryBase;
+}
 
-            if (!track_queue.empty()) have_data = true;
-        }
 
-        if (!have_data && (FillQueue() > 0)) return false;
-    }
+    // Whether any queue has reached the max depth.  Until one has, blocks are read whole.
+bool MatroskaParser::MayDeferPayloads() const
+{
+    if (m_MaxQueueDepth == 0 || !DefersPayloads()) return false;
 
-    return true;
+    for (FrameQueueMap::const_iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        if (track->second.size() >= (size_t) m_MaxQueueDepth) return true;
+    }
+    return false;
 }
 
-bool MatroskaParser::Seek(double seconds, unsigned samplerate_hint)
-{
-	if (m_CurrentChapter != NULL) {
-		seconds += (double)(int64)m_CurrentChapter->timeStart / 1000000000; // ns -> seconds
-	}
 
-	uint64 seekToTimecode = SecondsToTimecode(seconds);
-	
-	m_CurrentTimecode = seekToTimecode;
+bool MatroskaParser::ShouldDeferPayload( uint16 trackIdx ) const
+{
+    if (m_MaxQueueDepth == 0 || !DefersPayloads()) return false;
 
-	if (!skip_frames_until(seconds, samplerate_hint)) return false;
+    FrameQueueMap::const_iterator track = m_FrameQueues.find( trackIdx );
+    return (track != m_FrameQueues.end()) && (track->second.size() >= (size_t) m_MaxQueueDepth);
+}
 
-	m_CurrentTimecode = seekToTimecode;
-	return (FillQueue() > 0);
-};
 
-MatroskaFrame * MatroskaParser::ReadSingleFrame( uint16 trackIdx )
+    // Reads the laces of a frame from where they lie in the file.
+void MatroskaParser::ReadPayload( MatroskaFrame &frame )
+{
+    frame.dataBuffer.resize( frame.deferredLaces.size() );
+    for (size_t i = 0; i < frame.deferredLaces.size(); i++)
+    {
+        const PayloadLocation &lace = frame.deferredLaces[i];
+        ByteArray &buffer = frame.dataBuffer[i];
+        m_BufferPool->Acquire( buffer );
+        buffer.resize( lace.size );
+        if (lace.size == 0) continue;
+
+        size_t num_read = ReadBytesAt( lace.pos, &buffer.front(), lace.size );
+        if (num_read != lace.size) throw std::runtime_error(
+            (boost::format( "MatroskaParser::ReadPayload(): read %u of %u bytes at %u" )
+                % num_read % lace.size % lace.pos).str() );
+    }
+    frame.deferredLaces.clear();
+}
+
+
+void MatroskaParser::LoadDeferredPayload( uint16 trackIdx, MatroskaFrame &frame )
+{
+    if (frame.deferredLaces.empty()) return;
+
+    ReadPayload( frame );
+
+    const MatroskaTrackInfo &track = m_Tracks[trackIdx];
+    if (EncodesFrames( track ) && !DecodeFrame( track.contentEncodings, frame, *m_BufferPool ))
+    {
+        LOG_WARN_S( "MatroskaParser::LoadDeferredPayload(): failed to decode frame of track " << track.trackNumber << " at " << frame.timecode );
+    }
+    RechargeFrame( trackIdx, frame );
+}
+
+
+void MatroskaParser::SetByteBudget( uint64 bytes )
+{
+    m_ByteBudget = bytes;
+}
+
+
+void MatroskaParser::SetTrackByteBudget( uint16 trackIdx, uint64 bytes )
+{
+    if (bytes == 0) m_TrackByteBudgets.erase( trackIdx );
+    else m_TrackByteBudgets[trackIdx] = bytes;
+}
+
+
+uint64 MatroskaParser::GetQueuedBytes() const
+{
+    return m_TotalQueuedBytes;
+}
+
+
+uint64 MatroskaParser::GetQueuedBytes( uint16 trackIdx ) const
+{
+    std::map<uint16, uint64>::const_iterator queued = m_QueuedBytes.find( trackIdx );
+    return (queued == m_QueuedBytes.end()) ? 0 : queued->second;
+}
+
+
+void MatroskaParser::SetPressureCallback( const PressureCallback &callback )
+{
+    m_PressureCallback = callback;
+}
+
+
+uint64 MatroskaParser::DropQueuedFrames( uint16 trackIdx, uint64 bytes )
+{
+    FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
+    if (track == m_FrameQueues.end()) return 0;
+
+    FinishDecoding();
+    uint64 freed = 0;
+    FrameQueue &queue = track->second;
+    while (freed < bytes && !queue.empty())
+    {
+            // Deferred payloads needn't be read, just to be dropped.
+        MatroskaFrame *frame = queue.pop_front().release();
+        UnchargeFrame( trackIdx, *frame );
+        freed += frame->queuedBytes;
+        RecycleFrame( frame );
+    }
+
+    return freed;
+}
+
+
+MatroskaFrame *MatroskaParser::PopQueuedFrame( uint16 trackIdx )
+{
+    FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
+    if (track == m_FrameQueues.end() || track->second.empty()) return NULL;
+
+    FinishDecoding();
+    MatroskaFrame *frame = track->second.pop_front().release();
+    LoadDeferredPayload( trackIdx, *frame );
+    UnchargeFrame( trackIdx, *frame );
+    return frame;
+}
+
+
+uint64 MatroskaParser::GetFrameBytes( const MatroskaFrame &frame ) const
+{
+    uint64 bytes = frame.additional_data_buffer.size();
+    for (size_t i = 0; i < frame.get_lace_count(); i++)
+    {
+        bytes += frame.get_lace( i ).size;
+    }
+
+        // Deferred payloads will take (at least) this much, once they're loaded.
+    for (size_t i = 0; i < frame.deferredLaces.size(); i++)
+    {
+        bytes += frame.deferredLaces[i].size;
+    }
+
+    return bytes;
+}
+
+
+bool MatroskaParser::HasByteBudgets() const
+{
+    return m_ByteBudget != 0 || !m_TrackByteBudgets.empty();
+}
+
+
+    // A frame bigger than a track's budget is still let into its empty queue, or the
+    // reader of the track could never get past it.  Likewise, for the overall budget,
+    // once every queue is empty.
+bool MatroskaParser::FitsByteBudgets( uint16 trackIdx, uint64 bytes ) const
+{
+    const uint64 trackBytes = GetQueuedBytes( trackIdx );
+    std::map<uint16, uint64>::const_iterator budget = m_TrackByteBudgets.find( trackIdx );
+    if (budget != m_TrackByteBudgets.end() && trackBytes != 0 && trackBytes + bytes > budget->second) return false;
+
+    return (m_ByteBudget == 0) || (m_TotalQueuedBytes == 0) || (m_TotalQueuedBytes + bytes <= m_ByteBudget);
+}
+
+
+bool MatroskaParser::MakeRoom( uint16 trackIdx, uint64 bytes )
+{
+    if (FitsByteBudgets( trackIdx, bytes )) return true;
+    if (!m_PressureCallback) return false;
+
+    m_PressureCallback( *this, trackIdx, bytes );
+    return FitsByteBudgets( trackIdx, bytes );
+}
+
+
+void MatroskaParser::ChargeFrame( uint16 trackIdx, MatroskaFrame &frame )
+{
+    frame.queuedBytes = size_t( GetFrameBytes( frame ) );
+    m_QueuedBytes[trackIdx] += frame.queuedBytes;
+    m_TotalQueuedBytes += frame.queuedBytes;
+}
+
+
+void MatroskaParser::UnchargeFrame( uint16 trackIdx, const MatroskaFrame &frame )
+{
+    m_QueuedBytes[trackIdx] -= frame.queuedBytes;
+    m_TotalQueuedBytes -= frame.queuedBytes;
+}
+
+
+    // After a frame's payload has changed size, by being decoded or loaded.
+void MatroskaParser::RechargeFrame( uint16 trackIdx, MatroskaFrame &frame )
+{
+    UnchargeFrame( trackIdx, frame );
+    ChargeFrame( trackIdx, frame );
+}
+
+
+    // After frames are removed from the queues in bulk.
+void MatroskaParser::RecountQueuedBytes()
+{
+    m_TotalQueuedBytes = 0;
+    m_QueuedBytes.clear();
+    for (FrameQueueMap::const_iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        uint64 &trackBytes = m_QueuedBytes[uint16( track->first )];
+        for (FrameQueue::const_iterator frame = track->second.begin(); frame != track->second.end(); ++frame)
+        {
+            trackBytes += frame->queuedBytes;
+        }
+        m_TotalQueuedBytes += trackBytes;
+    }
+}
+
+
+void MatroskaParser::SetFollowMode( bool follow, unsigned int timeout_ms )
+{
+    if (follow && m_MemoryBase) throw std::runtime_error(
+        "MatroskaParser::SetFollowMode(): in-memory sources can't grow" );
+
+    m_Follow = follow;
+    m_FollowTimeoutMs = timeout_ms;
+    if (follow)
+    {
+        if (!m_Watcher) m_Watcher.reset( new FileWatcher( m_filename ) );
+        m_Eof = false;
+    }
+}
+
+
+void MatroskaParser::SetLaceSplitting( bool split )
+{
+    m_SplitLaces = split;
+}
+
+
+void MatroskaParser::SetDecodeThreads( unsigned int num_threads )
+{
+    FinishDecoding();
+    m_DecodeWorkers.reset( num_threads ? new DecodeWorkers( num_threads, *m_BufferPool ) : NULL );
+}
+
+
+void MatroskaParser::RecycleFrame( MatroskaFrame *frame )
+{
+    if (!frame) return;
+
+    for (size_t i = 0; i < frame->dataBuffer.size(); i++)
+    {
+        m_BufferPool->Release( frame->dataBuffer[i] );
+    }
+    delete frame;
+}
+
+
+    // Returns every queued frame's buffers to the pool.
+void MatroskaParser::DiscardQueuedFrames()
+{
+    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        FrameQueue &queue = track->second;
+        while (!queue.empty()) RecycleFrame( queue.pop_front().release() );
+    }
+    RecountQueuedBytes();
+}
+
+
+bool MatroskaParser::IsElementComplete( const EbmlElement &element )
+{
+    if (!element.IsFiniteSize()) return true;
+
+    uint64 end = element.GetElementPosition() + element.HeadSize() + element.GetSize();
+    if (end <= m_FileSize) return true;
+
+        // Only hit the filesystem when we seem to have caught up with the writer.
+    if (m_Watcher) m_FileSize = std::max( m_FileSize, m_Watcher->GetSize() );
+    return end <= m_FileSize;
+}
+
+
+int MatroskaParser::WaitForMoreData()
+{
+    uint64 size = m_Watcher->WaitForGrowth( m_FileSize, m_FollowTimeoutMs );
+    if (size <= m_FileSize) return 3;
+
+    LOG_DEBUG_S( "MatroskaParser::WaitForMoreData(): file grew to " << size );
+    m_FileSize = size;
+    return 0;
+}
+
+
+int32 MatroskaParser::GetAvgBitrate() 
+{ 
+	if (m_Duration <= 0) return 0;
+
+	double ret = 0;
+	ret = static_cast<double>(int64(m_FileSize)) / 1024;
+	ret = ret / (m_Duration / 1000000000.0);
+	ret = ret * 8;
+	return static_cast<int32>(ret);
+};
+
+bool MatroskaParser::skip_frames_until(double destination, unsigned /*hint_samplerate*/)
+{
+    return SkipFramesUntil( SecondsToTimecode( destination ) );
+}
+
+bool MatroskaParser::SkipFramesUntil(uint64 timecode)
+{
+    bool have_data = false;
+    while (!have_data)
+    {
+        FinishDecoding();
+        for(FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+        {
+            FrameQueue &track_queue = track->second;
+            while (!track_queue.empty() && track_queue.front().timecode < timecode) RecycleFrame( track_queue.pop_front().release() );
+
+            if (!track_queue.empty()) have_data = true;
+        }
+        RecountQueuedBytes();
+
+        if (!have_data && (FillQueue() > 0)) return false;
+    }
+
+    return true;
+}
+
+bool MatroskaParser::Seek(double seconds, unsigned /*samplerate_hint*/)
+{
+	return SeekTimecode(SecondsToTimecode(seconds));
+}
+
+bool MatroskaParser::SeekTimecode(uint64 timecode)
+{
+	uint64 seekToTimecode = timecode;
+	if (m_CurrentChapter != NULL) {
+		seekToTimecode += m_CurrentChapter->timeStart;
+	}
+
+	m_CurrentTimecode = seekToTimecode;
+
+	// In follow mode, the index would miss the clusters written since it was built.
+	if (!m_Follow && !IsSeekable(*m_IOCallback)) SeekToCluster(seekToTimecode);
+	if (!SkipFramesUntil(seekToTimecode)) return false;
+
+	m_CurrentTimecode = seekToTimecode;
+	return (FillQueue() > 0);
+};
+
+MatroskaFrame * MatroskaParser::ReadSingleFrame( uint16 trackIdx )
 {
     FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
     if (track == m_FrameQueues.end()) return NULL;
@@ -916,22 +1738,102 @@ MatroskaFrame * MatroskaParser::ReadSingleFrame( uint16 trackIdx )
     FrameQueue &track_queue = track->second;
     while (track_queue.empty())
     {
-        if (FillQueue() != 0) return NULL;
+            // In follow mode, a partial cluster can still yield some frames.
+        if (FillQueue() != 0 && track_queue.empty()) return NULL;
     }
 
     if (track_queue.empty()) return NULL;
 
-    return track_queue.pop_front().release();
+    FinishDecoding();
+    MatroskaFrame *frame = track_queue.pop_front().release();
+    LoadDeferredPayload( trackIdx, *frame );
+    UnchargeFrame( trackIdx, *frame );
+    return frame;
 };
 
+    // Discards the queued frames & resumes reading from the cluster holding timecode.
+bool MatroskaParser::SeekToCluster( uint64 timecode )
+{
+    if (m_ClusterIndex.empty() && !BuildClusterIndex()) return false;
+
+    cluster_entry_ptr cluster = FindCluster( timecode );
+    if (!cluster) return false;
+
+    FinishDecoding();
+    DiscardQueuedFrames();
+    m_PendingCluster.reset();
+    m_BlockedBytes = 0;
+    m_Eof = false;
+    m_ReadTimecode = 0;
+    m_IOCallback->setFilePointer( cluster->filePos );
+    return true;
+}
+
+bool MatroskaParser::BuildClusterIndex()
+{
+    if (m_FirstClusterPos == 0) return false;
+
+    std::vector<ClusterLocation> clusters;
+    try {
+        const ReadAtFunction read_at = boost::bind( &MatroskaParser::ReadBytesAt, this, _1, _2, _3 );
+        const uint64 end = FindClusters( read_at, m_FirstClusterPos, m_FileSize, clusters );
+        if (end < m_FileSize) LOG_INFO_S( "MatroskaParser::BuildClusterIndex(): stopped @ " << end << " of " << m_FileSize );
+    } catch (std::exception &e) {
+        LOG_WARN_S( "MatroskaParser::BuildClusterIndex(): " << e.what() );
+        return false;
+    }
+    if (clusters.empty()) return false;
+
+    m_ClusterIndex.clear();
+    m_ClusterIndex.reserve( clusters.size() );
+    for (size_t c = 0; c < clusters.size(); c++) {
+        cluster_entry_ptr entry( new MatroskaMetaSeekClusterEntry() );
+        entry->clusterNo = uint32( c );
+        entry->filePos = clusters[c].filePos;
+        entry->timecode = clusters[c].timecode * m_TimecodeScale;
+        m_ClusterIndex.push_back( entry );
+    }
+    return true;
+}
+
+AsyncReadRequest *MatroskaParser::ReadAhead()
+{
+    IOCallback *callback = m_IOCallback.get();
+    if (BufferedReadCallback *buffered = dynamic_cast< BufferedReadCallback * >( callback )) callback = buffered->GetInner();
+
+    AsyncReadCallback *async = dynamic_cast< AsyncReadCallback * >( callback );
+    if (!async) return NULL;
+
+    return async->ReadAhead( m_PendingCluster ? m_ResumePos : m_IOCallback->getFilePointer() );
+}
+
+int MatroskaParser::ReadCluster()
+{
+    return FillQueue();
+}
+
+uint64 MatroskaParser::GetReadTimecode() const
+{
+    return m_ReadTimecode;
+}
+
+const MatroskaFrame *MatroskaParser::PeekQueuedFrame( uint16 trackIdx ) const
+{
+    FrameQueueMap::const_iterator track = m_FrameQueues.find( trackIdx );
+    if (track == m_FrameQueues.end() || track->second.empty()) return NULL;
+
+    return &track->second.front();
+}
+
 bool MatroskaParser::Restart()
 {
     m_Eof = false;
+    m_ReadTimecode = 0;
     m_CurrentChapter = NULL;
-    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
-    {
-        track->second.clear();
-    }
+    m_PendingCluster.reset();
+    m_BlockedBytes = 0;
+    FinishDecoding();
+    DiscardQueuedFrames();
 
     unsigned int samplerate_hint = 0;   // this value is unused & should probably be removed.
     return Seek( 0.0, samplerate_hint );
@@ -939,28 +1841,560 @@ bool MatroskaParser::Restart()
 
 const MatroskaParser::attachment_list &MatroskaParser::GetAttachmentList() const
 {
+        // Attachments deferred by lazy parsing are parsed now, which is logically const.
+    const_cast< MatroskaParser * >( this )->LoadAttachments();
     return m_AttachmentList;
 }
 
 
 ByteArray MatroskaParser::ReadAttachment( attachment_list::const_iterator attachment )
 {
-    ByteArray result( attachment->SourceDataLength );
-
-    uint64 oldpos = m_IOCallback->getFilePointer();
-    m_IOCallback->setFilePointer( attachment->SourceStartPos );
+    ByteArray result( size_t( attachment->SourceDataLength ) );
+    if (result.empty()) return result;
 
-    uint32 num_read = m_IOCallback->read( &result.front(), attachment->SourceDataLength );
-    if (num_read != attachment->SourceDataLength) throw std::runtime_error(
+    size_t num_read = ReadAttachment( attachment, 0, &result.front(), result.size() );
+    if (num_read != result.size()) throw std::runtime_error(
         boost::str( boost::format( "MatroskaParser::ReadAttachment() got %d bytes instead of %d" )
             % num_read % attachment->SourceDataLength ) );
 
-    m_IOCallback->setFilePointer( oldpos );
-
     return result;
 }
 
 
+size_t MatroskaParser::ReadAttachment(
+    attachment_list::const_iterator attachment, uint64 offset, void *buffer, size_t size )
+{
+    if (offset >= attachment->SourceDataLength) return 0;
+    size = size_t( std::min( uint64( size ), attachment->SourceDataLength - offset ) );
+
+    const uint64 pos = attachment->SourceStartPos + offset;
+    if (m_MemoryBase)
+    {
+        if (pos >= m_FileSize) return 0;
+        size = size_t( std::min( uint64( size ), m_FileSize - pos ) );
+        memcpy( buffer, m_MemoryBase + pos, size );
+        return size;
+    }
+
+    return ReadAt( GetPreadFd(), buffer, size, pos );
+}
+
+
+void MatroskaParser::CopyAttachmentToFd( attachment_list::const_iterator attachment, int fd )
+{
+    if (m_MemoryBase)
+    {
+        if (attachment->SourceStartPos + attachment->SourceDataLength > m_FileSize) throw std::runtime_error(
+            "MatroskaParser::CopyAttachmentToFd() attachment extends past the end of the buffer" );
+
+        WriteAll( fd, m_MemoryBase + attachment->SourceStartPos, size_t( attachment->SourceDataLength ) );
+        return;
+    }
+
+    CopyRange( GetPreadFd(), attachment->SourceStartPos, fd, attachment->SourceDataLength );
+}
+
+
+    // Attachments & cues are read through a descriptor of their own, with positioned
+    // reads, so they neither pass through nor disturb m_IOCallback.
+int MatroskaParser::GetPreadFd()
+{
+    if (m_PreadFd < 0)
+    {
+        m_PreadFd = open( m_filename.c_str(), O_RDONLY | O_CLOEXEC );
+        if (m_PreadFd < 0) throw std::runtime_error(
+            boost::str( boost::format( "MatroskaParser: failed to open %s: %s" )
+                % m_filename % strerror( errno ) ) );
+    }
+
+    return m_PreadFd;
+}
+
+
+size_t MatroskaParser::ReadBytesAt( uint64 pos, void *buffer, size_t size )
+{
+    if (m_MemoryBase)
+    {
+        if (pos >= m_FileSize) return 0;
+        size = size_t( std::min( uint64( size ), m_FileSize - pos ) );
+        memcpy( buffer, m_MemoryBase + pos, size );
+        return size;
+    }
+
+    return ReadAt( GetPreadFd(), buffer, size, pos );
+}
+
+
+    // Reads a whole element, including its header, if it has the expected ID.
+bool MatroskaParser::ReadElementAt( uint64 pos, uint32 id, ByteArray &element )
+{
+    uint8 head_bytes[MaxElementHeadSize];
+    ElementHead head;
+    if (!ReadElementHead( head_bytes, ReadBytesAt( pos, head_bytes, sizeof( head_bytes ) ), head )
+        || head.id != id || head.unknownSize) return false;
+
+    element.resize( size_t( head.headSize + head.size ) );
+    return ReadBytesAt( pos, &element.front(), element.size() ) == element.size();
+}
+
+
+    // Returns the absolute position of the element with the given ID, according to the
+    // SeekHead at seekHeadPos, or 0 if it's not listed.
+uint64 MatroskaParser::FindSeekEntry( uint64 seekHeadPos, uint32 id )
+{
+    ByteArray seekHead;
+    if (!ReadElementAt( seekHeadPos, IdSeekHead, seekHead )) return 0;
+
+    ElementHead head;
+    ReadElementHead( &seekHead.front(), seekHead.size(), head );
+    for (size_t p = head.headSize; p < seekHead.size(); p += head.headSize + size_t( head.size ))
+    {
+        if (!ReadElementHead( &seekHead[p], seekHead.size() - p, head )) break;
+        if (head.id != IdSeek) continue;
+
+        uint32 seekId = 0;
+        uint64 seekPos = 0;
+        const size_t end = std::min( p + head.headSize + size_t( head.size ), seekHead.size() );
+        ElementHead child;
+        for (size_t q = p + head.headSize; q < end; q += child.headSize + size_t( child.size ))
+        {
+            if (!ReadElementHead( &seekHead[q], end - q, child ) || q + child.headSize + child.size > end) break;
+            if (child.id == IdSeekID) seekId = uint32( ReadUInt( &seekHead[q + child.headSize], size_t( child.size ) ) );
+            else if (child.id == IdSeekPosition) seekPos = ReadUInt( &seekHead[q + child.headSize], size_t( child.size ) );
+        }
+
+        if (seekId == id) return static_cast<KaxSegment *>(m_ElementLevel0.get())->GetGlobalPosition( seekPos );
+    }
+
+    return 0;
+}
+
+
+static bool CuePointIsEarlier( const MatroskaCuePoint &a, const MatroskaCuePoint &b )
+{
+    return a.timecode < b.timecode;
+}
+
+bool MatroskaParser::LoadCues()
+{
+    if (m_CuesLoaded) return !m_CuePoints.empty();
+    m_CuesLoaded = true;
+
+    if (!m_ElementLevel0) return false;
+    if (m_CuesPos == 0 && m_SeekHeadPos != 0) m_CuesPos = FindSeekEntry( m_SeekHeadPos, IdCues );
+    if (m_CuesPos == 0) return false;
+
+    ByteArray cues;
+    try
+    {
+        if (!ReadElementAt( m_CuesPos, IdCues, cues )) return false;
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN_S( "MatroskaParser::LoadCues(): " << e.what() );
+        return false;
+    }
+
+    KaxSegment &segment = *static_cast<KaxSegment *>(m_ElementLevel0.get());
+    ElementHead head;
+    ReadElementHead( &cues.front(), cues.size(), head );
+    for (size_t p = head.headSize; p < cues.size(); p += head.headSize + size_t( head.size ))
+    {
+        if (!ReadElementHead( &cues[p], cues.size() - p, head )) break;
+        if (head.id != IdCuePoint) continue;
+
+        // A CuePoint has one CueTime, then a CueTrackPositions per track.
+        const size_t pointEnd = std::min( p + head.headSize + size_t( head.size ), cues.size() );
+        uint64 cueTime = 0;
+        ElementHead child;
+        for (size_t q = p + head.headSize; q < pointEnd; q += child.headSize + size_t( child.size ))
+        {
+            if (!ReadElementHead( &cues[q], pointEnd - q, child ) || q + child.headSize + child.size > pointEnd) break;
+            const uint8 *data = &cues[q + child.headSize];
+            if (child.id == IdCueTime) cueTime = ReadUInt( data, size_t( child.size ) );
+            else if (child.id == IdCueTrackPositions)
+            {
+                MatroskaCuePoint cuePoint = { cueTime * m_TimecodeScale, 0, 0, 0 };
+                ElementHead position;
+                for (size_t r = 0; r < child.size; r += position.headSize + size_t( position.size ))
+                {
+                    if (!ReadElementHead( data + r, size_t( child.size ) - r, position )
+                        || r + position.headSize + position.size > child.size) break;
+                    const uint8 *value = data + r + position.headSize;
+                    if (position.id == IdCueTrack) cuePoint.trackNumber = uint16( ReadUInt( value, size_t( position.size ) ) );
+                    else if (position.id == IdCueClusterPosition) cuePoint.clusterPos = segment.GetGlobalPosition( ReadUInt( value, size_t( position.size ) ) );
+                    else if (position.id == IdCueRelativePosition) cuePoint.relativePos = ReadUInt( value, size_t( position.size ) );
+                }
+                m_CuePoints.push_back( cuePoint );
+            }
+        }
+    }
+
+    std::stable_sort( m_CuePoints.begin(), m_CuePoints.end(), CuePointIsEarlier );
+    LOG_INFO_S( "MatroskaParser::LoadCues(): loaded " << m_CuePoints.size() << " cue points" );
+    return !m_CuePoints.empty();
+}
+
+
+bool MatroskaParser::SeekKeyframe( uint64 timecode, std::vector<KeyframeSeekPoint> &keyframes )
+{
+    keyframes.clear();
+    if (m_CurrentChapter != NULL) timecode += m_CurrentChapter->timeStart;
+
+    std::vector<uint16> videoTracks;
+    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        if (m_Tracks.at( track->first ).trackType == track_video) videoTracks.push_back( uint16( track->first ) );
+    }
+
+    // Start from the earliest cluster holding the last cued keyframe of any video track.
+    // Without cues for all of them, start from the cluster holding the target (or the
+    // last indexed keyframe before it, if earlier), and step back a cluster at a time,
+    // 'til every video track has a keyframe to start from.
+    uint64 startPos = FindCuedKeyframes( timecode, videoTracks );
+    size_t clusterNo = TrackIndex::npos;
+    if (startPos == 0)
+    {
+        if (m_ClusterIndex.empty() && !BuildClusterIndex()) return false;
+        clusterNo = FindKeyframeCluster( timecode, videoTracks );
+        startPos = m_ClusterIndex[clusterNo]->filePos;
+    }
+
+    bool reached = ReadKeyframesFrom( startPos, timecode, videoTracks );
+    while (clusterNo != TrackIndex::npos && clusterNo > 0 && !HasKeyframesAt( timecode, videoTracks ))
+    {
+        clusterNo--;
+        reached = ReadKeyframesFrom( m_ClusterIndex[clusterNo]->filePos, timecode, videoTracks );
+    }
+
+    for (size_t v = 0; v < videoTracks.size(); v++)
+    {
+        const FrameQueue &queue = m_FrameQueues[videoTracks[v]];
+        if (queue.empty()) continue;
+
+        KeyframeSeekPoint point = { videoTracks[v], queue.front().timecode };
+        keyframes.push_back( point );
+    }
+
+    return reached;
+}
+
+
+    // Returns the earliest cluster holding the last cued keyframe, at or before timecode,
+    // of any of videoTracks, or 0, if one of them has none.
+uint64 MatroskaParser::FindCuedKeyframes( uint64 timecode, const std::vector<uint16> &videoTracks )
+{
+    if (videoTracks.empty() || !LoadCues()) return 0;
+
+    const MatroskaCuePoint target = { timecode, 0, 0, 0 };
+    const std::vector<MatroskaCuePoint>::const_iterator end =
+        std::upper_bound( m_CuePoints.begin(), m_CuePoints.end(), target, CuePointIsEarlier );
+
+    uint64 cuedPos = MAX_UINT64;
+    for (size_t v = 0; v < videoTracks.size(); v++)
+    {
+        const uint16 trackNumber = m_Tracks[videoTracks[v]].trackNumber;
+        std::vector<MatroskaCuePoint>::const_iterator cue = end;
+        while (cue != m_CuePoints.begin() && (cue - 1)->trackNumber != trackNumber) --cue;
+        if (cue == m_CuePoints.begin()) return 0;
+
+        cuedPos = std::min( cuedPos, (cue - 1)->clusterPos );
+    }
+    return cuedPos;
+}
+
+
+static bool ClusterIsAfter( uint64 filePos, const cluster_entry_ptr &cluster )
+{
+    return filePos < cluster->filePos;
+}
+
+    // Returns the number of the cluster holding timecode, or, if earlier, the one holding
+    // the last keyframe before it of any of videoTracks that has a frame index.
+size_t MatroskaParser::FindKeyframeCluster( uint64 timecode, const std::vector<uint16> &videoTracks )
+{
+    cluster_entry_ptr cluster = FindCluster( timecode );
+    size_t clusterNo = cluster ? size_t( cluster->clusterNo ) : m_ClusterIndex.size() - 1;
+    for (size_t v = 0; v < videoTracks.size(); v++)
+    {
+        const TrackIndex *index = GetFrameIndex( videoTracks[v] );
+        const size_t frame = index ? index->FindFrame( timecode ) : TrackIndex::npos;
+        const size_t keyframe = (frame != TrackIndex::npos) ? index->FindKeyframe( frame ) : TrackIndex::npos;
+        if (keyframe == TrackIndex::npos) continue;
+
+        const uint64 filePos = index->GetFrame( keyframe ).filePos;
+        const std::vector<cluster_entry_ptr>::const_iterator next =
+            std::upper_bound( m_ClusterIndex.begin(), m_ClusterIndex.end(), filePos, ClusterIsAfter );
+        if (next != m_ClusterIndex.begin()) clusterNo = std::min( clusterNo, size_t( next - m_ClusterIndex.begin() ) - 1 );
+    }
+    return clusterNo;
+}
+
+
+    // Whether each of videoTracks has a keyframe at or before timecode at the front of
+    // its queue, after ReadKeyframesFrom().
+bool MatroskaParser::HasKeyframesAt( uint64 timecode, const std::vector<uint16> &videoTracks )
+{
+    for (size_t v = 0; v < videoTracks.size(); v++)
+    {
+        const FrameQueue &queue = m_FrameQueues[videoTracks[v]];
+        if (queue.empty() || !queue.front().keyframe || queue.front().timecode > timecode) return false;
+    }
+    return true;
+}
+
+
+    // Discards the queued frames, then reads from startPos until every video track (or,
+    // if none, every track) has reached timecode.
+bool MatroskaParser::ReadKeyframesFrom( uint64 startPos, uint64 timecode, const std::vector<uint16> &videoTracks )
+{
+    FinishDecoding();
+    DiscardQueuedFrames();
+    m_PendingCluster.reset();
+    m_BlockedBytes = 0;
+    m_Eof = false;
+    m_ReadTimecode = 0;
+    m_CurrentTimecode = timecode;
+    m_IOCallback->setFilePointer( startPos );
+
+    // Read until every video track (or, if none, every track) has reached the target,
+    // discarding what can't be decoded, as we go.  The GOP must fit in the queue, so
+    // its limits are lifted in the meantime.
+    const uint32 maxQueueDepth = m_MaxQueueDepth;
+    m_MaxQueueDepth = 0;
+    const uint64 byteBudget = m_ByteBudget;
+    m_ByteBudget = 0;
+    std::map<uint16, uint64> trackByteBudgets;
+    trackByteBudgets.swap( m_TrackByteBudgets );
+    bool reached = false;
+    while (!reached)
+    {
+        const int result = FillQueue();
+        FinishDecoding();
+        PruneForPreroll( timecode );
+
+        reached = true;
+        for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+        {
+            if (!videoTracks.empty() && m_Tracks[track->first].trackType != track_video) continue;
+            if (track->second.empty() || track->second.back().timecode < timecode) reached = false;
+        }
+        if (result != 0) break;
+    }
+    m_MaxQueueDepth = maxQueueDepth;
+    m_ByteBudget = byteBudget;
+    m_TrackByteBudgets.swap( trackByteBudgets );
+
+    return reached;
+}
+
+
+    // Drops queued frames that precede timecode, except those of video tracks from their
+    // last keyframe at or before it, which are marked as preroll.
+void MatroskaParser::PruneForPreroll( uint64 timecode )
+{
+    for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
+    {
+        FrameQueue &queue = track->second;
+        if (m_Tracks[track->first].trackType != track_video)
+        {
+            while (!queue.empty() && queue.front().timecode < timecode) RecycleFrame( queue.pop_front().release() );
+            continue;
+        }
+
+        size_t keep = 0;
+        bool haveKeyframe = false;
+        for (size_t i = 0; i < queue.size() && queue[i].timecode <= timecode; i++)
+        {
+            if (queue[i].keyframe)
+            {
+                keep = i;
+                haveKeyframe = true;
+            }
+        }
+
+        // Without a keyframe, nothing before the target can be decoded.
+        if (!haveKeyframe)
+        {
+            while (!queue.empty() && queue.front().timecode < timecode) RecycleFrame( queue.pop_front().release() );
+        }
+        else for (; keep > 0; keep--) RecycleFrame( queue.pop_front().release() );
+
+        for (FrameQueue::iterator frame = queue.begin(); frame != queue.end() && frame->timecode < timecode; ++frame)
+        {
+            frame->preroll = true;
+        }
+    }
+    RecountQueuedBytes();
+}
+
+
+bool MatroskaParser::DescribeBlock( const BlockScanCallback &callback, const BlockDescriptor &block ) const
+{
+    const uint16 trackIdx = FindTrack( uint16( block.header.trackNum ) );
+    if (trackIdx == 0xffff) return true;
+
+    MatroskaBlockInfo info;
+    info.trackIdx = trackIdx;
+    info.timecode = ScaleTrackTimecode( trackIdx, uint64( std::max( block.timecode, int64( 0 ) ) ) * m_TimecodeScale );
+    info.duration = (block.duration != 0)
+        ? ScaleTrackTimecode( trackIdx, block.duration * m_TimecodeScale )
+        : m_Tracks[trackIdx].defaultDuration * block.header.numLaces;
+    info.keyframe = block.keyframe;
+    info.numLaces = block.header.numLaces;
+    info.filePos = block.filePos;
+    info.size = block.size;
+    return callback( info );
+}
+
+
+bool MatroskaParser::ScanBlocks( const BlockScanCallback &callback )
+{
+    if (m_FirstClusterPos == 0) return false;
+
+    try {
+        const ReadAtFunction read_at = boost::bind( &MatroskaParser::ReadBytesAt, this, _1, _2, _3 );
+        std::vector<ClusterLocation> clusters;
+        FindClusters( read_at, m_FirstClusterPos, m_FileSize, clusters );
+
+        const BlockDescriptorFunction describe = boost::bind( &MatroskaParser::DescribeBlock, this, boost::cref( callback ), _1 );
+        for (std::vector<ClusterLocation>::const_iterator cluster = clusters.begin(); cluster != clusters.end(); ++cluster) {
+            if (!ScanClusterBlocks( read_at, *cluster, describe )) break;
+        }
+    } catch (std::exception &e) {
+        LOG_WARN_S( "MatroskaParser::ScanBlocks(): " << e.what() );
+        return false;
+    }
+
+    return true;
+}
+
+
+bool MatroskaParser::IndexBlock( FrameIndexMap &indexes, const MatroskaBlockInfo &block ) const
+{
+    FrameLocation location;
+    location.timecode = block.timecode;
+    location.filePos = block.filePos;
+    location.size = uint32( block.size );
+    location.keyframe = block.keyframe;
+    indexes[block.trackIdx].Append( location );
+    return true;
+}
+
+
+bool MatroskaParser::BuildFrameIndexes()
+{
+    FrameIndexMap indexes;
+    if (!ScanBlocks( boost::bind( &MatroskaParser::IndexBlock, this, boost::ref( indexes ), _1 ) )) return false;
+
+    for (FrameIndexMap::iterator index = indexes.begin(); index != indexes.end(); ++index) index->second.Compact();
+    m_FrameIndexes.swap( indexes );
+    return true;
+}
+
+
+bool MatroskaParser::LoadFrameIndexesFromCues()
+{
+    if (!LoadCues()) return false;
+
+    FrameIndexMap indexes;
+    for (std::vector<MatroskaCuePoint>::const_iterator cue = m_CuePoints.begin(); cue != m_CuePoints.end(); ++cue) {
+        const uint16 trackIdx = FindTrack( cue->trackNumber );
+        if (trackIdx == 0xffff) continue;
+
+        // Without CueRelativePosition, this points at the cluster.
+        FrameLocation location;
+        location.timecode = cue->timecode;
+        location.filePos = cue->clusterPos;
+        location.size = 0;
+        location.keyframe = true;
+        if (cue->relativePos != 0) {
+            uint8 headBytes[MaxElementHeadSize];
+            ElementHead head;
+            if (ReadElementHead( headBytes, ReadBytesAt( cue->clusterPos, headBytes, sizeof( headBytes ) ), head ))
+                location.filePos += head.headSize + cue->relativePos;
+        }
+
+        TrackIndex &index = indexes[trackIdx];
+        index.SetKeyframesOnly( true );
+        index.Append( location );
+    }
+
+    for (FrameIndexMap::iterator index = indexes.begin(); index != indexes.end(); ++index) index->second.Compact();
+    m_FrameIndexes.swap( indexes );
+    return true;
+}
+
+
+static const char FrameIndexMagic[8] = { 'M', 'K', 'V', 'I', 'D', 'X', '0', '1' };
+
+bool MatroskaParser::SaveFrameIndexes( const char *filename ) const
+{
+    std::ofstream out( filename, std::ios::binary | std::ios::trunc );
+    out.write( FrameIndexMagic, sizeof( FrameIndexMagic ) );
+
+    // Indexes are keyed by track number & file size, so they can't be applied to the wrong file.
+    const uint64 fileSize = m_FileSize;
+    const uint32 numIndexes = uint32( m_FrameIndexes.size() );
+    out.write( reinterpret_cast<const char *>( &fileSize ), sizeof( fileSize ) );
+    out.write( reinterpret_cast<const char *>( &numIndexes ), sizeof( numIndexes ) );
+    for (FrameIndexMap::const_iterator index = m_FrameIndexes.begin(); index != m_FrameIndexes.end(); ++index) {
+        const uint16 trackNum = m_Tracks.at( index->first ).trackNumber;
+        out.write( reinterpret_cast<const char *>( &trackNum ), sizeof( trackNum ) );
+        index->second.Write( out );
+    }
+
+    return !!out;
+}
+
+
+bool MatroskaParser::LoadFrameIndexes( const char *filename )
+{
+    std::ifstream in( filename, std::ios::binary );
+    char magic[sizeof( FrameIndexMagic )];
+    uint64 fileSize = 0;
+    uint32 numIndexes = 0;
+    if (!in.read( magic, sizeof( magic ) ) || memcmp( magic, FrameIndexMagic, sizeof( magic ) ) != 0
+        || !in.read( reinterpret_cast<char *>( &fileSize ), sizeof( fileSize ) )
+        || !in.read( reinterpret_cast<char *>( &numIndexes ), sizeof( numIndexes ) )) return false;
+
+    if (fileSize != m_FileSize) {
+        LOG_WARN_S( "MatroskaParser::LoadFrameIndexes(): " << filename << " is for a file of a different size" );
+        return false;
+    }
+
+    FrameIndexMap indexes;
+    for (uint32 i = 0; i < numIndexes; i++) {
+        uint16 trackNum = 0;
+        if (!in.read( reinterpret_cast<char *>( &trackNum ), sizeof( trackNum ) )) return false;
+
+        const uint16 trackIdx = FindTrack( trackNum );
+        if (trackIdx == 0xffff || !indexes[trackIdx].Read( in )) return false;
+    }
+
+    m_FrameIndexes.swap( indexes );
+    return true;
+}
+
+
+const TrackIndex *MatroskaParser::GetFrameIndex( uint16 trackIdx ) const
+{
+    FrameIndexMap::const_iterator index = m_FrameIndexes.find( trackIdx );
+    return (index == m_FrameIndexes.end()) ? NULL : &index->second;
+}
+
+
+bool MatroskaParser::GetIoStats( IoStats &requested, IoStats &issued ) const
+{
+    const BufferedReadCallback *buffered = dynamic_cast< const BufferedReadCallback * >( m_IOCallback.get() );
+    if (!buffered) return false;
+
+    requested = buffered->GetStats();
+    issued = buffered->GetInnerStats();
+    return true;
+}
+
+
 bool MatroskaParser::IsEof() const
 {
     return m_Eof;
@@ -993,6 +2427,86 @@ std::ostream &operator<<( std::ostream &os, const EbmlIdPrinter &idp )
     return os;
 }
 
+void MatroskaParser::Parse_Attachments(ElementPtr ElementLevel1, int &UpperElementLevel, ElementPtr &ElementLevel2)
+{
+	ElementPtr ElementLevel3;
+	ElementPtr ElementLevel4;
+	ElementPtr NullElement;
+
+	ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
+	while (ElementLevel2 != NullElement) {
+		if (UpperElementLevel > 0) {
+			break;
+		}
+		if (UpperElementLevel < 0) {
+			UpperElementLevel = 0;
+		}
+		if (EbmlId(*ElementLevel2) == KaxAttached::ClassInfos.GlobalId) {
+			// We actually found a attached file entry :D
+			MatroskaAttachment newAttachment;
+
+			ElementLevel3 = ElementPtr(m_InputStream->FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
+			while (ElementLevel3 != NullElement) {
+				if (UpperElementLevel > 0) {
+					break;
+				}
+				if (UpperElementLevel < 0) {
+					UpperElementLevel = 0;
+				}
+
+				// Now evaluate the data belonging to this track
+				if (EbmlId(*ElementLevel3) == KaxFileName::ClassInfos.GlobalId) {
+					KaxFileName &attached_filename = *static_cast<KaxFileName *>(ElementLevel3.get());
+					attached_filename.ReadData(m_InputStream->I_O());
+					newAttachment.FileName = UTFstring(attached_filename);
+
+				} else if (EbmlId(*ElementLevel3) == KaxMimeType::ClassInfos.GlobalId) {
+					KaxMimeType &attached_mime_type = *static_cast<KaxMimeType *>(ElementLevel3.get());
+					attached_mime_type.ReadData(m_InputStream->I_O());
+					newAttachment.MimeType = std::string(attached_mime_type);
+
+				} else if (EbmlId(*ElementLevel3) == KaxFileDescription::ClassInfos.GlobalId) {
+					KaxFileDescription &attached_description = *static_cast<KaxFileDescription *>(ElementLevel3.get());
+					attached_description.ReadData(m_InputStream->I_O());
+					newAttachment.Description = UTFstring(attached_description);
+
+				} else if (EbmlId(*ElementLevel3) == KaxFileData::ClassInfos.GlobalId) {
+					KaxFileData &attached_data = *static_cast<KaxFileData *>(ElementLevel3.get());
+
+					//We don't what to read the data into memory because it could be very large
+					//attached_data.ReadData(m_InputStream->I_O());
+
+					//Instead we store the Matroska filename, the start of the data and the length, so we can read it
+					//later at the users request. IMHO This will save a lot of memory
+					newAttachment.SourceStartPos = attached_data.GetElementPosition() + attached_data.HeadSize();
+					newAttachment.SourceDataLength = attached_data.GetSize();
+				}
+
+				if (UpperElementLevel > 0) {	// we're coming from ElementLevel4
+					UpperElementLevel--;
+					ElementLevel3 = ElementLevel4;
+					if (UpperElementLevel > 0)
+						break;
+				} else {
+					ElementLevel3->SkipData(*m_InputStream, ElementLevel3->Generic().Context);
+					ElementLevel3 = ElementPtr(m_InputStream->FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
+				}					
+			} // while (ElementLevel3 != NULL)
+			m_AttachmentList.push_back(newAttachment);
+		}
+
+		if (UpperElementLevel > 0) {	// we're coming from ElementLevel3
+			UpperElementLevel--;
+			ElementLevel2 = ElementLevel3;
+			if (UpperElementLevel > 0)
+				break;
+		} else {
+			ElementLevel2->SkipData(*m_InputStream, ElementLevel2->Generic().Context);
+			ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, true, 1));
+		}
+	} // while (ElementLevel2 != NULL)
+}
+
 void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly) 
 {
 //    TIMER;
@@ -1006,7 +2520,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 	if (metaSeekElement == NullElement)
 		return;
 
-	l2 = ElementPtr(m_InputStream.FindNextElement(metaSeekElement->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+	l2 = ElementPtr(m_InputStream->FindNextElement(metaSeekElement->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 	while (l2 != NullElement) {
 		if (UpperElementLevel > 0) {
             LOG_DEBUG_S( "MatroskaParser::Parse_MetaSeek(): UpperElementLevel = " << UpperElementLevel );
@@ -1021,7 +2535,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 
 		if (EbmlId(*l2) == KaxSeek::ClassInfos.GlobalId) {
 			//Wow we found the SeekEntries, time to speed up reading ;)
-			l3 = ElementPtr(m_InputStream.FindNextElement(l2->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+			l3 = ElementPtr(m_InputStream->FindNextElement(l2->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 
 			EbmlIdPtr id;
 			while (l3 != NullElement) {
@@ -1039,7 +2553,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 					binary *b = NULL;
 					uint16 s = 0;
 					KaxSeekID &seek_id = static_cast<KaxSeekID &>(*l3);
-					seek_id.ReadData(m_InputStream.I_O(), SCOPE_ALL_DATA);
+					seek_id.ReadData(m_InputStream->I_O(), SCOPE_ALL_DATA);
 					b = seek_id.GetBuffer();
 					s = (uint16)seek_id.GetSize();
                     id.reset();
@@ -1048,7 +2562,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 
 				} else if (EbmlId(*l3) == KaxSeekPosition::ClassInfos.GlobalId) {
 					KaxSeekPosition &seek_pos = static_cast<KaxSeekPosition &>(*l3);
-					seek_pos.ReadData(m_InputStream.I_O());				
+					seek_pos.ReadData(m_InputStream->I_O());				
 					lastSeekPos = uint64(seek_pos);
 					if (endSeekPos < lastSeekPos)
 						endSeekPos = uint64(seek_pos);
@@ -1058,6 +2572,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 						//uint64 orig_pos = inputFile.getFilePointer();
 						//MatroskaMetaSeekClusterEntry newCluster;
                         cluster_entry_ptr newCluster(new MatroskaMetaSeekClusterEntry());
+						newCluster->clusterNo = uint32(m_ClusterIndex.size());
 						newCluster->timecode = MAX_UINT64;
 						newCluster->filePos = static_cast<KaxSegment *>(m_ElementLevel0.get())->GetGlobalPosition(lastSeekPos);
 						m_ClusterIndex.push_back(newCluster);
@@ -1068,7 +2583,7 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 						uint64 orig_pos = m_IOCallback->getFilePointer();
 						m_IOCallback->setFilePointer(static_cast<KaxSegment *>(m_ElementLevel0.get())->GetGlobalPosition(lastSeekPos));
 						
-						ElementPtr levelUnknown = ElementPtr(m_InputStream.FindNextID(KaxSeekHead::ClassInfos, 0xFFFFFFFFFFFFFFFFL));										
+						ElementPtr levelUnknown = ElementPtr(m_InputStream->FindNextID(KaxSeekHead::ClassInfos, 0xFFFFFFFFFFFFFFFFL));										
 						Parse_MetaSeek(levelUnknown, bInfoOnly);
 
 						m_IOCallback->setFilePointer(orig_pos);
@@ -1077,8 +2592,8 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 				} else {
 
 				}
-				l3->SkipData(m_InputStream, l3->Generic().Context);
-				l3 = ElementPtr(m_InputStream.FindNextElement(l2->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+				l3->SkipData(*m_InputStream, l3->Generic().Context);
+				l3 = ElementPtr(m_InputStream->FindNextElement(l2->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 			}
 		} else {
 
@@ -1091,8 +2606,8 @@ void MatroskaParser::Parse_MetaSeek(ElementPtr metaSeekElement, bool bInfoOnly)
 				break;
 
 		} else {
-			l2->SkipData(m_InputStream, l2->Generic().Context);
-			l2 = ElementPtr(m_InputStream.FindNextElement(metaSeekElement->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
+			l2->SkipData(*m_InputStream, l2->Generic().Context);
+			l2 = ElementPtr(m_InputStream->FindNextElement(metaSeekElement->Generic().Context, UpperElementLevel, 0xFFFFFFFFFFFFFFFFL, true, 1));
 		}
 	}
 //    _TIMER("Parse_MetaSeek");
@@ -1186,8 +2701,10 @@ void MatroskaParser::Parse_Chapter_Atom(KaxChapterAtom *ChapterAtom, std::vector
 			Parse_Chapter_Atom((KaxChapterAtom *)Element, newChapter.subChapters);
 		}
 	}
-	if ((newChapter.chapterUID != 0) && !FindChapterUID(newChapter.chapterUID))
+	if ((newChapter.chapterUID != 0) && !FindChapterUID(newChapter.chapterUID)) {
+		m_ChapterUIDs.insert(newChapter.chapterUID);
 		p_chapters.push_back(newChapter);
+	}
 }
 
 void MatroskaParser::Parse_Chapters(KaxChapters *chaptersElement)
@@ -1200,7 +2717,7 @@ void MatroskaParser::Parse_Chapters(KaxChapters *chaptersElement)
 	if (chaptersElement == NULL)
 		return;
 
-	chaptersElement->Read(m_InputStream, KaxChapters::ClassInfos.Context,
+	chaptersElement->Read(*m_InputStream, KaxChapters::ClassInfos.Context,
 		UpperEltFound, Element, true);
 
 	for (uint32 i = 0; i < chaptersElement->ListSize(); i++)
@@ -1225,11 +2742,14 @@ void MatroskaParser::Parse_Chapters(KaxChapters *chaptersElement)
 					Parse_Chapter_Atom((KaxChapterAtom *)Element);
 				}
 			}
-			if ((newEdition.editionUID != 0) && !FindEditionUID(newEdition.editionUID))
+			if ((newEdition.editionUID != 0) && !FindEditionUID(newEdition.editionUID)) {
+				m_EditionUIDs.insert(newEdition.editionUID);
 				m_Editions.push_back(newEdition);
+			}
 		}
 	}
 	FixChapterEndTimes();
+	IndexChapters();
 }
 
 void MatroskaParser::Parse_Tags(KaxTags *tagsElement)
@@ -1243,7 +2763,7 @@ void MatroskaParser::Parse_Tags(KaxTags *tagsElement)
 	m_TagPos = tagsElement->GetElementPosition();
 	m_TagSize = (uint32) tagsElement->GetSize();
 
-	tagsElement->Read(m_InputStream, KaxTags::ClassInfos.Context, UpperEltFound, Element, true);
+	tagsElement->Read(*m_InputStream, KaxTags::ClassInfos.Context, UpperEltFound, Element, true);
 
 	for (uint32 i = 0; i < tagsElement->ListSize(); i++)
 	{
@@ -1339,9 +2859,244 @@ void MatroskaParser::Parse_Tags(KaxTags *tagsElement)
 			m_Tags.push_back(newTag);
 		}
 	}
+	IndexTags();
 };
 
 
+static bool EncodingDecodesFirst(const MatroskaContentEncoding &a, const MatroskaContentEncoding &b)
+{
+	return a.order > b.order;
+}
+
+void MatroskaParser::Parse_ContentEncodings(KaxContentEncodings &encodingsElement, MatroskaTrackInfo &track)
+{
+	for (uint32 Index0 = 0; Index0 < encodingsElement.ListSize(); Index0++) {
+		if (!(encodingsElement[Index0]->Generic().GlobalId == KaxContentEncoding::ClassInfos.GlobalId))
+			continue;
+
+		KaxContentEncoding &encodingElement = *static_cast<KaxContentEncoding *>(encodingsElement[Index0]);
+		MatroskaContentEncoding newEncoding;
+		for (uint32 Index1 = 0; Index1 < encodingElement.ListSize(); Index1++) {
+			EbmlElement *Element = encodingElement[Index1];
+			if (Element->Generic().GlobalId == KaxContentEncodingOrder::ClassInfos.GlobalId) {
+				newEncoding.order = uint64(*static_cast<KaxContentEncodingOrder *>(Element));
+
+			} else if (Element->Generic().GlobalId == KaxContentEncodingScope::ClassInfos.GlobalId) {
+				newEncoding.scope = uint64(*static_cast<KaxContentEncodingScope *>(Element));
+
+			} else if (Element->Generic().GlobalId == KaxContentEncodingType::ClassInfos.GlobalId) {
+				newEncoding.type = uint64(*static_cast<KaxContentEncodingType *>(Element));
+
+			} else if (Element->Generic().GlobalId == KaxContentCompression::ClassInfos.GlobalId) {
+				KaxContentCompression &compression = *static_cast<KaxContentCompression *>(Element);
+				for (uint32 Index2 = 0; Index2 < compression.ListSize(); Index2++) {
+					if (compression[Index2]->Generic().GlobalId == KaxContentCompAlgo::ClassInfos.GlobalId) {
+						newEncoding.compAlgo = uint64(*static_cast<KaxContentCompAlgo *>(compression[Index2]));
+
+					} else if (compression[Index2]->Generic().GlobalId == KaxContentCompSettings::ClassInfos.GlobalId) {
+						KaxContentCompSettings &settings = *static_cast<KaxContentCompSettings *>(compression[Index2]);
+						newEncoding.compSettings.assign(settings.GetBuffer(), settings.GetBuffer() + settings.GetSize());
+					}
+				}
+			}
+		}
+		track.contentEncodings.push_back(newEncoding);
+	}
+
+	// Encodings were applied in increasing order, so they're undone in decreasing order.
+	std::stable_sort(track.contentEncodings.begin(), track.contentEncodings.end(), EncodingDecodesFirst);
+
+	if (!IsDecodable(track)) {
+		LOG_WARN_S("MatroskaParser::Parse(): track " << track.trackNumber << " uses unsupported content encodings");
+	}
+}
+
+
+uint16 MatroskaParser::ReadBlock(KaxInternalBlock &DataBlock, KaxCluster &SegmentCluster, MatroskaFrame &frame)
+{
+	// With an in-memory source, we only need the block header & the location of each lace.
+	// The same goes for frames whose payloads may be deferred, which depends on the track.
+	const bool partial = m_MemoryBase || MayDeferPayloads();
+	DataBlock.ReadData(m_InputStream->I_O(), partial ? SCOPE_PARTIAL_DATA : SCOPE_ALL_DATA);
+	DataBlock.SetParent(SegmentCluster);
+
+	//NOTE4("Track # %u / %u frame%s / Timecode %I64d", DataBlock.TrackNum(), DataBlock.NumberFrames(), (DataBlock.NumberFrames() > 1)?"s":"", DataBlock.GlobalTimecode()/m_TimecodeScale);
+	uint16 trackNum = DataBlock.TrackNum();
+	if (!TrackNumIsEnabled( trackNum )) return 0xffff;
+
+	uint16 trackIdx = FindTrack( trackNum );
+	const MatroskaTrackInfo &track = m_Tracks[trackIdx];
+
+	frame.timecode = ScaleTrackTimecode(trackIdx, DataBlock.GlobalTimecode());
+
+	// If the evil lacing has been used, this covers all of the laces.
+	const uint32 numLaces = DataBlock.NumberFrames();
+	frame.duration = track.defaultDuration * numLaces;
+
+	if (m_MemoryBase) {
+		frame.dataViews.resize(numLaces);
+		for (uint32 f = 0; f < numLaces; f++) {
+			frame.dataViews[f] = PayloadView(m_MemoryBase + DataBlock.GetDataPosition(f), size_t(DataBlock.GetFrameSize(f)));
+		}
+		frame.dataOwner = m_MemoryOwner;
+	} else if (partial) {
+		frame.deferredLaces.resize(numLaces);
+		for (uint32 f = 0; f < numLaces; f++) {
+			frame.deferredLaces[f] = PayloadLocation(DataBlock.GetDataPosition(f), size_t(DataBlock.GetFrameSize(f)));
+		}
+		// Only the header's been read, so a payload that's wanted now is read just once.
+		if (!ShouldDeferPayload(trackIdx)) ReadPayload(frame);
+	} else {
+		frame.dataBuffer.resize(numLaces);
+		for (uint32 f = 0; f < numLaces; f++) {
+			DataBuffer &buffer = DataBlock.GetBuffer(f);
+			m_BufferPool->Acquire(frame.dataBuffer[f]);
+			frame.dataBuffer[f].assign(buffer.Buffer(), buffer.Buffer() + buffer.Size());
+		}
+	}
+
+	return trackIdx;
+}
+
+
+uint64 MatroskaParser::ScaleTrackTimecode(uint16 trackIdx, uint64 timecode) const
+{
+	if (trackIdx >= m_Tracks.size()) return timecode;
+
+	const Rational &scale = m_Tracks[trackIdx].timecodeScale;
+	return scale.IsOne() ? timecode : MulDiv(timecode, scale.num, scale.den);
+}
+
+
+// Queues the frame read from a block at blockPos, in cluster, unless it's over the byte
+// budgets, in which case the block is left to be read again, once there's room for it.
+// \return -1 if it's over budget, otherwise 0.
+int MatroskaParser::QueueBlockFrame(MatroskaFrame *newFrame, uint16 trackIdx, ElementPtr cluster, uint64 blockPos)
+{
+	FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
+	if (track == m_FrameQueues.end() || (newFrame->get_lace_count() == 0 && newFrame->deferredLaces.empty()))
+	{
+		RecycleFrame( newFrame );
+		return 0;
+	}
+
+	// Budgets are charged the decoded size, so decode before checking them.
+	const MatroskaTrackInfo &trackInfo = m_Tracks[trackIdx];
+	const bool decoded = HasByteBudgets() && newFrame->deferredLaces.empty() && EncodesFrames( trackInfo );
+	if (decoded && !DecodeFrame( trackInfo.contentEncodings, *newFrame, *m_BufferPool ))
+	{
+		LOG_WARN_S( "MatroskaParser::FillQueue(): failed to decode frame of track " << trackInfo.trackNumber << " at " << newFrame->timecode );
+	}
+
+	const uint64 frameBytes = GetFrameBytes( *newFrame );
+	if (!MakeRoom( trackIdx, frameBytes ))
+	{
+		// Leave the block in the file, 'til there's room for it.
+		RecycleFrame( newFrame );
+		m_PendingCluster = cluster;
+		m_ResumePos = blockPos;
+		m_BlockedTrack = trackIdx;
+		m_BlockedBytes = frameBytes;
+		LOG_DEBUG_S( "MatroskaParser::FillQueue(): trackIdx " << trackIdx << " is over budget, by " << frameBytes << " bytes." );
+		return -1;
+	}
+
+	QueueFrame( newFrame, trackIdx, track->second, decoded );
+	return 0;
+}
+
+
+MatroskaFrame *MatroskaParser::QueueFrame(MatroskaFrame *frame, uint16 trackIdx, FrameQueue &queue, bool decoded)
+{
+	// Deferred payloads are decoded once they're read.
+	const bool deferred = !frame->deferredLaces.empty();
+	const size_t numLaces = deferred ? frame->deferredLaces.size() : frame->get_lace_count();
+	if (!m_SplitLaces || numLaces < 2) {
+		ChargeFrame(trackIdx, *frame);
+		queue.push_back(frame);
+		if (!deferred && !decoded) DecodeQueuedFrame(trackIdx, *frame);
+		return frame;
+	}
+
+	// Laces held in dataBuffer are each moved into a frame of their own.  Views
+	// are shared with the block's frame, which stays alive as long as any of them.
+	boost::shared_ptr<MatroskaFrame> block(frame);
+	for (size_t i = 0; i < numLaces; i++) {
+		// Position each lace relative to the block, so rounding errors don't accumulate.
+		const uint64 start = block->duration * i / numLaces;
+		const uint64 end = block->duration * (i + 1) / numLaces;
+
+		MatroskaFrame *lace = new MatroskaFrame();
+		lace->timecode = block->timecode + start;
+		lace->duration = end - start;
+		lace->keyframe = block->keyframe;
+		if (deferred) {
+			lace->deferredLaces.push_back(block->deferredLaces[i]);
+		} else if (block->dataViews.empty()) {
+			lace->dataBuffer.resize(1);
+			lace->dataBuffer[0].swap(block->dataBuffer[i]);
+		} else {
+			lace->dataViews.push_back(block->dataViews[i]);
+			lace->dataOwner = block;
+		}
+		if (i == 0) {
+			lace->add_id = block->add_id;
+			lace->additional_data_buffer = block->additional_data_buffer;
+		}
+		ChargeFrame(trackIdx, *lace);
+		queue.push_back(lace);
+		if (!deferred && !decoded) DecodeQueuedFrame(trackIdx, *lace);
+	}
+
+	return &queue.back();
+}
+
+
+void MatroskaParser::DecodeQueuedFrame(uint16 trackIdx, MatroskaFrame &frame)
+{
+	const MatroskaTrackInfo &track = m_Tracks[trackIdx];
+	if (!EncodesFrames(track)) return;
+
+	// Header stripping is cheap enough to just do here.
+	bool inflate = false;
+	for (size_t i = 0; i < track.contentEncodings.size(); i++) {
+		if (track.contentEncodings[i].compAlgo == ContentCompZlib) inflate = true;
+	}
+
+	if (inflate && m_DecodeWorkers) {
+		m_DecodeWorkers->Post(track.contentEncodings, frame);
+		m_RechargeDecoded = true;
+		return;
+	}
+
+	if (!DecodeFrame(track.contentEncodings, frame, *m_BufferPool)) {
+		LOG_WARN_S("MatroskaParser::FillQueue(): failed to decode frame of track " << track.trackNumber << " at " << frame.timecode);
+	}
+	RechargeFrame(trackIdx, frame);
+}
+
+
+void MatroskaParser::FinishDecoding()
+{
+	if (!m_DecodeWorkers) return;
+
+	if (unsigned int failures = m_DecodeWorkers->Wait()) {
+		LOG_WARN_S("MatroskaParser::FillQueue(): failed to decode " << failures << " frames");
+	}
+
+	// Frames were charged what was read; now they've been decoded.
+	if (m_RechargeDecoded) {
+		m_RechargeDecoded = false;
+		for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track) {
+			for (FrameQueue::iterator frame = track->second.begin(); frame != track->second.end(); ++frame) {
+				frame->queuedBytes = size_t(GetFrameBytes(*frame));
+			}
+		}
+		RecountQueuedBytes();
+	}
+}
+
+
 int MatroskaParser::FillQueue() 
 {
 	LOG_DEBUG("MatroskaParser::FillQueue()");
@@ -1351,6 +3106,15 @@ int MatroskaParser::FillQueue()
         LOG_WARN_S( "MatroskaParser::FillQueue(): not filling because another queue is full." );
         return -1;
     }
+    if (m_BlockedBytes != 0)
+    {
+        if (!MakeRoom( m_BlockedTrack, m_BlockedBytes ))
+        {
+            LOG_DEBUG_S( "MatroskaParser::FillQueue(): not filling because a frame of trackIdx " << m_BlockedTrack << " is over budget." );
+            return -1;
+        }
+        m_BlockedBytes = 0;
+    }
 
 	int UpperElementLevel = 0;
 	bool bAllowDummy = false;
@@ -1359,387 +3123,154 @@ int MatroskaParser::FillQueue()
 	ElementPtr ElementLevel2;
 	ElementPtr ElementLevel3;
 	ElementPtr ElementLevel4;
-    ElementPtr ElementLevel5;
 	ElementPtr NullElement;
 
-	if (IsSeekable(*m_IOCallback)) {
-		cluster_entry_ptr currentCluster = FindCluster(m_CurrentTimecode);
-		if (currentCluster.get() == NULL)
-		{
-			LOG_ERROR_S( "MatroskaParser::FillQueue(): can't find cluster at current timecode: " << m_CurrentTimecode );
-			return 2;
-		}
-        else LOG_DEBUG_S( "MatroskaParser::FillQueue(): got cluster at timecode: " << m_CurrentTimecode );
-		int64 clusterFilePos = currentCluster->filePos;
-
-		LOG_DEBUG_S("cluster " << currentCluster->clusterNo);
-
-		m_IOCallback->setFilePointer(clusterFilePos);
+	uint64 searchPos = m_IOCallback->getFilePointer();
+	if (m_PendingCluster) {
+		// Resume the cluster that was only partially written, when we last looked.
+		ElementLevel1 = m_PendingCluster;
+		m_PendingCluster.reset();
+		m_IOCallback->setFilePointer(m_ResumePos);
+	} else {
 		// Find the element data
-		ElementLevel1 = ElementPtr(m_InputStream.FindNextID(KaxCluster::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
-		if (ElementLevel1 == NullElement)
+		ElementLevel1 = ElementPtr(m_InputStream->FindNextID(KaxCluster::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+	}
+	if (ElementLevel1 == NullElement)
+	{
+		if (m_Follow)
 		{
-			LOG_INFO_S( "MatroskaParser::FillQueue(): got NullElement" );
-			m_Eof = true;
-			return 1;
+			m_IOCallback->setFilePointer(searchPos);
+			return WaitForMoreData();
 		}
+		LOG_INFO_S( "MatroskaParser::FillQueue(): got NullElement" );
+		m_Eof = true;
+		return 1;
+	}
 
-		if (EbmlId(*ElementLevel1) == KaxCluster::ClassInfos.GlobalId) {
-			KaxCluster *SegmentCluster = static_cast<KaxCluster *>(ElementLevel1.get());
-			uint32 ClusterTimecode = 0;
-			MatroskaFrame *prevFrame = NULL;
+	if (EbmlId(*ElementLevel1) == KaxCluster::ClassInfos.GlobalId) {
+		KaxCluster *SegmentCluster = static_cast<KaxCluster *>(ElementLevel1.get());
+		uint32 ClusterTimecode = 0;
 
-			// read blocks and discard the ones we don't care about
-			ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
-			while (ElementLevel2 != NullElement) {
-				if (UpperElementLevel > 0) {
-					break;
-				}
-				if (UpperElementLevel < 0) {
-					UpperElementLevel = 0;
-				}
-				if (EbmlId(*ElementLevel2) == KaxClusterTimecode::ClassInfos.GlobalId) {						
-					KaxClusterTimecode & ClusterTime = *static_cast<KaxClusterTimecode*>(ElementLevel2.get());
-					ClusterTime.ReadData(m_InputStream.I_O());
-					ClusterTimecode = uint32(ClusterTime);
-					currentCluster->timecode = ClusterTimecode * m_TimecodeScale;
-					SegmentCluster->InitTimecode(ClusterTimecode, m_TimecodeScale);
-				} else  if (EbmlId(*ElementLevel2) == KaxBlockGroup::ClassInfos.GlobalId) {
-					//KaxBlockGroup & aBlockGroup = *static_cast<KaxBlockGroup*>(ElementLevel2);
-
-					// Create a new frame
-					MatroskaFrame *newFrame = new MatroskaFrame();
-                    uint16 trackIdx = 0xffff;   // track of frame.
-
-					ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
-					while (ElementLevel3 != NullElement) {
-						if (UpperElementLevel > 0) {
+		// read blocks and discard the ones we don't care about
+		uint64 level2Pos = m_IOCallback->getFilePointer();
+		ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
+		while (ElementLevel2 != NullElement) {
+			if (UpperElementLevel > 0) {
+                LOG_WARN_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
+				break;
+			}
+			if (UpperElementLevel < 0) {
+				UpperElementLevel = 0;
+			}
+			if (m_Follow && !IsElementComplete(*ElementLevel2)) {
+				// Not all there, yet.  Pick up from this element, once the file grows.
+				m_PendingCluster = ElementLevel1;
+				m_ResumePos = ElementLevel2->GetElementPosition();
+				return WaitForMoreData();
+			}
+			if (EbmlId(*ElementLevel2) == KaxClusterTimecode::ClassInfos.GlobalId) {						
+				KaxClusterTimecode & ClusterTime = *static_cast<KaxClusterTimecode*>(ElementLevel2.get());
+				ClusterTime.ReadData(m_InputStream->I_O());
+				ClusterTimecode = uint32(ClusterTime);
+				m_ReadTimecode = ClusterTimecode * m_TimecodeScale;
+				SegmentCluster->InitTimecode(ClusterTimecode, m_TimecodeScale);
+			} else  if (EbmlId(*ElementLevel2) == KaxBlockGroup::ClassInfos.GlobalId) {
+				//KaxBlockGroup & aBlockGroup = *static_cast<KaxBlockGroup*>(ElementLevel2);
+
+				// Create a new frame
+				MatroskaFrame *newFrame = new MatroskaFrame();
+                uint16 trackIdx = 0xffff;   // track of frame.
+                uint64 blockDuration = 0;   // in ticks, if hasBlockDuration.
+                bool hasBlockDuration = false;
+
+				ElementLevel3 = ElementPtr(m_InputStream->FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
+				while (ElementLevel3 != NullElement) {
+					if (UpperElementLevel > 0) {
+                        LOG_DEBUG_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
+						break;
+					}
+					if (UpperElementLevel < 0) {
+						UpperElementLevel = 0;
+					}
+					if (EbmlId(*ElementLevel3) == KaxBlock::ClassInfos.GlobalId) {								
+						KaxBlock & DataBlock = *static_cast<KaxBlock*>(ElementLevel3.get());
+						trackIdx = ReadBlock(DataBlock, *SegmentCluster, *newFrame);
+					} else if (EbmlId(*ElementLevel3) == KaxReferenceBlock::ClassInfos.GlobalId) {
+						// Only blocks that reference others aren't keyframes.
+						newFrame->keyframe = false;
+					} else if (EbmlId(*ElementLevel3) == KaxBlockDuration::ClassInfos.GlobalId) {
+						KaxBlockDuration & BlockDuration = *static_cast<KaxBlockDuration*>(ElementLevel3.get());
+						BlockDuration.ReadData(m_InputStream->I_O());
+						// Scaled once the Block's been read, since it may come first.
+						blockDuration = uint64(BlockDuration);
+						hasBlockDuration = true;
+					}
+					if (UpperElementLevel > 0) {
+						UpperElementLevel--;
+						//delete ElementLevel3;
+						//_DELETE(ElementLevel3);
+						ElementLevel3 = ElementLevel4;
+						if (UpperElementLevel > 0)
+                        {
+                            LOG_WARN_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
 							break;
-						}
-						if (UpperElementLevel < 0) {
-							UpperElementLevel = 0;
-						}
-						if (EbmlId(*ElementLevel3) == KaxBlock::ClassInfos.GlobalId) {
-							KaxBlock & DataBlock = *static_cast<KaxBlock*>(ElementLevel3.get());														
-							DataBlock.ReadData(m_InputStream.I_O());
-							DataBlock.SetParent(*SegmentCluster);
-
-							//NOTE4("Track # %u / %u frame%s / Timecode %I64d", DataBlock.TrackNum(), DataBlock.NumberFrames(), (DataBlock.NumberFrames() > 1)?"s":"", DataBlock.GlobalTimecode()/m_TimecodeScale);
-							uint16 trackNum = DataBlock.TrackNum();
-							if (TrackNumIsEnabled( trackNum ))
-                            {
-								trackIdx = FindTrack( trackNum );
-								MatroskaTrackInfo &track = m_Tracks[trackIdx];
-
-								newFrame->timecode = DataBlock.GlobalTimecode();
-
-								if (DataBlock.NumberFrames() > 1) {	
-									// The evil lacing has been used
-									newFrame->duration = track.defaultDuration * DataBlock.NumberFrames();
-
-									newFrame->dataBuffer.resize(DataBlock.NumberFrames());
-									for (uint32 f = 0; f < DataBlock.NumberFrames(); f++) {
-										DataBuffer &buffer = DataBlock.GetBuffer(f);
-										newFrame->dataBuffer[f].resize(buffer.Size());								
-										memcpy(&newFrame->dataBuffer[f][0], buffer.Buffer(), buffer.Size());
-									}
-								} else {
-									// Non-lacing block		
-									newFrame->duration = track.defaultDuration;
-
-									newFrame->dataBuffer.resize(1);
-									DataBuffer &buffer = DataBlock.GetBuffer(0);
-									newFrame->dataBuffer.at(0).resize(buffer.Size());
-                                        
-									memcpy(&newFrame->dataBuffer.at(0).at(0), buffer.Buffer(), buffer.Size());
-								}
-							} else {
-								//newFrame->timecode = MAX_UINT64;
-							}
-						/*
-						} else if (EbmlId(*ElementLevel3) == KaxReferenceBlock::ClassInfos.GlobalId) {
-							KaxReferenceBlock & RefTime = *static_cast<KaxReferenceBlock*>(ElementLevel3);
-							RefTime.ReadData(m_InputStream.I_O());
-							newFrame->frameReferences.push_back(int32(RefTime));
-							//wxLogDebug("  Reference frame at scaled (%d) timecode %ld\n", int32(RefTime), int32(int64(RefTime) * TimecodeScale));
-							*/
-						} else if (EbmlId(*ElementLevel3) == KaxBlockDuration::ClassInfos.GlobalId) {
-							KaxBlockDuration & BlockDuration = *static_cast<KaxBlockDuration*>(ElementLevel3.get());
-							BlockDuration.ReadData(m_InputStream.I_O());
-							newFrame->duration = uint64(BlockDuration);
-                        } else if (EbmlId(*ElementLevel3) == KaxBlockAdditions::ClassInfos.GlobalId) {
-                            ElementLevel4 = ElementPtr(m_InputStream.FindNextElement(ElementLevel3->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, bAllowDummy));
-                            while (ElementLevel4 != NullElement) {
-                                if (UpperElementLevel > 0) {
-							        break;
-						        }
-						        if (UpperElementLevel < 0) {
-							        UpperElementLevel = 0;
-						        }
-                                if (EbmlId(*ElementLevel4) == KaxBlockMore::ClassInfos.GlobalId) {
-                                    ElementLevel5 = ElementPtr(m_InputStream.FindNextElement(ElementLevel4->Generic().Context, UpperElementLevel, 0xFFFFFFFFL, bAllowDummy));
-                                    while (ElementLevel5 != NullElement) {
-                                        if (UpperElementLevel > 0) {
-							                break;
-						                }
-						                if (UpperElementLevel < 0) {
-							                UpperElementLevel = 0;
-						                }
-                                        if (EbmlId(*ElementLevel5) == KaxBlockAddID::ClassInfos.GlobalId) {
-                                            KaxBlockAddID & AddId = *static_cast<KaxBlockAddID*>(ElementLevel5.get());
-                                            AddId.ReadData(m_InputStream.I_O());
-                                            newFrame->add_id = uint64(AddId);
-                                        } else if (EbmlId(*ElementLevel5) == KaxBlockAdditional::ClassInfos.GlobalId) {
-                                            KaxBlockAdditional & DataBlockAdditional = *static_cast<KaxBlockAdditional*>(ElementLevel5.get());														
-							                DataBlockAdditional.ReadData(m_InputStream.I_O());		
-                                            newFrame->additional_data_buffer.resize(DataBlockAdditional.GetSize());
-                                            if (!newFrame->add_id) {
-                                                newFrame->add_id = 1;
-                                            }
-                                            memcpy(&newFrame->additional_data_buffer.at(0), DataBlockAdditional.GetBuffer(), DataBlockAdditional.GetSize());
-                                        }
-                                        ElementLevel5->SkipData(m_InputStream, ElementLevel5->Generic().Context);
-							            ElementLevel5 = ElementPtr(m_InputStream.FindNextElement(ElementLevel4->Generic().Context, UpperElementLevel, ElementLevel4->ElementSize(), bAllowDummy));
-                                    }
-                                }
-                                if (UpperElementLevel > 0) {
-							        UpperElementLevel--;
-							        ElementLevel4 = ElementLevel5;
-							        if (UpperElementLevel > 0)
-								        break;
-						        } else {
-							        ElementLevel4->SkipData(m_InputStream, ElementLevel4->Generic().Context);
-							        ElementLevel4 = ElementPtr(m_InputStream.FindNextElement(ElementLevel3->Generic().Context, UpperElementLevel, ElementLevel3->ElementSize(), bAllowDummy));
-						        }
-                            }
                         }
-						if (UpperElementLevel > 0) {
-							UpperElementLevel--;
-							ElementLevel3 = ElementLevel4;
-							if (UpperElementLevel > 0)
-								break;
-						} else {
-							ElementLevel3->SkipData(m_InputStream, ElementLevel3->Generic().Context);
-
-							ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
-						}							
-						//newFrame = new MatroskaReadFrame();
-					}
-					if (newFrame->dataBuffer.size()>0) {
-                        FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
-                        if (track == m_FrameQueues.end()) continue;
-
-                        FrameQueue &track_queue = track->second;
-						track_queue.push_back( newFrame );
-						if (prevFrame != NULL && prevFrame->duration == 0) {
-							prevFrame->duration = newFrame->timecode - prevFrame->timecode;
-							//if (newFrame->duration == 0)
-							//	newFrame->duration = prevFrame->duration;
-						}
-
-						// !!!!!!!!!!!!!!! HACK ALERT !!!!!!!!!!!!!!!!!!!!!!!!
-						// This is an ugly hack to keep us from re-seeking to the same cluster
-						m_CurrentTimecode = newFrame->timecode + (newFrame->duration * 2);
-						if (newFrame->duration == 0) {
-							m_CurrentTimecode += (int64)m_Tracks.at(m_CurrentTrackNo).defaultDuration * 2;
-						}
-						// !!!!!!!!!!!!!!! HACK ALERT !!!!!!!!!!!!!!!!!!!!!!!!
-
-						prevFrame = newFrame;
-                    } else {
-                        LOG_INFO("newFrame ==!! delete!!");
-                        _DELETE(newFrame);
-                    }
-				}
-
-				if (UpperElementLevel > 0) {
-					UpperElementLevel--;
-					//delete ElementLevel2;
-					//_DELETE(ElementLevel2);
-					ElementLevel2 = ElementLevel3;
-					if (UpperElementLevel > 0)
-						break;
-				} else {
-					ElementLevel2->SkipData(m_InputStream, ElementLevel2->Generic().Context);
-					//if (ElementLevel2 != pChecksum)
-					//	delete ElementLevel2;								
-					//ElementLevel2 = NULL;
-					//_DELETE(ElementLevel2);
-
-					ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
+					} else {
+						ElementLevel3->SkipData(*m_InputStream, ElementLevel3->Generic().Context);
+						//delete ElementLevel3;
+						//ElementLevel3 = NULL;
+						//_DELETE(ElementLevel3);
+
+						ElementLevel3 = ElementPtr(m_InputStream->FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
+					}							
+					//newFrame = new MatroskaReadFrame();
 				}
+				if (hasBlockDuration) newFrame->duration = ScaleTrackTimecode(trackIdx, blockDuration * m_TimecodeScale);
+				if (QueueBlockFrame(newFrame, trackIdx, ElementLevel1, ElementLevel2->GetElementPosition()) != 0) return -1;
+			} else if (EbmlId(*ElementLevel2) == KaxSimpleBlock::ClassInfos.GlobalId) {
+				// Its flags say whether it's a keyframe, in place of a ReferenceBlock.
+				KaxSimpleBlock & DataBlock = *static_cast<KaxSimpleBlock*>(ElementLevel2.get());
+				MatroskaFrame *newFrame = new MatroskaFrame();
+				const uint16 trackIdx = ReadBlock(DataBlock, *SegmentCluster, *newFrame);
+				newFrame->keyframe = DataBlock.IsKeyframe();
+				if (QueueBlockFrame(newFrame, trackIdx, ElementLevel1, ElementLevel2->GetElementPosition()) != 0) return -1;
 			}
-		}
-		//_DELETE(ElementLevel3);
-		//_DELETE(ElementLevel2);
-		//_DELETE(ElementLevel1);
-		//delete ElementLevel1;
-		
-		if (currentCluster->clusterNo < m_ClusterIndex.size()-1) {
-			if (m_ClusterIndex.at(currentCluster->clusterNo+1)->timecode == MAX_UINT64)
-				m_ClusterIndex.at(currentCluster->clusterNo+1)->timecode = GetClusterTimecode(m_ClusterIndex.at(currentCluster->clusterNo+1)->filePos);
-			m_CurrentTimecode = m_ClusterIndex.at(currentCluster->clusterNo+1)->timecode;
-			if(m_CurrentTimecode == 0)
-			{
-				LOG_INFO_S( (boost::format("clusterNo : %d, m_ClusterIndex.size() : %d")
-					% currentCluster->clusterNo % (int) m_ClusterIndex.size()) );
-				LOG_INFO("m_CurrentTimecode == 0 (a)");
-			}
-		} else {
-			m_CurrentTimecode = MAX_UINT64;
-		}
-		
-	} else {
-		// Find the element data
-		ElementLevel1 = ElementPtr(m_InputStream.FindNextID(KaxCluster::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
-		if (ElementLevel1 == NullElement)
-		{
-			LOG_INFO_S( "MatroskaParser::FillQueue(): got NullElement" );
-			m_Eof = true;
-			return 1;
-		}
 
-		if (EbmlId(*ElementLevel1) == KaxCluster::ClassInfos.GlobalId) {
-			KaxCluster *SegmentCluster = static_cast<KaxCluster *>(ElementLevel1.get());
-			uint32 ClusterTimecode = 0;
-
-			// read blocks and discard the ones we don't care about
-			ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
-			while (ElementLevel2 != NullElement) {
-				if (UpperElementLevel > 0) {
-                    LOG_WARN_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
+			if (UpperElementLevel > 0) {
+				UpperElementLevel--;
+				//delete ElementLevel2;
+				//_DELETE(ElementLevel2);
+				ElementLevel2 = ElementLevel3;
+				if (UpperElementLevel > 0)
+                {
+                    LOG_DEBUG_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
 					break;
-				}
-				if (UpperElementLevel < 0) {
-					UpperElementLevel = 0;
-				}
-				if (EbmlId(*ElementLevel2) == KaxClusterTimecode::ClassInfos.GlobalId) {						
-					KaxClusterTimecode & ClusterTime = *static_cast<KaxClusterTimecode*>(ElementLevel2.get());
-					ClusterTime.ReadData(m_InputStream.I_O());
-					ClusterTimecode = uint32(ClusterTime);
-					SegmentCluster->InitTimecode(ClusterTimecode, m_TimecodeScale);
-				} else  if (EbmlId(*ElementLevel2) == KaxBlockGroup::ClassInfos.GlobalId) {
-					//KaxBlockGroup & aBlockGroup = *static_cast<KaxBlockGroup*>(ElementLevel2);
-
-					// Create a new frame
-					MatroskaFrame *newFrame = new MatroskaFrame();
-                    uint16 trackIdx = 0xffff;   // track of frame.
-
-					ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
-					while (ElementLevel3 != NullElement) {
-						if (UpperElementLevel > 0) {
-                            LOG_DEBUG_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
-							break;
-						}
-						if (UpperElementLevel < 0) {
-							UpperElementLevel = 0;
-						}
-						if (EbmlId(*ElementLevel3) == KaxBlock::ClassInfos.GlobalId) {								
-							KaxBlock & DataBlock = *static_cast<KaxBlock*>(ElementLevel3.get());														
-							DataBlock.ReadData(m_InputStream.I_O());		
-							DataBlock.SetParent(*SegmentCluster);
-
-							//NOTE4("Track # %u / %u frame%s / Timecode %I64d", DataBlock.TrackNum(), DataBlock.NumberFrames(), (DataBlock.NumberFrames() > 1)?"s":"", DataBlock.GlobalTimecode()/m_TimecodeScale);
-							uint16 trackNum = DataBlock.TrackNum();
-							if (TrackNumIsEnabled( trackNum ))
-                            {
-								trackIdx = FindTrack( trackNum );
-								MatroskaTrackInfo &track = m_Tracks[trackIdx];
-
-								newFrame->timecode = DataBlock.GlobalTimecode();							
-
-								if (DataBlock.NumberFrames() > 1) {	
-									// The evil lacing has been used
-									newFrame->duration = track.defaultDuration * DataBlock.NumberFrames();
-
-									newFrame->dataBuffer.resize(DataBlock.NumberFrames());
-									for (uint32 f = 0; f < DataBlock.NumberFrames(); f++) {
-										DataBuffer &buffer = DataBlock.GetBuffer(f);
-										newFrame->dataBuffer[f].resize(buffer.Size());								
-										memcpy(&newFrame->dataBuffer[f][0], buffer.Buffer(), buffer.Size());
-									}
-								} else {
-									// Non-lacing block		
-									newFrame->duration = track.defaultDuration;
-									
-									newFrame->dataBuffer.resize(1);
-									DataBuffer &buffer = DataBlock.GetBuffer(0);
-									newFrame->dataBuffer.at(0).resize(buffer.Size());								
-									memcpy(&newFrame->dataBuffer[0][0], buffer.Buffer(), buffer.Size());
-								}
-							} else {
-								//newFrame->timecode = MAX_UINT64;
-							}
-						/*
-						} else if (EbmlId(*ElementLevel3) == KaxReferenceBlock::ClassInfos.GlobalId) {
-							KaxReferenceBlock & RefTime = *static_cast<KaxReferenceBlock*>(ElementLevel3);
-							RefTime.ReadData(m_InputStream.I_O());
-							newFrame->frameReferences.push_back(int32(RefTime));
-							//wxLogDebug("  Reference frame at scaled (%d) timecode %ld\n", int32(RefTime), int32(int64(RefTime) * TimecodeScale));
-							*/
-						} else if (EbmlId(*ElementLevel3) == KaxBlockDuration::ClassInfos.GlobalId) {
-							KaxBlockDuration & BlockDuration = *static_cast<KaxBlockDuration*>(ElementLevel3.get());
-							BlockDuration.ReadData(m_InputStream.I_O());
-							newFrame->duration = uint64(BlockDuration);
-						}
-						if (UpperElementLevel > 0) {
-							UpperElementLevel--;
-							//delete ElementLevel3;
-							//_DELETE(ElementLevel3);
-							ElementLevel3 = ElementLevel4;
-							if (UpperElementLevel > 0)
-                            {
-                                LOG_WARN_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
-								break;
-                            }
-						} else {
-							ElementLevel3->SkipData(m_InputStream, ElementLevel3->Generic().Context);
-							//delete ElementLevel3;
-							//ElementLevel3 = NULL;
-							//_DELETE(ElementLevel3);
-
-							ElementLevel3 = ElementPtr(m_InputStream.FindNextElement(ElementLevel2->Generic().Context, UpperElementLevel, ElementLevel2->ElementSize(), bAllowDummy));
-						}							
-						//newFrame = new MatroskaReadFrame();
-					}
-					if (newFrame->dataBuffer.size()>0)
-                    {
-                        FrameQueueMap::iterator track = m_FrameQueues.find( trackIdx );
-                        if (track == m_FrameQueues.end()) continue;
-
-                        FrameQueue &track_queue = track->second;
-						track_queue.push_back( newFrame );
-                    }
-                    else delete newFrame;
-				}
-
-				if (UpperElementLevel > 0) {
-					UpperElementLevel--;
-					//delete ElementLevel2;
-					//_DELETE(ElementLevel2);
-					ElementLevel2 = ElementLevel3;
-					if (UpperElementLevel > 0)
-                    {
-                        LOG_DEBUG_S( "MatroskaParser::FillQueue(): UpperElementLevel = " << UpperElementLevel << " at line " << __LINE__ );
-						break;
-                    }
-				} else {
-					ElementLevel2->SkipData(m_InputStream, ElementLevel2->Generic().Context);
-					//if (ElementLevel2 != pChecksum)
-					//	delete ElementLevel2;								
-					//ElementLevel2 = NULL;
-					//_DELETE(ElementLevel2);
-
-					ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
-				}
+                }
+			} else {
+				ElementLevel2->SkipData(*m_InputStream, ElementLevel2->Generic().Context);
+				//if (ElementLevel2 != pChecksum)
+				//	delete ElementLevel2;								
+				//ElementLevel2 = NULL;
+				//_DELETE(ElementLevel2);
+
+				level2Pos = m_IOCallback->getFilePointer();
+				ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), bAllowDummy));
 			}
 		}
-		ElementLevel1->SkipData(m_InputStream, ElementLevel1->Generic().Context);
-		//_DELETE(ElementLevel3);
-		//_DELETE(ElementLevel2);
-		//_DELETE(ElementLevel1);
-		//delete ElementLevel1;
+		if (m_Follow && (ElementLevel2 == NullElement)
+			&& (!ElementLevel1->IsFiniteSize() || !IsElementComplete(*ElementLevel1)))
+		{
+			// Ran out of data before the end of the cluster.
+			m_PendingCluster = ElementLevel1;
+			m_ResumePos = level2Pos;
+			return WaitForMoreData();
+		}
 	}
+	ElementLevel1->SkipData(*m_InputStream, ElementLevel1->Generic().Context);
+	//_DELETE(ElementLevel3);
+	//_DELETE(ElementLevel2);
+	//_DELETE(ElementLevel1);
+	//delete ElementLevel1;
     for (FrameQueueMap::iterator track = m_FrameQueues.begin(); track != m_FrameQueues.end(); ++track)
     {
         LOG_INFO_S("MatroskaParser::FillQueue() - trackIdx " << track->first << " now has " << track->second.size() << " frames queued");
@@ -1760,7 +3291,7 @@ uint64 MatroskaParser::GetClusterTimecode(uint64 filePos) {
 
 		m_IOCallback->setFilePointer(filePos);
 		// Find the element data
-		ElementLevel1 = ElementPtr(m_InputStream.FindNextID(KaxCluster::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
+		ElementLevel1 = ElementPtr(m_InputStream->FindNextID(KaxCluster::ClassInfos, 0xFFFFFFFFFFFFFFFFL));
 		if (ElementLevel1 == NullElement)
 			return MAX_UINT64;
 
@@ -1769,7 +3300,7 @@ uint64 MatroskaParser::GetClusterTimecode(uint64 filePos) {
 			//uint32 ClusterTimecode = 0;
 
 			// read blocks and discard the ones we don't care about
-			ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), false));
+			ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), false));
 			while (ElementLevel2 != NullElement) {
 				if (UpperElementLevel > 0) {
 					break;
@@ -1779,7 +3310,7 @@ uint64 MatroskaParser::GetClusterTimecode(uint64 filePos) {
 				}
 				if (EbmlId(*ElementLevel2) == KaxClusterTimecode::ClassInfos.GlobalId) {						
 					KaxClusterTimecode & ClusterTime = *static_cast<KaxClusterTimecode*>(ElementLevel2.get());
-					ClusterTime.ReadData(m_InputStream.I_O());
+					ClusterTime.ReadData(m_InputStream->I_O());
 					ret = uint64(ClusterTime) * m_TimecodeScale;
 					
 				}
@@ -1792,14 +3323,14 @@ uint64 MatroskaParser::GetClusterTimecode(uint64 filePos) {
 					if (UpperElementLevel > 0)
 						break;
 				} else {
-					ElementLevel2->SkipData(m_InputStream, ElementLevel2->Generic().Context);
+					ElementLevel2->SkipData(*m_InputStream, ElementLevel2->Generic().Context);
 					//if (ElementLevel2 != pChecksum)
 					//delete ElementLevel2;								
 					//ElementLevel2 = NULL;
 					//_DELETE(ElementLevel2);
 					ElementLevel2 = NullElement;
 					if (ret == MAX_UINT64)
-						ElementLevel2 = ElementPtr(m_InputStream.FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), false));
+						ElementLevel2 = ElementPtr(m_InputStream->FindNextElement(ElementLevel1->Generic().Context, UpperElementLevel, ElementLevel1->ElementSize(), false));
 				}
 			}
 		}
@@ -1817,6 +3348,21 @@ uint64 MatroskaParser::GetClusterTimecode(uint64 filePos) {
 	return MAX_UINT64;
 };
 
+
+    // Orders clusters by timecode, reading those of clusters found by the SeekHead, which
+    // aren't known, 'til they're needed.
+struct ClusterTimecodeIsAfter {
+	boost::function<uint64 (uint64)> getTimecode;
+
+	bool operator()( uint64 timecode, const cluster_entry_ptr &cluster ) const
+	{
+		if (cluster->timecode == MAX_UINT64) cluster->timecode = getTimecode( cluster->filePos );
+		return timecode < cluster->timecode;
+	}
+};
+
+    // Returns the last cluster starting at or before timecode, or the first, if none does.
+    // Clusters' timecodes increase in file order, so it's a binary search.
 cluster_entry_ptr MatroskaParser::FindCluster(uint64 timecode)
 {
 	try {
@@ -1829,99 +3375,14 @@ cluster_entry_ptr MatroskaParser::FindCluster(uint64 timecode)
 
         assert( !m_ClusterIndex.empty() );
 
-		if (timecode == 0)
-			// Special case
-			return m_ClusterIndex.at(0);
-		
-		cluster_entry_ptr correctEntry;
-		double clusterDuration = (double)(int64)m_ClusterIndex.size() / m_Duration;
-		size_t clusterIndex = size_t( clusterDuration * (double)(int64)timecode );
-		//int lookCount = 0;
-		if (clusterIndex > m_ClusterIndex.size())
-			clusterIndex = m_ClusterIndex.size()-1;
-
-		cluster_entry_ptr clusterEntry;
-		cluster_entry_ptr prevClusterEntry;
-		cluster_entry_ptr nextClusterEntry;
-		while (correctEntry == NULL) {
-			clusterEntry = m_ClusterIndex.at(clusterIndex);		
-			if (clusterIndex > 0)
-				prevClusterEntry = m_ClusterIndex.at(clusterIndex-1);
-			if (clusterIndex+1 < m_ClusterIndex.size())
-				nextClusterEntry = m_ClusterIndex.at(clusterIndex+1);			
-			
-			// We need timecodes to do good seeking
-			if (clusterEntry->timecode == MAX_UINT64) {				
-				clusterEntry->timecode = GetClusterTimecode(clusterEntry->filePos);			
-			}
-			if (prevClusterEntry != NULL && prevClusterEntry->timecode == MAX_UINT64) {
-				prevClusterEntry->timecode = GetClusterTimecode(prevClusterEntry->filePos);			
-			}
-			if (nextClusterEntry != NULL && nextClusterEntry->timecode == MAX_UINT64) {				
-				nextClusterEntry->timecode = GetClusterTimecode(nextClusterEntry->filePos);			
-			}
-
-			if (clusterEntry->timecode == timecode) {
-				// WOW, we are seeking directly to this cluster
-				correctEntry = clusterEntry;
-				break;
-			}
-
-			if (prevClusterEntry != NULL) {
-				if (clusterEntry->timecode > timecode && timecode > prevClusterEntry->timecode) {
-					// We found it !!!
-					correctEntry = prevClusterEntry;
-					break;
-				}
-				if (prevClusterEntry->timecode == timecode) {
-					// WOW, we are seeking directly to this cluster
-					correctEntry = prevClusterEntry;
-					break;
-				}
-				// Check if we overshot the needed cluster
-				if (timecode < prevClusterEntry->timecode) {
-					clusterIndex--;
-					//lookCount++; // This is how many times we have 'looked'
-					continue;
-				}
-			}
-			
-			if (nextClusterEntry != NULL) {
-				if (clusterEntry->timecode < timecode && timecode < nextClusterEntry->timecode) {
-					// We found it !!!
-					correctEntry = clusterEntry;
-					break;
-				}			
-				if (nextClusterEntry->timecode == timecode) {
-					// WOW, we are seeking directly to this cluster
-					correctEntry = nextClusterEntry;
-					break;
-				}
-				// Check if we undershot the needed cluster
-				if (timecode > nextClusterEntry->timecode) {
-					clusterIndex++;
-					//lookCount--;
-					continue;
-				}
-			}
-			// We should never get here, unless this is the last cluster
-			assert(clusterEntry != NULL);	
-			if (timecode <= m_Duration)
-				correctEntry = clusterEntry;
-			else
-				break;
-		}
-
-		if (correctEntry != NULL)
-        {
-			LOG_INFO("MatroskaParser::FindCluster(timecode = %u) seeking to cluster %i at %u",
-                (uint32)(timecode / m_TimecodeScale), (uint32) correctEntry->clusterNo, (uint32) correctEntry->filePos);
-        }
-		else
-		{
-			LOG_INFO("MatroskaParser::FindCluster(timecode = %u) seeking failed", (uint32)(timecode / m_TimecodeScale));
-		}
+        ClusterTimecodeIsAfter isAfter;
+        isAfter.getTimecode = boost::bind( &MatroskaParser::GetClusterTimecode, this, _1 );
+        std::vector<cluster_entry_ptr>::const_iterator next =
+            std::upper_bound( m_ClusterIndex.begin(), m_ClusterIndex.end(), timecode, isAfter );
+        cluster_entry_ptr correctEntry = (next == m_ClusterIndex.begin()) ? *next : *(next - 1);
 
+		LOG_INFO("MatroskaParser::FindCluster(timecode = %u) seeking to cluster %i at %u",
+            (uint32)(timecode / m_TimecodeScale), (uint32) correctEntry->clusterNo, (uint32) correctEntry->filePos);
 		return correctEntry;
 	} catch (std::exception &e) {
         LOG_ERROR_S( "Caught exception (" << typeid( e ).name() << "): " << e.what() );
@@ -1963,22 +3424,12 @@ void MatroskaParser::FixChapterEndTimes()
 
 bool MatroskaParser::FindEditionUID(uint64 uid)
 {
-	for (uint32 c = 0; c < m_Editions.size(); c++) {
-		MatroskaEditionInfo &currentEdition = m_Editions.at(c);	
-		if (currentEdition.editionUID == uid)
-			return true;
-	}	
-	return false;
+	return m_EditionUIDs.count(uid) != 0;
 }
 
 bool MatroskaParser::FindChapterUID(uint64 uid)
 {
-	for (uint32 c = 0; c < m_Chapters.size(); c++) {
-		MatroskaChapterInfo &currentChapter = m_Chapters.at(c);	
-		if (currentChapter.chapterUID == uid)
-			return true;
-	}	
-	return false;
+	return m_ChapterUIDs.count(uid) != 0;
 }
 
 void PrintChapters(std::vector<MatroskaChapterInfo> &theChapters) 
@@ -0,0 +1,492 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file matroska_trim.cpp
+    \brief Fast extraction of a time range from a Matroska file.
+*/
+
+#include "mkvreader/matroska_trim.h"
+#include "ebml_util.h"
+#include "posix_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+
+namespace mkvreader {
+
+
+static const uint64 DefaultTimecodeScale = 1000000;
+
+
+TrimStats::TrimStats()
+:
+    clustersCopied( 0 ),
+    clustersRewritten( 0 ),
+    bytesCopied( 0 ),
+    bytesRewritten( 0 )
+{
+}
+
+
+namespace {
+
+
+/// Closes a file descriptor when it goes out of scope.
+class ScopedFd {
+public:
+    explicit ScopedFd( int fd ) : m_fd( fd ) {}
+    ~ScopedFd() { if (m_fd >= 0) close( m_fd ); }
+    int get() const { return m_fd; }
+
+private:
+    ScopedFd( const ScopedFd & );
+    ScopedFd &operator=( const ScopedFd & );
+
+    int m_fd;
+};
+
+
+/// A child of the Segment.
+struct Level1Element {
+    uint32 id;
+    uint64 pos;
+    uint64 size;        ///< Including the header.
+    uint64 timecode;    ///< For clusters, in ns.
+};
+
+bool operator<( const Level1Element &cluster, uint64 timecode )
+{
+    return cluster.timecode < timecode;
+}
+
+bool operator<( uint64 timecode, const Level1Element &cluster )
+{
+    return timecode < cluster.timecode;
+}
+
+
+/// A child of a boundary cluster.
+struct ClusterChild {
+    size_t pos;
+    size_t len;
+    bool isBlock;
+    uint64 track;
+    int16 relTimecode;
+    bool keyframe;
+};
+
+
+bool ReadHeadAt( int fd, uint64 pos, ElementHead &head )
+{
+    uint8 buf[MaxElementHeadSize];
+    size_t num_read = ReadAt( fd, buf, sizeof( buf ), pos );
+    return ReadElementHead( buf, num_read, head );
+}
+
+
+std::vector< uint8 > ReadElement( int fd, const Level1Element &element )
+{
+    std::vector< uint8 > data( size_t( element.size ) );
+    if (ReadAt( fd, &data.front(), data.size(), element.pos ) != data.size())
+    {
+        throw std::runtime_error( "TrimFile(): unexpected end of file" );
+    }
+    return data;
+}
+
+
+    // The cluster's Timecode is normally its first child, but may follow a CRC-32.
+uint64 ReadClusterTimecode( int fd, uint64 data_pos, uint64 data_size )
+{
+    uint8 buf[64];
+    size_t avail = ReadAt( fd, buf, size_t( std::min( data_size, uint64( sizeof( buf ) ) ) ), data_pos );
+    size_t p = 0;
+    ElementHead head;
+    while (ReadElementHead( buf + p, avail - p, head ) && p + head.headSize + head.size <= avail)
+    {
+        if (head.id == IdClusterTimecode) return ReadUInt( buf + p + head.headSize, size_t( head.size ) );
+        p += head.headSize + size_t( head.size );
+    }
+    throw std::runtime_error( boost::str(
+        boost::format( "TrimFile(): no Timecode at start of cluster @ %d" ) % data_pos ) );
+}
+
+
+    // Decodes the track number, timecode & flags from the start of a Block or SimpleBlock.
+bool ReadBlockHeader( const uint8 *p, size_t avail, ClusterChild &child, uint8 &flags )
+{
+    unsigned int len = ReadVint( p, avail, child.track );
+    if (len == 0 || len + 3 > avail) return false;
+
+    child.relTimecode = int16( (p[len] << 8) | p[len + 1] );
+    flags = p[len + 2];
+    child.isBlock = true;
+    return true;
+}
+
+
+void WriteInfo( int out_fd, const std::vector< uint8 > &info, double duration )
+{
+    ElementHead head;
+    ReadElementHead( &info.front(), info.size(), head );
+
+        // Keep everything but the old Duration, and any CRC-32 that it'd invalidate.
+    std::vector< uint8 > body;
+    for (size_t p = head.headSize; p < info.size(); )
+    {
+        ElementHead child;
+        if (!ReadElementHead( &info[p], info.size() - p, child )) break;
+        size_t len = child.headSize + size_t( child.size );
+        if (child.id != IdDuration && child.id != IdCrc32 && child.id != IdVoid)
+        {
+            body.insert( body.end(), info.begin() + p, info.begin() + std::min( p + len, info.size() ) );
+        }
+        p += len;
+    }
+
+    uint64 bits;
+    memcpy( &bits, &duration, sizeof( bits ) );
+    uint8 dur[MaxElementHeadSize + 8];
+    size_t dur_len = WriteId( dur, IdDuration );
+    dur[dur_len++] = 0x88;  // 1-byte size of 8
+    for (int i = 7; i >= 0; i--) dur[dur_len++] = uint8( bits >> (8 * i) );
+    body.insert( body.end(), dur, dur + dur_len );
+
+    uint8 info_head[MaxElementHeadSize];
+    WriteAll( out_fd, info_head, WriteElementHead( info_head, IdInfo, body.size() ) );
+    WriteAll( out_fd, &body.front(), body.size() );
+}
+
+
+/// A boundary cluster, read & split into its children.
+struct ParsedCluster {
+    ParsedCluster(): timecode( 0 ) {}
+
+    std::vector< uint8 > data;
+    uint64 timecode;    ///< In units of the timecode scale.
+    std::vector< ClusterChild > children;
+
+    uint64 BlockTimecode( const ClusterChild &child, uint64 timecode_scale ) const
+    {
+        return uint64( std::max( int64( timecode ) + child.relTimecode, int64( 0 ) ) ) * timecode_scale;
+    }
+};
+
+
+/// Where each track's output starts, before start_ns: the (cluster, child) indexes of
+/// its last keyframe at or before start_ns.
+typedef std::map< uint64, std::pair< size_t, size_t > > KeyframeMap;
+
+
+void ParseCluster( int in_fd, const Level1Element &cluster, ParsedCluster &parsed )
+{
+    parsed.data = ReadElement( in_fd, cluster );
+    const std::vector< uint8 > &data = parsed.data;
+    ElementHead head;
+    ReadElementHead( &data.front(), data.size(), head );
+
+    for (size_t p = head.headSize; p < data.size(); )
+    {
+        ElementHead child_head;
+        if (!ReadElementHead( &data[p], data.size() - p, child_head ) || child_head.unknownSize) break;
+        size_t len = child_head.headSize + size_t( child_head.size );
+        if (p + len > data.size()) break;
+
+        const uint8 *payload = &data[p + child_head.headSize];
+        ClusterChild child = { p, len, false, 0, 0, false };
+        uint8 flags = 0;
+        bool keep = true;
+        switch (child_head.id)
+        {
+        case IdClusterTimecode:
+            parsed.timecode = ReadUInt( payload, size_t( child_head.size ) );
+            break;
+
+        case IdSimpleBlock:
+            if (ReadBlockHeader( payload, size_t( child_head.size ), child, flags )) child.keyframe = (flags & 0x80) != 0;
+            break;
+
+        case IdBlockGroup:
+            {
+                    // Without a ReferenceBlock, the Block is a keyframe.
+                child.keyframe = true;
+                for (size_t q = 0; q < child_head.size; )
+                {
+                    ElementHead group_head;
+                    if (!ReadElementHead( payload + q, size_t( child_head.size ) - q, group_head )) break;
+                    if (group_head.id == IdBlock) ReadBlockHeader( payload + q + group_head.headSize, size_t( group_head.size ), child, flags );
+                    else if (group_head.id == IdReferenceBlock) child.keyframe = false;
+                    q += group_head.headSize + size_t( group_head.size );
+                }
+            }
+            break;
+
+            // Positions & checksums would be wrong in the new file.
+        case IdCrc32:
+        case IdVoid:
+        case IdClusterPosition:
+        case IdClusterPrevSize:
+            keep = false;
+            break;
+        }
+
+        if (keep) parsed.children.push_back( child );
+        p += len;
+    }
+}
+
+
+    // Walks back from the cluster containing start_ns, until every track with blocks
+    // before start_ns has a keyframe at or before it.
+    // \return the index of the earliest cluster to output.
+size_t FindKeyframes( int in_fd, const std::vector< Level1Element > &clusters, size_t first,
+    uint64 timecode_scale, uint64 start_ns, std::map< size_t, ParsedCluster > &parsed, KeyframeMap &keys )
+{
+    std::set< uint64 > needed;
+    size_t cut = first;
+    for (size_t c = first + 1; c-- > 0; )
+    {
+        ParsedCluster &cluster = parsed[c];
+        ParseCluster( in_fd, clusters[c], cluster );
+
+        for (size_t i = cluster.children.size(); i-- > 0; )
+        {
+            const ClusterChild &child = cluster.children[i];
+            if (!child.isBlock) continue;
+
+            const uint64 timecode = cluster.BlockTimecode( child, timecode_scale );
+            if (timecode < start_ns) needed.insert( child.track );
+            if (child.keyframe && timecode <= start_ns && !keys.count( child.track ))
+            {
+                keys[child.track] = std::make_pair( c, i );
+                cut = c;
+            }
+        }
+
+        bool found_all = true;
+        for (std::set< uint64 >::const_iterator t = needed.begin(); t != needed.end() && found_all; ++t)
+        {
+            found_all = keys.count( *t ) != 0;
+        }
+        if (found_all) break;
+    }
+    return cut;
+}
+
+
+    // Writes a boundary cluster with only the blocks that belong in the output.
+uint64 WriteCluster( int out_fd, const ParsedCluster &cluster, size_t index, uint64 timecode_scale,
+    uint64 start_ns, uint64 end_ns, const KeyframeMap &keys )
+{
+    const std::vector< uint8 > &data = cluster.data;
+    std::vector< uint8 > body;
+    for (size_t i = 0; i < cluster.children.size(); i++)
+    {
+        const ClusterChild &child = cluster.children[i];
+        if (child.isBlock)
+        {
+            uint64 timecode = cluster.BlockTimecode( child, timecode_scale );
+            if (timecode >= end_ns) continue;
+
+                // Before start_ns, each track starts from its last keyframe at or before it.
+            if (timecode < start_ns)
+            {
+                KeyframeMap::const_iterator key = keys.find( child.track );
+                if (key == keys.end() || std::make_pair( index, i ) < key->second) continue;
+            }
+        }
+        body.insert( body.end(), data.begin() + child.pos, data.begin() + child.pos + child.len );
+    }
+
+    uint8 cluster_head[MaxElementHeadSize];
+    size_t head_len = WriteElementHead( cluster_head, IdCluster, body.size() );
+    WriteAll( out_fd, cluster_head, head_len );
+    if (!body.empty()) WriteAll( out_fd, &body.front(), body.size() );
+
+    return head_len + body.size();
+}
+
+
+}   // namespace
+
+
+TrimStats TrimFile( const char *src_filename, const char *dst_filename, uint64 start_ns, uint64 end_ns )
+{
+    ScopedFd in( open( src_filename, O_RDONLY | O_CLOEXEC ) );
+    if (in.get() < 0) throw std::runtime_error( boost::str(
+        boost::format( "TrimFile(): failed to open %s: %s" ) % src_filename % strerror( errno ) ) );
+
+    struct stat st;
+    if (fstat( in.get(), &st ) != 0) throw std::runtime_error( "TrimFile(): fstat() failed" );
+    const uint64 file_size = uint64( st.st_size );
+
+    ElementHead head;
+    if (!ReadHeadAt( in.get(), 0, head ) || head.id != IdEbmlHead)
+    {
+        throw std::runtime_error( "TrimFile(): no EBML header" );
+    }
+
+    const uint64 segment_pos = head.headSize + head.size;
+    if (!ReadHeadAt( in.get(), segment_pos, head ) || head.id != IdSegment)
+    {
+        throw std::runtime_error( "TrimFile(): no segment" );
+    }
+
+    const uint64 data_start = segment_pos + head.headSize;
+    const uint64 data_end = head.unknownSize ? file_size : std::min( file_size, data_start + head.size );
+
+        // Hop over the segment's children, using only their headers.
+    std::vector< Level1Element > headers;
+    std::vector< Level1Element > clusters;
+    std::vector< uint8 > info;
+    for (uint64 pos = data_start; pos < data_end; )
+    {
+        if (!ReadHeadAt( in.get(), pos, head )) break;
+        if (head.unknownSize) throw std::runtime_error( boost::str(
+            boost::format( "TrimFile(): element with unknown size @ %d" ) % pos ) );
+
+        Level1Element element = { head.id, pos, head.headSize + head.size, 0 };
+        if (head.id == IdCluster)
+        {
+            element.timecode = ReadClusterTimecode( in.get(), pos + head.headSize, head.size );
+            clusters.push_back( element );
+        }
+        else if (head.id == IdInfo)
+        {
+            info = ReadElement( in.get(), element );
+            headers.push_back( element );
+        }
+        else if (head.id != IdSeekHead && head.id != IdCues && head.id != IdVoid) headers.push_back( element );
+
+        pos += element.size;
+    }
+
+    uint64 timecode_scale = DefaultTimecodeScale;
+    double duration = 0.0;  // in units of timecode_scale
+    for (size_t p = 0; p < info.size(); )
+    {
+        ElementHead child;
+        if (!ReadElementHead( &info[p], info.size() - p, child )) break;
+        if (p == 0)
+        {
+            p = child.headSize;     // Descend into Info.
+            continue;
+        }
+        if (child.id == IdTimecodeScale) timecode_scale = ReadUInt( &info[p + child.headSize], size_t( child.size ) );
+        else if (child.id == IdDuration) duration = ReadFloat( &info[p + child.headSize], size_t( child.size ) );
+        p += child.headSize + size_t( child.size );
+    }
+
+    for (std::vector< Level1Element >::iterator i = clusters.begin(); i != clusters.end(); ++i)
+    {
+        i->timecode *= timecode_scale;
+    }
+
+        // The first cluster is the one containing start_ns; the last, the one containing end_ns.
+    std::vector< Level1Element >::const_iterator first =
+        std::upper_bound( clusters.begin(), clusters.end(), start_ns );
+    if (first != clusters.begin()) --first;
+    std::vector< Level1Element >::const_iterator last =
+        std::lower_bound( clusters.begin(), clusters.end(), end_ns );
+
+    ScopedFd out( open( dst_filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) );
+    if (out.get() < 0) throw std::runtime_error( boost::str(
+        boost::format( "TrimFile(): failed to create %s: %s" ) % dst_filename % strerror( errno ) ) );
+
+    TrimStats stats;
+
+        // EBML header, verbatim.
+    CopyRange( in.get(), 0, out.get(), segment_pos );
+
+        // The segment size is patched in, at the end.
+    uint8 segment_head[MaxElementHeadSize];
+    size_t segment_head_len = WriteElementHead( segment_head, IdSegment, 0 );
+    WriteAll( out.get(), segment_head, segment_head_len );
+
+        // Timestamps aren't shifted, so the duration runs from 0 to the end of the range.
+    uint64 end_timecode = (duration > 0.0) ? uint64( duration * double( timecode_scale ) ) : end_ns;
+    end_timecode = std::min( end_timecode, end_ns );
+    double new_duration = double( end_timecode ) / double( timecode_scale );
+
+    for (std::vector< Level1Element >::const_iterator i = headers.begin(); i != headers.end(); ++i)
+    {
+        if (i->id == IdInfo) WriteInfo( out.get(), info, new_duration );
+        else CopyRange( in.get(), i->pos, out.get(), i->size );
+    }
+
+    const size_t first_idx = size_t( first - clusters.begin() );
+    const size_t last_idx = size_t( last - clusters.begin() );
+
+        // Clusters from the one with the earliest keyframe needed up to the first are rewritten.
+    std::map< size_t, ParsedCluster > parsed;
+    KeyframeMap keys;
+    size_t cut = first_idx;
+    if (first_idx < last_idx) cut = FindKeyframes( in.get(), clusters, first_idx, timecode_scale, start_ns, parsed, keys );
+
+    for (size_t i = cut; i < last_idx; ++i)
+    {
+        if (i <= first_idx || i + 1 == last_idx)
+        {
+            ParsedCluster &cluster = parsed[i];
+            if (cluster.data.empty()) ParseCluster( in.get(), clusters[i], cluster );
+            stats.bytesRewritten += WriteCluster( out.get(), cluster, i, timecode_scale, start_ns, end_ns, keys );
+            stats.clustersRewritten++;
+            parsed.erase( i );
+        }
+        else
+        {
+            CopyRange( in.get(), clusters[i].pos, out.get(), clusters[i].size );
+            stats.bytesCopied += clusters[i].size;
+            stats.clustersCopied++;
+        }
+    }
+
+    off_t out_size = lseek( out.get(), 0, SEEK_CUR );
+    uint8 size_field[8];
+    WriteSize8( size_field, uint64( out_size ) - segment_pos - segment_head_len );
+    if (pwrite( out.get(), size_field, sizeof( size_field ), off_t( segment_pos + segment_head_len - 8 ) ) != sizeof( size_field ))
+    {
+        throw std::runtime_error( "TrimFile(): failed to write segment size" );
+    }
+
+    return stats;
+}
+
+
+}   // namespace mkvreader
+
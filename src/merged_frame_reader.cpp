@@ -0,0 +1,142 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file merged_frame_reader.cpp
+    \brief Reads the frames of several tracks, merged in order of timecode.
+*/
+
+#include "mkvreader/merged_frame_reader.h"
+
+#include <algorithm>
+
+
+namespace mkvreader {
+
+
+    // Reversed, since the std heap functions make a max-heap.
+bool MergedFrameReader::Head::operator<( const Head &other ) const
+{
+    if (frame->timecode != other.frame->timecode) return frame->timecode > other.frame->timecode;
+    return order > other.order;
+}
+
+
+MergedFrameReader::MergedFrameReader( MatroskaParser &parser, const std::vector< uint16 > &trackIdxs )
+:   m_Parser( parser ),
+    m_Tracks( trackIdxs ),
+    m_Lookahead( 5000000000ull )
+{
+    m_Heads.reserve( m_Tracks.size() );
+    for (size_t i = 0; i < m_Tracks.size(); i++)
+    {
+        m_Parser.EnableTrack( m_Tracks[i] );
+        m_Pending.push_back( i );
+    }
+}
+
+
+MergedFrameReader::~MergedFrameReader()
+{
+    for (size_t i = 0; i < m_Heads.size(); i++) m_Parser.RecycleFrame( m_Heads[i].frame );
+}
+
+
+MatroskaFrame *MergedFrameReader::ReadFrame( uint16 &trackIdx )
+{
+    while (NeedsCluster() && ReadCluster() == 0) continue;
+
+    return TakeFrame( trackIdx );
+}
+
+
+bool MergedFrameReader::NeedsCluster()
+{
+    TakeQueuedFrames();
+    if (m_Pending.empty() || m_Parser.IsEof()) return false;
+    if (m_Heads.empty()) return true;
+
+        // The heap's front is its earliest frame.
+    return m_Parser.GetReadTimecode() < m_Heads.front().frame->timecode + m_Lookahead;
+}
+
+
+int MergedFrameReader::ReadCluster()
+{
+        // Another track's queue may be full, from the frames read while finding this one's.
+    const unsigned int maxQueueDepth = m_Parser.GetMaxQueueDepth();
+    m_Parser.SetMaxQueueDepth( 0 );
+    const int result = m_Parser.ReadCluster();
+    m_Parser.SetMaxQueueDepth( maxQueueDepth );
+    return result;
+}
+
+
+MatroskaFrame *MergedFrameReader::TakeFrame( uint16 &trackIdx )
+{
+        // Until the pending tracks have frames, or the lookahead's been read, the order
+        // isn't known.
+    if (NeedsCluster() || m_Heads.empty()) return NULL;
+
+    std::pop_heap( m_Heads.begin(), m_Heads.end() );
+    const Head head = m_Heads.back();
+    m_Heads.pop_back();
+    m_Pending.push_back( head.order );
+
+    trackIdx = head.trackIdx;
+    return head.frame;
+}
+
+
+bool MergedFrameReader::IsEnd() const
+{
+    return m_Heads.empty() && m_Pending.empty();
+}
+
+
+    // Moves the frames the parser's queued for pending tracks into the heap, without
+    // reading any more.  At EOF, those still without a frame have ended.
+void MergedFrameReader::TakeQueuedFrames()
+{
+    std::vector< size_t > pending;
+    pending.swap( m_Pending );
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        Head head;
+        head.trackIdx = m_Tracks[pending[i]];
+        head.order = pending[i];
+        head.frame = m_Parser.PeekQueuedFrame( head.trackIdx ) ? m_Parser.ReadSingleFrame( head.trackIdx ) : NULL;
+
+        if (head.frame)
+        {
+            m_Heads.push_back( head );
+            std::push_heap( m_Heads.begin(), m_Heads.end() );
+        }
+        else if (!m_Parser.IsEof()) m_Pending.push_back( pending[i] );
+    }
+}
+
+
+}   // namespace mkvreader
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file posix_io.cpp
+    \brief Helpers for positioned reads & in-kernel copies between descriptors.
+*/
+
+#include "posix_io.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#   include <sys/sendfile.h>
+#endif
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+
+namespace mkvreader {
+
+
+    // Size of each step of the in-kernel copies & of the user-space fallback buffer.
+static const size_t CopyChunkSize = 8 * 1024 * 1024;
+static const size_t FallbackBufferSize = 256 * 1024;
+
+
+static std::runtime_error IoError( const char *what )
+{
+    return std::runtime_error( boost::str( boost::format( "%s: %s" ) % what % strerror( errno ) ) );
+}
+
+
+size_t ReadAt( int fd, void *buffer, size_t size, uint64 offset )
+{
+    char *dest = static_cast< char * >( buffer );
+    size_t total = 0;
+    while (total < size)
+    {
+        ssize_t num_read = pread( fd, dest + total, size - total, off_t( offset + total ) );
+        if (num_read < 0)
+        {
+            if (errno == EINTR) continue;
+            throw IoError( "pread()" );
+        }
+        if (num_read == 0) break;
+        total += size_t( num_read );
+    }
+    return total;
+}
+
+
+void WriteAll( int out_fd, const void *buffer, size_t size )
+{
+    const char *src = static_cast< const char * >( buffer );
+    while (size > 0)
+    {
+        ssize_t num_written = write( out_fd, src, size );
+        if (num_written < 0)
+        {
+            if (errno == EINTR) continue;
+            throw IoError( "write()" );
+        }
+        src += num_written;
+        size -= size_t( num_written );
+    }
+}
+
+
+void CopyRange( int in_fd, uint64 in_offset, int out_fd, uint64 len )
+{
+#ifdef __linux__
+    bool try_copy_file_range = true;
+    bool try_sendfile = true;
+    while (len > 0)
+    {
+        size_t chunk = size_t( std::min( len, uint64( CopyChunkSize ) ) );
+        ssize_t num_copied = -1;
+        if (try_copy_file_range)
+        {
+            loff_t off_in = loff_t( in_offset );
+            num_copied = copy_file_range( in_fd, &off_in, out_fd, NULL, chunk, 0 );
+
+                // Not supported for these files (e.g. across filesystems, on older kernels).
+            if (num_copied < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+                try_copy_file_range = false;
+                continue;
+            }
+        }
+        else if (try_sendfile)
+        {
+            off_t off_in = off_t( in_offset );
+            num_copied = sendfile( out_fd, in_fd, &off_in, chunk );
+            if (num_copied < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                try_sendfile = false;
+                continue;
+            }
+        }
+        else break;
+
+        if (num_copied < 0)
+        {
+            if (errno == EINTR) continue;
+            throw IoError( "CopyRange()" );
+        }
+        if (num_copied == 0) throw std::runtime_error( "CopyRange(): unexpected end of input" );
+
+        in_offset += uint64( num_copied );
+        len -= uint64( num_copied );
+    }
+#endif
+
+    std::vector< char > buffer( size_t( std::min( len, uint64( FallbackBufferSize ) ) ) );
+    while (len > 0)
+    {
+        size_t chunk = size_t( std::min( len, uint64( buffer.size() ) ) );
+        size_t num_read = ReadAt( in_fd, &buffer.front(), chunk, in_offset );
+        if (num_read == 0) throw std::runtime_error( "CopyRange(): unexpected end of input" );
+
+        WriteAll( out_fd, &buffer.front(), num_read );
+        in_offset += num_read;
+        len -= num_read;
+    }
+}
+
+
+}   // namespace mkvreader
+
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file posix_io.h
+    \brief Helpers for positioned reads & in-kernel copies between descriptors.
+*/
+
+#ifndef _POSIX_IO_H_
+#define _POSIX_IO_H_
+
+
+#include <stddef.h>
+
+#include "ebml/EbmlTypes.h"
+
+
+namespace mkvreader {
+
+
+/// Reads up to size bytes at offset, without moving the file pointer.  Retries
+/// on short reads, so it only returns less than size at the end of the file.
+/// \throws std::runtime_error on failure.
+size_t ReadAt( int fd, void *buffer, size_t size, uint64 offset );
+
+/// Writes all of buffer at out_fd's current position.
+/// \throws std::runtime_error on failure.
+void WriteAll( int out_fd, const void *buffer, size_t size );
+
+/// Copies len bytes, starting at in_offset in in_fd, to out_fd's current position.
+/// Uses copy_file_range() or sendfile(), so the data needn't pass through user
+/// space, and falls back to pread() & write() where neither is supported.
+/// \throws std::runtime_error on failure, or if in_fd ends early.
+void CopyRange( int in_fd, uint64 in_offset, int out_fd, uint64 len );
+
+
+}   // namespace mkvreader
+
+
+#endif // _POSIX_IO_H_
@@ -0,0 +1,242 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file stream_analyzer.cpp
+    \brief Per-track bitrates, frame sizes, timing & interleaving, from a scan of the blocks.
+*/
+
+#include "mkvreader/stream_analyzer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+
+
+namespace mkvreader {
+
+
+TrackAnalysis::TrackAnalysis()
+:   trackIdx( 0 ),
+    frames( 0 ),
+    keyframes( 0 ),
+    bytes( 0 ),
+    firstTimecode( 0 ),
+    lastTimecode( 0 ),
+    avgBitrate( 0 ),
+    peakBitrate( 0 ),
+    peakTimecode( 0 ),
+    minFrameSize( 0 ),
+    maxFrameSize( 0 ),
+    frameInterval( 0 ),
+    jitter( 0 ),
+    maxQueueDepth( 0 )
+{
+}
+
+
+StreamAnalysis::StreamAnalysis()
+:   windowSize( 0 ),
+    duration( 0 ),
+    fileSize( 0 ),
+    blockBytes( 0 ),
+    attachmentBytes( 0 ),
+    overheadBytes( 0 ),
+    avgBitrate( 0 ),
+    maxInterleaveDepth( 0 ),
+    maxInterleaveTime( 0 )
+{
+}
+
+
+namespace {
+
+
+    // Accumulates what's needed for the analysis, block by block.
+class BlockAccumulator {
+public:
+    BlockAccumulator( size_t numTracks, uint64 windowSize, StreamAnalysis &analysis )
+    :   m_WindowSize( windowSize ),
+        m_Analysis( analysis ),
+        m_Timecodes( numTracks ),
+        m_WindowBytes( numTracks )
+    {
+        analysis.tracks.resize( numTracks );
+        for (size_t i = 0; i < numTracks; i++) analysis.tracks[i].trackIdx = uint16( i );
+    }
+
+    bool AddBlock( const MatroskaBlockInfo &block );
+    void Finish();
+
+private:
+    uint64 m_WindowSize;
+    StreamAnalysis &m_Analysis;
+
+        // Each track's timecodes, so far, in order.
+    std::vector< std::vector< uint64 > > m_Timecodes;
+    std::vector< std::vector< uint64 > > m_WindowBytes;
+};
+
+
+bool BlockAccumulator::AddBlock( const MatroskaBlockInfo &block )
+{
+    if (block.trackIdx >= m_Timecodes.size()) return true;
+
+    TrackAnalysis &track = m_Analysis.tracks[block.trackIdx];
+    const uint32 size = uint32( block.size );
+    if (track.frames == 0)
+    {
+        track.firstTimecode = block.timecode;
+        track.minFrameSize = size;
+    }
+    track.frames++;
+    if (block.keyframe) track.keyframes++;
+    track.bytes += size;
+    track.firstTimecode = std::min( track.firstTimecode, block.timecode );
+    track.lastTimecode = std::max( track.lastTimecode, block.timecode );
+    track.minFrameSize = std::min( track.minFrameSize, size );
+    track.maxFrameSize = std::max( track.maxFrameSize, size );
+    m_Analysis.blockBytes += size;
+    m_Analysis.duration = std::max( m_Analysis.duration, block.timecode + block.duration );
+
+    size_t bucket = 0;
+    while ((size >> (bucket + 1)) != 0) bucket++;
+    if (track.sizeHistogram.size() <= bucket) track.sizeHistogram.resize( bucket + 1 );
+    track.sizeHistogram[bucket]++;
+
+    std::vector< uint64 > &windowBytes = m_WindowBytes[block.trackIdx];
+    const size_t window = size_t( block.timecode / m_WindowSize );
+    if (windowBytes.size() <= window) windowBytes.resize( window + 1 );
+    windowBytes[window] += size;
+
+        // The frames of other tracks after this one, in time, had to be queued to get to it.
+    for (size_t other = 0; other < m_Timecodes.size(); other++)
+    {
+        const std::vector< uint64 > &timecodes = m_Timecodes[other];
+        if (other == block.trackIdx || timecodes.empty()) continue;
+
+        TrackAnalysis &otherTrack = m_Analysis.tracks[other];
+        const uint64 depth = timecodes.end() - std::upper_bound( timecodes.begin(), timecodes.end(), block.timecode );
+        otherTrack.maxQueueDepth = std::max( otherTrack.maxQueueDepth, depth );
+        if (timecodes.back() > block.timecode)
+        {
+            m_Analysis.maxInterleaveTime = std::max( m_Analysis.maxInterleaveTime, timecodes.back() - block.timecode );
+        }
+    }
+
+        // Blocks are nearly in order, so this is usually an append.
+    std::vector< uint64 > &timecodes = m_Timecodes[block.trackIdx];
+    timecodes.insert( std::upper_bound( timecodes.begin(), timecodes.end(), block.timecode ), block.timecode );
+    return true;
+}
+
+
+void BlockAccumulator::Finish()
+{
+    const double seconds = double( m_Analysis.duration ) / 1000000000.0;
+    const double windowSeconds = double( m_WindowSize ) / 1000000000.0;
+    const size_t numWindows = size_t( (m_Analysis.duration + m_WindowSize - 1) / m_WindowSize );
+    if (seconds > 0) m_Analysis.avgBitrate = double( m_Analysis.blockBytes ) * 8 / seconds;
+
+    for (size_t i = 0; i < m_Analysis.tracks.size(); i++)
+    {
+        TrackAnalysis &track = m_Analysis.tracks[i];
+        if (seconds > 0) track.avgBitrate = double( track.bytes ) * 8 / seconds;
+        m_Analysis.maxInterleaveDepth = std::max( m_Analysis.maxInterleaveDepth, track.maxQueueDepth );
+
+        const std::vector< uint64 > &windowBytes = m_WindowBytes[i];
+        track.bitrates.assign( std::max( numWindows, windowBytes.size() ), 0.0 );
+        for (size_t w = 0; w < windowBytes.size(); w++)
+        {
+            track.bitrates[w] = double( windowBytes[w] ) * 8 / windowSeconds;
+            if (track.bitrates[w] > track.peakBitrate)
+            {
+                track.peakBitrate = track.bitrates[w];
+                track.peakTimecode = w * m_WindowSize;
+            }
+        }
+
+        const std::vector< uint64 > &timecodes = m_Timecodes[i];
+        if (timecodes.size() < 2) continue;
+
+        std::vector< uint64 > intervals( timecodes.size() - 1 );
+        double sum = 0;
+        for (size_t f = 0; f < intervals.size(); f++)
+        {
+            intervals[f] = timecodes[f + 1] - timecodes[f];
+            sum += double( intervals[f] );
+        }
+
+        const double mean = sum / intervals.size();
+        double variance = 0;
+        for (size_t f = 0; f < intervals.size(); f++)
+        {
+            const double deviation = double( intervals[f] ) - mean;
+            variance += deviation * deviation;
+        }
+        track.jitter = std::sqrt( variance / intervals.size() );
+
+        std::vector< uint64 > sorted( intervals );
+        std::nth_element( sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end() );
+        track.frameInterval = sorted[sorted.size() / 2];
+
+        for (size_t f = 0; f < intervals.size(); f++)
+        {
+            if (intervals[f] <= 2 * track.frameInterval) continue;
+
+            TimestampGap gap = { timecodes[f], intervals[f] };
+            track.gaps.push_back( gap );
+        }
+    }
+}
+
+
+}   // namespace
+
+
+bool AnalyzeStream( MatroskaParser &parser, uint64 windowSize, StreamAnalysis &analysis )
+{
+    analysis = StreamAnalysis();
+    analysis.windowSize = std::max( windowSize, uint64( 1 ) );
+    analysis.fileSize = parser.GetFileSize();
+
+    const MatroskaParser::attachment_list &attachments = parser.GetAttachmentList();
+    for (MatroskaParser::attachment_list::const_iterator attachment = attachments.begin(); attachment != attachments.end(); ++attachment)
+    {
+        analysis.attachmentBytes += attachment->SourceDataLength;
+    }
+
+    BlockAccumulator accumulator( parser.GetTrackCount(), analysis.windowSize, analysis );
+    if (!parser.ScanBlocks( boost::bind( &BlockAccumulator::AddBlock, &accumulator, _1 ) )) return false;
+    accumulator.Finish();
+
+    const uint64 counted = analysis.blockBytes + analysis.attachmentBytes;
+    analysis.overheadBytes = (analysis.fileSize > counted) ? analysis.fileSize - counted : 0;
+    return true;
+}
+
+
+}   // namespace mkvreader
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file timebase.cpp
+    \brief Exact integer conversions between timebases.
+*/
+
+#include "mkvreader/timebase.h"
+
+#include <cmath>
+#include <limits>
+
+
+namespace mkvreader {
+
+
+uint64 MulDiv( uint64 a, uint64 b, uint64 c )
+{
+    const uint64 round = c / 2;
+    if ((a >> 32) == 0 && (b >> 32) == 0)
+    {
+            // The product fits, but adding round to it mightn't, for large c.
+        const uint64 product = a * b;
+        if (product <= std::numeric_limits< uint64 >::max() - round) return (product + round) / c;
+    }
+
+#ifdef __SIZEOF_INT128__
+    return uint64( ((unsigned __int128)( a ) * b + round) / c );
+#else
+        // Form the 128-bit product in two halves, then divide one bit at a time.
+    const uint64 a0 = a & 0xffffffff, a1 = a >> 32;
+    const uint64 b0 = b & 0xffffffff, b1 = b >> 32;
+
+    const uint64 mid1 = a0 * b1;
+    const uint64 mid = mid1 + a1 * b0;
+    const uint64 mid_carry = (mid < mid1) ? (uint64( 1 ) << 32) : 0;
+
+    uint64 lo = a0 * b0;
+    uint64 hi = a1 * b1 + (mid >> 32) + mid_carry;
+    lo += mid << 32;
+    hi += (lo < (mid << 32));
+    lo += round;
+    hi += (lo < round);
+
+    uint64 quotient = 0;
+    for (int i = 63; i >= 0; i--)
+    {
+        const bool top = (hi >> 63) != 0;
+        hi = (hi << 1) | ((lo >> i) & 1);
+        quotient <<= 1;
+        if (top || hi >= c)
+        {
+            hi -= c;
+            quotient |= 1;
+        }
+    }
+    return quotient;
+#endif
+}
+
+
+Rational ApproximateRational( double value, uint32 max_den )
+{
+    if (!(value > 0.0)) return Rational( 0, 1 );
+
+        // Walk the continued fraction's convergents, until they're exact or too big.
+    uint64 num0 = 0, den0 = 1, num1 = 1, den1 = 0;
+    double x = value;
+    for (int i = 0; i < 64; i++)
+    {
+        const double whole = floor( x );
+        if (whole > double( 0xffffffffu )) break;
+
+        const uint64 a = uint64( whole );
+        const uint64 num2 = a * num1 + num0;
+        const uint64 den2 = a * den1 + den0;
+        if (num2 > 0xffffffffu || den2 > max_den) break;
+
+        num0 = num1; den0 = den1;
+        num1 = num2; den1 = den2;
+
+        const double fraction = x - whole;
+        if (fraction < 1e-12) break;
+        x = 1.0 / fraction;
+    }
+
+    if (den1 == 0) return Rational( 0xffffffffu, 1 );
+    return Rational( uint32( num1 ), uint32( den1 ) );
+}
+
+
+}   // namespace mkvreader
+
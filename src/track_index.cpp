@@ -0,0 +1,308 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+/*!
+    \file track_index.cpp
+    \brief A compact index of a track's frames, by number & by time.
+*/
+
+#include "mkvreader/track_index.h"
+
+#include <istream>
+#include <ostream>
+#include <algorithm>
+
+
+namespace mkvreader {
+
+
+static void PutVarint( std::vector< uint8 > &out, uint64 value )
+{
+    while (value >= 0x80)
+    {
+        out.push_back( uint8( value | 0x80 ) );
+        value >>= 7;
+    }
+    out.push_back( uint8( value ) );
+}
+
+    // Fails rather than read past end, or beyond 64 bits.
+static bool GetVarint( const uint8 *&p, const uint8 *end, uint64 &value )
+{
+    value = 0;
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        const uint8 byte = *p++;
+        value |= uint64( byte & 0x7f ) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64 ZigZag( int64 value )
+{
+    return (uint64( value ) << 1) ^ uint64( value >> 63 );
+}
+
+static int64 UnZigZag( uint64 value )
+{
+    return int64( value >> 1 ) ^ -int64( value & 1 );
+}
+
+
+TrackIndex::TrackIndex()
+:
+    m_Count( 0 ),
+    m_KeyframesOnly( false )
+{
+    m_Last.duration = 0;
+}
+
+
+void TrackIndex::Append( const FrameLocation &frame )
+{
+    if (m_Count % ChunkSize == 0)
+    {
+        Chunk chunk = { frame, frame.timecode, uint32( m_Data.size() ) };
+        m_Chunks.push_back( chunk );
+        m_Last.duration = 0;
+    }
+    else
+    {
+            // Each entry: change in duration, gap since the previous frame's end, and size with the keyframe flag.
+        const int64 duration = int64( frame.timecode - m_Last.frame.timecode );
+        PutVarint( m_Data, ZigZag( duration - m_Last.duration ) );
+        PutVarint( m_Data, ZigZag( int64( frame.filePos - (m_Last.frame.filePos + m_Last.frame.size) ) ) );
+        PutVarint( m_Data, (uint64( frame.size ) << 1) | (frame.keyframe ? 1 : 0) );
+        m_Last.duration = duration;
+
+        Chunk &chunk = m_Chunks.back();
+        chunk.lastTimecode = std::max( chunk.lastTimecode, frame.timecode );
+    }
+
+    m_Last.frame = frame;
+    m_Count++;
+}
+
+
+const uint8 *TrackIndex::GetData( size_t offset ) const
+{
+    return m_Data.empty() ? NULL : &m_Data.front() + offset;
+}
+
+
+bool TrackIndex::Advance( Cursor &cursor, const uint8 *&p ) const
+{
+    const uint8 *data_end = GetData( m_Data.size() );
+    uint64 duration = 0, gap = 0, size = 0;
+    if (!GetVarint( p, data_end, duration ) || !GetVarint( p, data_end, gap ) || !GetVarint( p, data_end, size )) return false;
+
+    cursor.duration += UnZigZag( duration );
+    const uint64 end = cursor.frame.filePos + cursor.frame.size;
+    cursor.frame.timecode += uint64( cursor.duration );
+    cursor.frame.filePos = end + uint64( UnZigZag( gap ) );
+    cursor.frame.size = uint32( size >> 1 );
+    cursor.frame.keyframe = (size & 1) != 0;
+    return true;
+}
+
+
+FrameLocation TrackIndex::GetFrame( size_t frame_number ) const
+{
+    const Chunk &chunk = m_Chunks.at( frame_number / ChunkSize );
+    Cursor cursor = { chunk.first, 0 };
+    const uint8 *p = GetData( chunk.dataOffset );
+    for (size_t i = frame_number % ChunkSize; i > 0 && Advance( cursor, p ); i--) {}
+    return cursor.frame;
+}
+
+
+static bool ChunkStartsAfter( uint64 timecode, const FrameLocation &first )
+{
+    return timecode < first.timecode;
+}
+
+size_t TrackIndex::FindFrame( uint64 timecode ) const
+{
+    if (m_Chunks.empty()) return npos;
+
+        // Find the last chunk starting at or before timecode.  With B-frames, timecodes
+        // aren't in file order, so that chunk & the next are walked in full.
+    size_t lo = 0, hi = m_Chunks.size();
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (ChunkStartsAfter( timecode, m_Chunks[mid].first )) hi = mid;
+        else lo = mid + 1;
+    }
+
+    const size_t first_chunk = (lo == 0) ? 0 : lo - 1;
+    const size_t end_chunk = std::min( first_chunk + 2, m_Chunks.size() );
+    size_t found = npos;
+    for (size_t chunk_number = first_chunk; chunk_number < end_chunk; chunk_number++)
+    {
+        const Chunk &chunk = m_Chunks[chunk_number];
+        const size_t first = chunk_number * ChunkSize;
+        const size_t end = std::min( first + ChunkSize, m_Count );
+        if (chunk.lastTimecode <= timecode)
+        {
+            found = end - 1;
+            continue;
+        }
+
+        Cursor cursor = { chunk.first, 0 };
+        const uint8 *p = GetData( chunk.dataOffset );
+        if (cursor.frame.timecode <= timecode) found = first;
+        for (size_t i = first + 1; i < end && Advance( cursor, p ); i++)
+        {
+            if (cursor.frame.timecode <= timecode) found = i;
+        }
+    }
+    return found;
+}
+
+
+size_t TrackIndex::FindKeyframe( size_t frame_number ) const
+{
+    if (frame_number >= m_Count) return npos;
+
+    for (size_t chunk_number = frame_number / ChunkSize + 1; chunk_number-- > 0; )
+    {
+        const Chunk &chunk = m_Chunks[chunk_number];
+        const size_t first = chunk_number * ChunkSize;
+        const size_t last = std::min( frame_number, first + ChunkSize - 1 );
+
+        size_t found = chunk.first.keyframe ? first : npos;
+        Cursor cursor = { chunk.first, 0 };
+        const uint8 *p = GetData( chunk.dataOffset );
+        for (size_t i = first + 1; i <= last && Advance( cursor, p ); i++)
+        {
+            if (cursor.frame.keyframe) found = i;
+        }
+        if (found != npos) return found;
+    }
+    return npos;
+}
+
+
+void TrackIndex::Compact()
+{
+    std::vector< Chunk >( m_Chunks ).swap( m_Chunks );
+    std::vector< uint8 >( m_Data ).swap( m_Data );
+}
+
+
+size_t TrackIndex::GetMemoryUsage() const
+{
+    return m_Chunks.capacity() * sizeof( Chunk ) + m_Data.capacity();
+}
+
+
+template< typename T > static void WriteRaw( std::ostream &out, const T &value )
+{
+    out.write( reinterpret_cast< const char * >( &value ), sizeof( value ) );
+}
+
+template< typename T > static bool ReadRaw( std::istream &in, T &value )
+{
+    return !!in.read( reinterpret_cast< char * >( &value ), sizeof( value ) );
+}
+
+
+    // The layout is native-endian, since sidecars are only meant for the machine that made them.
+void TrackIndex::Write( std::ostream &out ) const
+{
+    WriteRaw( out, uint64( m_Count ) );
+    WriteRaw( out, uint8( m_KeyframesOnly ) );
+    WriteRaw( out, uint64( m_Chunks.size() ) );
+    for (std::vector< Chunk >::const_iterator chunk = m_Chunks.begin(); chunk != m_Chunks.end(); ++chunk)
+    {
+        WriteRaw( out, chunk->first.timecode );
+        WriteRaw( out, chunk->first.filePos );
+        WriteRaw( out, chunk->first.size );
+        WriteRaw( out, uint8( chunk->first.keyframe ) );
+        WriteRaw( out, chunk->lastTimecode );
+        WriteRaw( out, chunk->dataOffset );
+    }
+    WriteRaw( out, uint64( m_Data.size() ) );
+    if (!m_Data.empty()) out.write( reinterpret_cast< const char * >( &m_Data.front() ), m_Data.size() );
+}
+
+
+bool TrackIndex::Read( std::istream &in )
+{
+    uint64 count = 0, num_chunks = 0, data_size = 0;
+    uint8 keyframes_only = 0;
+    if (!ReadRaw( in, count ) || !ReadRaw( in, keyframes_only ) || !ReadRaw( in, num_chunks )) return false;
+    if (num_chunks != (count + ChunkSize - 1) / ChunkSize) return false;
+
+    std::vector< Chunk > chunks( static_cast< size_t >( num_chunks ) );
+    for (std::vector< Chunk >::iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+    {
+        uint8 keyframe = 0;
+        if (!ReadRaw( in, chunk->first.timecode ) || !ReadRaw( in, chunk->first.filePos )
+            || !ReadRaw( in, chunk->first.size ) || !ReadRaw( in, keyframe )
+            || !ReadRaw( in, chunk->lastTimecode ) || !ReadRaw( in, chunk->dataOffset )) return false;
+        chunk->first.keyframe = (keyframe != 0);
+    }
+
+    std::vector< uint8 > data;
+    if (!ReadRaw( in, data_size )) return false;
+    data.resize( size_t( data_size ) );
+    if (!data.empty() && !in.read( reinterpret_cast< char * >( &data.front() ), data.size() )) return false;
+
+    m_Chunks.swap( chunks );
+    m_Data.swap( data );
+    m_Count = size_t( count );
+    m_KeyframesOnly = (keyframes_only != 0);
+
+        // Check that every entry can be decoded, so lookups needn't.
+    for (size_t chunk_number = 0; chunk_number < m_Chunks.size(); chunk_number++)
+    {
+        const Chunk &chunk = m_Chunks[chunk_number];
+        bool valid = (chunk.dataOffset <= m_Data.size());
+        Cursor cursor = { chunk.first, 0 };
+        const uint8 *p = GetData( chunk.dataOffset );
+        const size_t first = chunk_number * ChunkSize;
+        for (size_t i = first + 1; valid && i < std::min( first + ChunkSize, m_Count ); i++) valid = Advance( cursor, p );
+        if (!valid)
+        {
+            *this = TrackIndex();
+            return false;
+        }
+    }
+
+        // Appending resumes from the last frame.
+    if (m_Count > 0)
+    {
+        m_Last.frame = GetFrame( m_Count - 1 );
+        m_Last.duration = (m_Count % ChunkSize == 1) ? 0
+            : int64( m_Last.frame.timecode - GetFrame( m_Count - 2 ).timecode );
+    }
+    return true;
+}
+
+
+}   // namespace mkvreader
+
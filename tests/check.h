@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file check.h
+    \brief Minimal assertions for the tests, which report every failure, not just the first.
+*/
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+
+#include <iostream>
+
+
+namespace mkvreader {
+
+
+inline int &CheckFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+
+#define CHECK( expr ) \
+    do { \
+        if (!(expr)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK( " #expr " ) failed\n"; \
+            mkvreader::CheckFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL( actual, expected ) \
+    do { \
+        if (!((actual) == (expected))) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQUAL( " #actual ", " #expected " ) failed: " \
+                << (actual) << " != " << (expected) << "\n"; \
+            mkvreader::CheckFailures()++; \
+        } \
+    } while (0)
+
+
+/// The exit status of a test program.
+inline int CheckResult()
+{
+    if (CheckFailures() != 0) std::cerr << CheckFailures() << " check(s) failed\n";
+    return (CheckFailures() == 0) ? 0 : 1;
+}
+
+
+}   // namespace mkvreader
+
+
+#endif // _CHECK_H_
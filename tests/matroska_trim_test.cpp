@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file matroska_trim_test.cpp
+    \brief Checks the blocks & Duration of the files TrimFile() writes.
+*/
+
+#include "mkvreader/matroska_trim.h"
+#include "ebml_util.h"
+#include "mkv_fixture.h"
+#include "check.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+using namespace mkvreader;
+
+
+/// A block found in a trimmed file.
+struct FoundBlock {
+    uint64 track;
+    uint64 timecode;    ///< In ms.
+    bool keyframe;
+};
+
+/// What a trimmed file holds.
+struct TrimmedFile {
+    TrimmedFile(): duration( 0.0 ) {}
+
+    double duration;    ///< Info/Duration, in ms.
+    std::vector< FoundBlock > blocks;
+};
+
+
+    // Walks the Segment's children, then those of its Info & clusters.
+static TrimmedFile ReadTrimmedFile( const std::string &filename )
+{
+    std::ifstream in( filename.c_str(), std::ios::binary );
+    const std::vector< uint8 > data( (std::istreambuf_iterator< char >( in )), std::istreambuf_iterator< char >() );
+
+    TrimmedFile file;
+    ElementHead head;
+    if (!ReadElementHead( &data[0], data.size(), head ) || head.id != IdEbmlHead) return file;
+
+    size_t pos = head.headSize + size_t( head.size );
+    if (!ReadElementHead( &data[pos], data.size() - pos, head ) || head.id != IdSegment) return file;
+
+    for (pos += head.headSize; pos < data.size(); pos += head.headSize + size_t( head.size ))
+    {
+        if (!ReadElementHead( &data[pos], data.size() - pos, head )) break;
+        if (head.id != IdInfo && head.id != IdCluster) continue;
+
+        uint64 clusterTimecode = 0;
+        const size_t end = pos + head.headSize + size_t( head.size );
+        ElementHead child;
+        for (size_t p = pos + head.headSize; p < end; p += child.headSize + size_t( child.size ))
+        {
+            if (!ReadElementHead( &data[p], end - p, child )) break;
+
+            const uint8 *value = &data[p + child.headSize];
+            if (child.id == IdDuration) file.duration = ReadFloat( value, size_t( child.size ) );
+            else if (child.id == IdClusterTimecode) clusterTimecode = ReadUInt( value, size_t( child.size ) );
+            else if (child.id == IdSimpleBlock)
+            {
+                FoundBlock block;
+                const unsigned int len = ReadVint( value, size_t( child.size ), block.track );
+                block.timecode = clusterTimecode + int16( (value[len] << 8) | value[len + 1] );
+                block.keyframe = (value[len + 2] & 0x80) != 0;
+                file.blocks.push_back( block );
+            }
+        }
+    }
+    return file;
+}
+
+
+    // Returns the timecodes of track's blocks, in file order.
+static std::vector< uint64 > GetTimecodes( const TrimmedFile &file, uint64 track )
+{
+    std::vector< uint64 > timecodes;
+    for (size_t i = 0; i < file.blocks.size(); i++)
+    {
+        if (file.blocks[i].track == track) timecodes.push_back( file.blocks[i].timecode );
+    }
+    return timecodes;
+}
+
+static std::vector< uint64 > MakeTimecodes( uint64 first, uint64 end )
+{
+    std::vector< uint64 > timecodes;
+    for (uint64 timecode = first; timecode < end; timecode += 250) timecodes.push_back( timecode );
+    return timecodes;
+}
+
+
+    // Trims the fixture to [start_ms, end_ms), & checks that each track starts from its
+    // last keyframe at or before start_ms (video_key_ms, for video; start_ms for audio).
+static void CheckTrim( const std::string &source, uint64 start_ms, uint64 end_ms, uint64 video_key_ms )
+{
+    const std::string trimmed = source + ".trimmed";
+    TrimFile( source.c_str(), trimmed.c_str(), start_ms * 1000000, end_ms * 1000000 );
+    const TrimmedFile file = ReadTrimmedFile( trimmed );
+    remove( trimmed.c_str() );
+
+    CHECK_EQUAL( file.duration, double( end_ms ) );
+    CHECK( GetTimecodes( file, 1 ) == MakeTimecodes( video_key_ms, end_ms ) );
+    CHECK( GetTimecodes( file, 2 ) == MakeTimecodes( start_ms, end_ms ) );
+
+    for (size_t i = 0; i < file.blocks.size(); i++)
+    {
+        const FoundBlock &block = file.blocks[i];
+        CHECK_EQUAL( block.keyframe, block.track == 2 || block.timecode % 3000 == 0 );
+    }
+
+        // The first video block is the keyframe that the rest depend on.
+    const std::vector< uint64 > video = GetTimecodes( file, 1 );
+    CHECK( !video.empty() && video.front() == video_key_ms );
+}
+
+
+static void TestTrims()
+{
+    const std::string source = WriteTempFile( "matroska_trim_test", MakeFixture( MakeClusters( 10 ), 10000.0, false ) );
+
+        // The keyframe is 2 clusters before the one holding the start.
+    CheckTrim( source, 5500, 8500, 3000 );
+        // The start is a keyframe.
+    CheckTrim( source, 6000, 7000, 6000 );
+        // The range ends within the first cluster.
+    CheckTrim( source, 250, 750, 0 );
+
+    const std::string trimmed = source + ".trimmed";
+    const TrimStats stats = TrimFile( source.c_str(), trimmed.c_str(), 5500000000ull, 8500000000ull );
+    remove( trimmed.c_str() );
+    CHECK_EQUAL( stats.clustersRewritten, uint64( 4 ) );    // 3-5 & 8.
+    CHECK_EQUAL( stats.clustersCopied, uint64( 2 ) );       // 6 & 7.
+
+    remove( source.c_str() );
+}
+
+
+    // Without a Duration in the source, the range's end is used.
+static void TestNoDuration()
+{
+    const std::string source = WriteTempFile( "matroska_trim_test", MakeFixture( MakeClusters( 4 ), 0.0, true ) );
+    CheckTrim( source, 1250, 2500, 0 );
+    remove( source.c_str() );
+}
+
+
+int main()
+{
+    TestTrims();
+    TestNoDuration();
+    return CheckResult();
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file measure_duration_test.cpp
+    \brief Checks MatroskaParser::MeasureDuration() on files without a usable Duration.
+*/
+
+#include "mkvreader/matroska_parser.h"
+#include "mkv_fixture.h"
+#include "check.h"
+
+#include <cstdio>
+#include <algorithm>
+
+
+using namespace mkvreader;
+
+
+    // Parses a fixture, measuring its duration if it has none, then removes it.
+static void CheckParsed( const std::vector< uint8 > &data, double duration, duration_source source, bool measure = true )
+{
+    const std::string filename = WriteTempFile( "measure_duration_test", data );
+    {
+        MatroskaParser parser( filename.c_str() );
+        parser.SetMeasureMissingDuration( measure );
+        CHECK_EQUAL( parser.Parse(), 0 );
+        CHECK_EQUAL( parser.GetDuration(), duration );
+        CHECK_EQUAL( parser.GetDurationSource(), source );
+    }
+    remove( filename.c_str() );
+}
+
+
+    // The last frame (video, at 9750ms) ends at 10s, by its DefaultDuration.
+static void TestComplete()
+{
+    CheckParsed( MakeFixture( MakeClusters( 10 ), 10000.0, false ), 10.0, duration_from_info );
+    CheckParsed( MakeFixture( MakeClusters( 10 ), 0.0, false ), 10.0, duration_measured );
+    CheckParsed( MakeFixture( MakeClusters( 10 ), 0.0, true ), 10.0, duration_measured );
+
+        // Only when asked.
+    CheckParsed( MakeFixture( MakeClusters( 10 ), 0.0, false ), 0.0, duration_unknown, false );
+}
+
+
+    // As if recording stopped in the middle of writing the video frame at 9500ms.  Its
+    // header's there, so it counts, but nothing after it does.
+static void TestTruncated()
+{
+    std::vector< uint8 > data = MakeFixture( MakeClusters( 10 ), 0.0, true );
+
+        // SimpleBlock (604 bytes) of track 1, at 500ms into the last cluster, not a keyframe.
+    const uint8 header[] = { 0xA3, 0x42, 0x5C, 0x81, 0x01, 0xF4, 0x00 };
+    std::vector< uint8 >::iterator block = std::find_end( data.begin(), data.end(), header, header + sizeof( header ) );
+    CHECK( block != data.end() );
+    data.erase( block + sizeof( header ) + 100, data.end() );
+
+    CheckParsed( data, 9.75, duration_measured );
+}
+
+
+    // A Duration that can't be trusted is replaced, when asked.
+static void TestRemeasured()
+{
+    const std::string filename = WriteTempFile( "measure_duration_test", MakeFixture( MakeClusters( 10 ), 60000.0, false ) );
+    {
+        MatroskaParser parser( filename.c_str() );
+        CHECK_EQUAL( parser.Parse(), 0 );
+        CHECK_EQUAL( parser.GetDuration(), 60.0 );
+        CHECK( parser.MeasureDuration() );
+        CHECK_EQUAL( parser.GetDuration(), 10.0 );
+        CHECK_EQUAL( parser.GetDurationSource(), duration_measured );
+    }
+    remove( filename.c_str() );
+}
+
+
+int main()
+{
+    TestComplete();
+    TestTruncated();
+    TestRemeasured();
+    return CheckResult();
+}
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file mkv_fixture.cpp
+    \brief Builds small Matroska files for the tests.
+*/
+
+#include "mkv_fixture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+
+namespace mkvreader {
+
+
+typedef std::vector< uint8 > Bytes;
+
+static const uint64 UnknownSize = ~uint64( 0 );
+
+
+static void PutId( Bytes &out, uint32 id )
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        if ((id >> shift) != 0) out.push_back( uint8( id >> shift ) );
+    }
+}
+
+    // The shortest encoding of size, or the 8-byte "unknown" one.
+static void PutSize( Bytes &out, uint64 size )
+{
+    if (size == UnknownSize)
+    {
+        out.push_back( 0x01 );
+        out.insert( out.end(), 7, 0xff );
+        return;
+    }
+
+    unsigned int len = 1;
+    while (len < 8 && size >= (uint64( 1 ) << (7 * len)) - 1) len++;
+    for (unsigned int i = len; i-- > 0; )
+    {
+        uint8 byte = uint8( size >> (8 * i) );
+        if (i == len - 1) byte |= uint8( 0x80 >> (len - 1) );
+        out.push_back( byte );
+    }
+}
+
+static void PutElement( Bytes &out, uint32 id, const Bytes &data, uint64 size )
+{
+    PutId( out, id );
+    PutSize( out, size );
+    out.insert( out.end(), data.begin(), data.end() );
+}
+
+static void PutElement( Bytes &out, uint32 id, const Bytes &data )
+{
+    PutElement( out, id, data, data.size() );
+}
+
+static void PutUInt( Bytes &out, uint32 id, uint64 value )
+{
+    Bytes data;
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+        if (!data.empty() || (value >> shift) != 0 || shift == 0) data.push_back( uint8( value >> shift ) );
+    }
+    PutElement( out, id, data );
+}
+
+static void PutFloat( Bytes &out, uint32 id, double value )
+{
+    uint64 bits;
+    memcpy( &bits, &value, sizeof( bits ) );
+    Bytes data;
+    for (int shift = 56; shift >= 0; shift -= 8) data.push_back( uint8( bits >> shift ) );
+    PutElement( out, id, data );
+}
+
+static void PutString( Bytes &out, uint32 id, const std::string &value )
+{
+    PutElement( out, id, Bytes( value.begin(), value.end() ) );
+}
+
+
+static Bytes MakeTrack( uint64 number, uint64 type, const char *codec )
+{
+    Bytes entry;
+    PutUInt( entry, 0xD7, number );         // TrackNumber
+    PutUInt( entry, 0x73C5, number );       // TrackUID
+    PutUInt( entry, 0x83, type );           // TrackType
+    PutString( entry, 0x86, codec );        // CodecID
+
+    Bytes settings;
+    if (type == 1)
+    {
+        PutUInt( entry, 0x23E383, 250000000 );  // DefaultDuration
+        PutUInt( settings, 0xB0, 320 );     // PixelWidth
+        PutUInt( settings, 0xBA, 240 );     // PixelHeight
+        PutElement( entry, 0xE0, settings );    // Video
+    }
+    else
+    {
+        PutFloat( settings, 0xB5, 48000.0 );    // SamplingFrequency
+        PutUInt( settings, 0x9F, 2 );       // Channels
+        PutElement( entry, 0xE1, settings );    // Audio
+    }
+
+    Bytes track;
+    PutElement( track, 0xAE, entry );       // TrackEntry
+    return track;
+}
+
+
+Bytes MakeFixture( const std::vector< FixtureCluster > &clusters, double duration_ms, bool unknown_size )
+{
+    Bytes head;
+    PutUInt( head, 0x4286, 1 );             // EBMLVersion
+    PutUInt( head, 0x42F7, 1 );             // EBMLReadVersion
+    PutUInt( head, 0x42F2, 4 );             // EBMLMaxIDLength
+    PutUInt( head, 0x42F3, 8 );             // EBMLMaxSizeLength
+    PutString( head, 0x4282, "matroska" );  // DocType
+    PutUInt( head, 0x4287, 2 );             // DocTypeVersion
+    PutUInt( head, 0x4285, 2 );             // DocTypeReadVersion
+
+    Bytes info;
+    PutUInt( info, 0x2AD7B1, 1000000 );     // TimecodeScale
+    if (duration_ms > 0.0) PutFloat( info, 0x4489, duration_ms );
+    PutString( info, 0x4D80, "mkv_fixture" );   // MuxingApp
+    PutString( info, 0x5741, "mkv_fixture" );   // WritingApp
+
+    Bytes tracks = MakeTrack( 1, 1, "V_MJPEG" );
+    const Bytes audio = MakeTrack( 2, 2, "A_PCM/INT/LIT" );
+    tracks.insert( tracks.end(), audio.begin(), audio.end() );
+
+    Bytes segment;
+    PutElement( segment, 0x1549A966, info );    // Info
+    PutElement( segment, 0x1654AE6B, tracks );  // Tracks
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        const FixtureCluster &blocks = clusters[c];
+        const uint64 timecode = blocks.empty() ? 0 : blocks.front().timecode;
+
+        Bytes cluster;
+        PutUInt( cluster, 0xE7, timecode );     // Timecode
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+            const int16 relative = int16( int64( blocks[b].timecode ) - int64( timecode ) );
+            Bytes block;
+            PutSize( block, blocks[b].track );
+            block.push_back( uint8( uint16( relative ) >> 8 ) );
+            block.push_back( uint8( relative ) );
+            block.push_back( blocks[b].keyframe ? 0x80 : 0x00 );
+            block.insert( block.end(), blocks[b].size, uint8( blocks[b].track ) );
+            PutElement( cluster, 0xA3, block ); // SimpleBlock
+        }
+        PutElement( segment, 0x1F43B675, cluster );
+    }
+
+    Bytes file;
+    PutElement( file, 0x1A45DFA3, head );       // EBML
+    PutElement( file, 0x18538067, segment, unknown_size ? UnknownSize : segment.size() );
+    return file;
+}
+
+
+std::vector< FixtureCluster > MakeClusters( size_t num_clusters )
+{
+    std::vector< FixtureCluster > clusters( num_clusters );
+    for (size_t c = 0; c < num_clusters; c++)
+    {
+        for (uint64 timecode = c * 1000; timecode < (c + 1) * 1000; timecode += 250)
+        {
+            const FixtureBlock video = { 1, timecode, timecode % 3000 == 0, 600 };
+            const FixtureBlock audio = { 2, timecode, true, 200 };
+            clusters[c].push_back( video );
+            clusters[c].push_back( audio );
+        }
+    }
+    return clusters;
+}
+
+
+std::string WriteTempFile( const char *prefix, const Bytes &data )
+{
+    std::string filename = std::string( "/tmp/" ) + prefix + ".XXXXXX";
+    const int fd = mkstemp( &filename[0] );
+    if (fd < 0) throw std::runtime_error( "WriteTempFile(): mkstemp() failed" );
+
+    const bool ok = data.empty() || write( fd, &data.front(), data.size() ) == ssize_t( data.size() );
+    close( fd );
+    if (!ok) throw std::runtime_error( "WriteTempFile(): write() failed" );
+    return filename;
+}
+
+
+}   // namespace mkvreader
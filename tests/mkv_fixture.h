@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file mkv_fixture.h
+    \brief Builds small Matroska files for the tests.
+*/
+
+#ifndef _MKV_FIXTURE_H_
+#define _MKV_FIXTURE_H_
+
+
+#include "ebml/EbmlTypes.h"
+
+#include <string>
+#include <vector>
+
+
+namespace mkvreader {
+
+
+/// A SimpleBlock of a fixture.  Its payload is size bytes of the track number.
+struct FixtureBlock {
+    uint64 track;
+    uint64 timecode;        ///< In ms, which is the fixture's timecode scale.
+    bool keyframe;
+    size_t size;
+};
+
+/// A cluster of a fixture, which starts at the timecode of its first block.
+typedef std::vector< FixtureBlock > FixtureCluster;
+
+
+/// Returns a file with an EBML header, then a Segment holding Info, Tracks & clusters.
+/// Track 1 is video (V_MJPEG), with a DefaultDuration of 250ms, & track 2 is audio
+/// (A_PCM/INT/LIT).  There's no SeekHead or Cues.
+/// \param duration_ms the Info/Duration, or 0 to leave it out.
+/// \param unknown_size whether the Segment's size is left unknown, as by a recorder
+/// that was interrupted.
+std::vector< uint8 > MakeFixture( const std::vector< FixtureCluster > &clusters, double duration_ms, bool unknown_size );
+
+/// Returns num_clusters clusters of 1s, each holding a video & an audio block every
+/// 250ms.  Audio blocks are all keyframes; video has a keyframe every 3s.
+std::vector< FixtureCluster > MakeClusters( size_t num_clusters );
+
+/// Writes data to a new file in /tmp, & returns its name.
+std::string WriteTempFile( const char *prefix, const std::vector< uint8 > &data );
+
+
+}   // namespace mkvreader
+
+
+#endif // _MKV_FIXTURE_H_
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file timebase_test.cpp
+    \brief Checks MulDiv() & the timebase conversions built on it.
+*/
+
+#include "mkvreader/timebase.h"
+#include "check.h"
+
+
+using namespace mkvreader;
+
+
+static void TestMulDiv()
+{
+    CHECK_EQUAL( MulDiv( 10, 3, 5 ), uint64( 6 ) );
+    CHECK_EQUAL( MulDiv( 10, 3, 4 ), uint64( 8 ) );     // 7.5 rounds up.
+    CHECK_EQUAL( MulDiv( 1, 1, 3 ), uint64( 0 ) );
+
+        // The product overflows 64 bits, but the result doesn't.
+    const uint64 big = uint64( 1 ) << 62;
+    CHECK_EQUAL( MulDiv( big, 1000000000, 1000000000 ), big );
+    CHECK_EQUAL( MulDiv( big, 3, 6 ), big / 2 );
+    CHECK_EQUAL( MulDiv( 0xffffffffffffffffull, 0xffffffffffffffffull, 0xffffffffffffffffull ), 0xffffffffffffffffull );
+
+        // The product fits in 64 bits, but not once half of c is added, to round it.
+    CHECK_EQUAL( MulDiv( 0xffffffff, 0xffffffff, uint64( 1 ) << 40 ), uint64( 16777216 ) );
+    CHECK_EQUAL( MulDiv( 0xffffffff, 0xffffffff, (uint64( 1 ) << 63) + 1 ), uint64( 2 ) );
+    CHECK_EQUAL( MulDiv( 0xffffffff, 0xffffffff, uint64( 1 ) << 63 ), uint64( 2 ) );
+}
+
+
+    // Ticks converted to ns & back come out exactly as they went in (for as long as the
+    // timecodes fit in 64 bits).
+static void TestRoundTrip( Rational timebase )
+{
+    const uint64 ticks[] = { 0, 1, 2, 999, 1000, 1001, 29999, 48000, 3600 * 48000ull, uint64( 1 ) << 32 };
+    for (size_t i = 0; i < sizeof( ticks ) / sizeof( ticks[0] ); i++)
+    {
+        const uint64 timecode = TimebaseToTimecode( ticks[i], timebase );
+        CHECK_EQUAL( TimecodeToTimebase( timecode, timebase ), ticks[i] );
+    }
+}
+
+
+static void TestRescale()
+{
+    CHECK_EQUAL( TimebaseToTimecode( 48000, Rational( 1, 48000 ) ), uint64( 1000000000 ) );
+    CHECK_EQUAL( TimebaseToTimecode( 30000, Rational( 1001, 30000 ) ), uint64( 1001000000000ull ) );
+    CHECK_EQUAL( Rescale( 48000, Rational( 1, 48000 ), Rational( 1, 44100 ) ), uint64( 44100 ) );
+    CHECK_EQUAL( Rescale( 1, Rational( 1, 48000 ), Rational( 1, 1000 ) ), uint64( 0 ) );
+    CHECK_EQUAL( Rescale( 24, Rational( 1, 48000 ), Rational( 1, 1000 ) ), uint64( 1 ) );  // 0.5 rounds up.
+
+    TestRoundTrip( Rational( 1, 1000 ) );
+    TestRoundTrip( Rational( 1, 44100 ) );
+    TestRoundTrip( Rational( 1, 48000 ) );
+    TestRoundTrip( Rational( 1, 90000 ) );
+    TestRoundTrip( Rational( 1001, 30000 ) );
+    TestRoundTrip( Rational( 1001, 24000 ) );
+}
+
+
+static void TestApproximateRational()
+{
+    const Rational ntsc = ApproximateRational( 30000.0 / 1001.0 );
+    CHECK_EQUAL( ntsc.num, uint32( 30000 ) );
+    CHECK_EQUAL( ntsc.den, uint32( 1001 ) );
+
+    const Rational half = ApproximateRational( 0.5 );
+    CHECK_EQUAL( half.num, uint32( 1 ) );
+    CHECK_EQUAL( half.den, uint32( 2 ) );
+}
+
+
+int main()
+{
+    TestMulDiv();
+    TestRescale();
+    TestApproximateRational();
+    return CheckResult();
+}
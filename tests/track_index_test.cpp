@@ -0,0 +1,186 @@
+/*
+ *  Copyright (C) Matt Gruenke (github.com/mattgruenke) - 2017
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ */
+
+
+
+/*!
+    \file track_index_test.cpp
+    \brief Checks TrackIndex lookups & its sidecar format.
+*/
+
+#include "mkvreader/track_index.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+
+using namespace mkvreader;
+
+
+    // Builds an index of frames 40ms apart, 1000 bytes each, with a keyframe every 12.
+    // With B-frames, each group of 3 after the keyframe is stored as P, B, B, so the
+    // P frame's timecode precedes those of the B frames in the file.
+static TrackIndex MakeIndex( size_t count, bool b_frames, std::vector< FrameLocation > &frames )
+{
+    TrackIndex index;
+    frames.clear();
+    uint64 pos = 4096;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t display = i;
+        if (b_frames && i % 3 == 1) display = i + 2;
+        else if (b_frames && i > 0) display = i - 1;
+
+        FrameLocation frame;
+        frame.timecode = uint64( display ) * 40000000;
+        frame.filePos = pos;
+        frame.size = 1000 + uint32( i % 7 );
+        frame.keyframe = (i % 12 == 0);
+        index.Append( frame );
+        frames.push_back( frame );
+        pos += frame.size + 20;
+    }
+    return index;
+}
+
+
+static bool SameFrame( const FrameLocation &a, const FrameLocation &b )
+{
+    return a.timecode == b.timecode && a.filePos == b.filePos && a.size == b.size && a.keyframe == b.keyframe;
+}
+
+
+    // The reference for FindFrame(): the last frame, in file order, at or before timecode.
+static size_t FindFrameSlowly( const std::vector< FrameLocation > &frames, uint64 timecode )
+{
+    size_t found = TrackIndex::npos;
+    for (size_t i = 0; i < frames.size(); i++) if (frames[i].timecode <= timecode) found = i;
+    return found;
+}
+
+
+static void CheckLookups( const TrackIndex &index, const std::vector< FrameLocation > &frames )
+{
+    CHECK_EQUAL( index.GetFrameCount(), frames.size() );
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        CHECK( SameFrame( index.GetFrame( i ), frames[i] ) );
+        CHECK_EQUAL( index.FindKeyframe( i ), i / 12 * 12 );
+    }
+
+    for (uint64 timecode = 0; timecode < (frames.size() + 2) * 40000000; timecode += 10000000)
+    {
+        CHECK_EQUAL( index.FindFrame( timecode ), FindFrameSlowly( frames, timecode ) );
+    }
+}
+
+
+static void TestLookups()
+{
+    std::vector< FrameLocation > frames;
+    TrackIndex empty = MakeIndex( 0, false, frames );
+    CHECK_EQUAL( empty.FindFrame( 0 ), TrackIndex::npos );
+    CHECK_EQUAL( empty.FindKeyframe( 0 ), TrackIndex::npos );
+
+        // Chunk boundaries fall at multiples of ChunkSize.
+    const size_t counts[] = { 1, TrackIndex::ChunkSize, TrackIndex::ChunkSize + 1, 1000 };
+    for (size_t c = 0; c < sizeof( counts ) / sizeof( counts[0] ); c++)
+    {
+        CheckLookups( MakeIndex( counts[c], false, frames ), frames );
+        CheckLookups( MakeIndex( counts[c], true, frames ), frames );
+    }
+}
+
+
+static void TestSidecar()
+{
+    std::vector< FrameLocation > frames;
+    const TrackIndex index = MakeIndex( 1000, true, frames );
+
+    char filename[] = "/tmp/track_index_test.XXXXXX";
+    const int fd = mkstemp( filename );
+    CHECK( fd >= 0 );
+    if (fd >= 0) close( fd );
+    {
+        std::ofstream out( filename, std::ios::binary | std::ios::trunc );
+        index.Write( out );
+    }
+
+    TrackIndex loaded;
+    {
+        std::ifstream in( filename, std::ios::binary );
+        CHECK( loaded.Read( in ) );
+    }
+    remove( filename );
+    CheckLookups( loaded, frames );
+
+        // Appending resumes where the saved index left off.
+    FrameLocation next = frames.back();
+    next.timecode += 40000000;
+    next.filePos += next.size + 20;
+    next.keyframe = false;
+    loaded.Append( next );
+    frames.push_back( next );
+    CHECK( SameFrame( loaded.GetFrame( frames.size() - 1 ), next ) );
+    CHECK_EQUAL( loaded.FindFrame( next.timecode ), frames.size() - 1 );
+}
+
+
+static void TestCorruptSidecar()
+{
+    std::vector< FrameLocation > frames;
+    std::ostringstream out;
+    MakeIndex( 200, false, frames ).Write( out );
+    const std::string data = out.str();
+
+        // Truncated anywhere, it's rejected.
+    for (size_t size = 0; size < data.size(); size += 37)
+    {
+        std::istringstream in( data.substr( 0, size ) );
+        TrackIndex index;
+        CHECK( !index.Read( in ) );
+    }
+
+        // A chunk's data offset past the end is rejected.  It follows the chunk's first
+        // frame (8 + 8 + 4 + 1 bytes) & lastTimecode (8), after the 17-byte preamble.
+    std::string bad_offset = data;
+    bad_offset[17 + 29 + 3] = char( 0x7f );
+    std::istringstream in( bad_offset );
+    TrackIndex index;
+    CHECK( !index.Read( in ) );
+}
+
+
+int main()
+{
+    TestLookups();
+    TestSidecar();
+    TestCorruptSidecar();
+    return CheckResult();
+}